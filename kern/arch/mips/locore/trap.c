@@ -203,6 +203,17 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+		/*
+		 * If we interrupted a user thread whose process is
+		 * exiting, finish it off now instead of going back.
+		 * Sync the interrupt state first, as below.
+		 */
+		if (!iskern && curproc->p_exiting) {
+			spl = splhigh();
+			splx(spl);
+			proc_exitcheck();
+		}
 		goto done2;
 	}
 
@@ -323,6 +334,11 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	/* If another thread in our process called _exit, go with it. */
+	if (!iskern) {
+		proc_exitcheck();
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -444,3 +460,23 @@ enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 	mips_usermode(&tf);
 }
+
+/*
+ * Enter user mode in a new thread of the current process: call
+ * ENTRY(ARG) on the stack STACK. Like enter_new_process, this starts
+ * from a clean trapframe rather than a copy of the creator's.
+ */
+void
+enter_new_thread(vaddr_t entry, vaddr_t arg, vaddr_t stack)
+{
+	struct trapframe tf;
+
+	bzero(&tf, sizeof(tf));
+
+	tf.tf_status = CST_IRQMASK | CST_IEp | CST_KUp;
+	tf.tf_epc = entry;
+	tf.tf_a0 = arg;
+	tf.tf_sp = stack;
+
+	mips_usermode(&tf);
+}
@@ -32,11 +32,13 @@
 #include <kern/syscall.h>
 #include <endian.h>
 #include <lib.h>
+#include <clock.h>
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
 #include <copyinout.h>
 #include <syscall.h>
+#include <syscallstat.h>
 
 
 /*
@@ -83,6 +85,11 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+#if OPT_SYSCALLSTAT
+	struct timespec start;
+
+	gettime(&start);
+#endif
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -138,10 +145,47 @@ syscall(struct trapframe *tf)
 			&retval);
 		break;
 
+	    case SYS_waitmany:
+		err = sys_waitmany(
+			(userptr_t)tf->tf_a0,
+			(userptr_t)tf->tf_a1,
+			tf->tf_a2,
+			tf->tf_a3,
+			&retval);
+		break;
+
+	    case SYS_spawn:
+		err = sys_spawn(
+			(userptr_t)tf->tf_a0,
+			(userptr_t)tf->tf_a1,
+			(userptr_t)tf->tf_a2,
+			tf->tf_a3,
+			&retval);
+		break;
+
 	    case SYS_getpid:
 		err = sys_getpid(&retval);
 		break;
 
+	    case SYS___threadfork:
+		err = sys___threadfork(
+			(userptr_t)tf->tf_a0,
+			(userptr_t)tf->tf_a1,
+			&retval);
+		break;
+
+	    case SYS_threadexit:
+		sys_threadexit();
+		panic("Returning from threadexit\n");
+
+	    case SYS_futex:
+		err = sys_futex(
+			(userptr_t)tf->tf_a0,
+			tf->tf_a1,
+			tf->tf_a2,
+			&retval);
+		break;
+
 
 	    /* file calls */
 
@@ -164,6 +208,10 @@ syscall(struct trapframe *tf)
 		err = sys_close(tf->tf_a0);
 		break;
 
+	    case SYS_pipe:
+		err = sys_pipe((userptr_t)tf->tf_a0);
+		break;
+
 	    case SYS_read:
 		err = sys_read(
 			tf->tf_a0,
@@ -178,6 +226,82 @@ syscall(struct trapframe *tf)
 			tf->tf_a2,
 			&retval);
 		break;
+	    case SYS_readv:
+		err = sys_readv(
+			tf->tf_a0,
+			(const_userptr_t)tf->tf_a1,
+			tf->tf_a2,
+			&retval);
+		break;
+	    case SYS_writev:
+		err = sys_writev(
+			tf->tf_a0,
+			(const_userptr_t)tf->tf_a1,
+			tf->tf_a2,
+			&retval);
+		break;
+	    case SYS_pread:
+	    case SYS_pwrite:
+	    case SYS_preadv:
+	    case SYS_pwritev:
+		{
+			/*
+			 * The 64-bit position would go in a3 and the
+			 * next register, but it has to be aligned, so
+			 * it skips a3 and both halves end up on the
+			 * stack.
+			 */
+			off_t pos;
+
+			err = copyin((userptr_t)tf->tf_sp + 16,
+				     &pos, sizeof(pos));
+			if (err) {
+				break;
+			}
+
+			switch (callno) {
+			    case SYS_pread:
+				err = sys_pread(tf->tf_a0,
+						(userptr_t)tf->tf_a1,
+						tf->tf_a2, pos, &retval);
+				break;
+			    case SYS_pwrite:
+				err = sys_pwrite(tf->tf_a0,
+						 (userptr_t)tf->tf_a1,
+						 tf->tf_a2, pos, &retval);
+				break;
+			    case SYS_preadv:
+				err = sys_preadv(tf->tf_a0,
+						 (const_userptr_t)tf->tf_a1,
+						 tf->tf_a2, pos, &retval);
+				break;
+			    default:
+				err = sys_pwritev(tf->tf_a0,
+						  (const_userptr_t)tf->tf_a1,
+						  tf->tf_a2, pos, &retval);
+				break;
+			}
+		}
+		break;
+	    case SYS_copy_file_range:
+		{
+			/* The length and flags are on the stack. */
+			uint32_t stackargs[2];
+
+			err = copyin((userptr_t)tf->tf_sp + 16,
+				     stackargs, sizeof(stackargs));
+			if (err) {
+				break;
+			}
+			err = sys_copy_file_range(tf->tf_a0,
+						  (userptr_t)tf->tf_a1,
+						  tf->tf_a2,
+						  (userptr_t)tf->tf_a3,
+						  stackargs[0], stackargs[1],
+						  &retval);
+		}
+		break;
+
 	    case SYS_lseek:
 		{
 			/*
@@ -222,6 +346,45 @@ syscall(struct trapframe *tf)
 			&retval);
 		break;
 
+	    case SYS_semop:
+		err = sys_semop(
+			(const_userptr_t)tf->tf_a0,
+			tf->tf_a1);
+		break;
+
+	    case SYS_poll:
+		err = sys_poll(
+			(userptr_t)tf->tf_a0,
+			tf->tf_a1,
+			tf->tf_a2,
+			&retval);
+		break;
+
+	    case SYS_select:
+		{
+			/* The fifth argument is on the stack. */
+			userptr_t timeout;
+
+			err = copyin((userptr_t)tf->tf_sp + 16,
+				     &timeout, sizeof(timeout));
+			if (err) {
+				break;
+			}
+			err = sys_select(tf->tf_a0,
+					 (userptr_t)tf->tf_a1,
+					 (userptr_t)tf->tf_a2,
+					 (userptr_t)tf->tf_a3,
+					 timeout, &retval);
+		}
+		break;
+
+	    case SYS_uring_enter:
+		err = sys_uring_enter(
+			(userptr_t)tf->tf_a0,
+			tf->tf_a1,
+			&retval);
+		break;
+
 
 	    /* Even more system calls will go here */
 
@@ -232,6 +395,9 @@ syscall(struct trapframe *tf)
 		break;
 	}
 
+#if OPT_SYSCALLSTAT
+	syscallstat_record(callno, err, retval, &start);
+#endif
 
 	if (err) {
 		/*
@@ -58,6 +58,10 @@
 /* (this must be > 64K so argument blocks of size ARG_MAX will fit) */
 #define DUMBVM_STACKPAGES    18
 
+/* Bottom of the stack for user thread stack slot N. */
+#define DUMBVM_THREADSTACKBASE(n) \
+	(USERTHREADSTACK_TOP - ((n) + 1) * USERTHREADSTACK_PAGES * PAGE_SIZE)
+
 /*
  * Wrap ram_stealmem in a spinlock.
  */
@@ -122,6 +126,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
 	paddr_t paddr;
 	int i;
+	unsigned slot;
 	uint32_t ehi, elo;
 	struct addrspace *as;
 	int spl;
@@ -189,6 +194,17 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	else if (faultaddress >= stackbase && faultaddress < stacktop) {
 		paddr = (faultaddress - stackbase) + as->as_stackpbase;
 	}
+	else if (faultaddress >= DUMBVM_THREADSTACKBASE(USERTHREADSTACK_MAX-1)
+		 && faultaddress < USERTHREADSTACK_TOP) {
+		/* one of the thread stacks, if that slot has memory */
+		slot = (USERTHREADSTACK_TOP - 1 - faultaddress) /
+			(USERTHREADSTACK_PAGES * PAGE_SIZE);
+		if (as->as_threadstackpbase[slot] == 0) {
+			return EFAULT;
+		}
+		paddr = (faultaddress - DUMBVM_THREADSTACKBASE(slot)) +
+			as->as_threadstackpbase[slot];
+	}
 	else {
 		return EFAULT;
 	}
@@ -221,6 +237,8 @@ struct addrspace *
 as_create(void)
 {
 	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+	unsigned i;
+
 	if (as==NULL) {
 		return NULL;
 	}
@@ -232,6 +250,9 @@ as_create(void)
 	as->as_pbase2 = 0;
 	as->as_npages2 = 0;
 	as->as_stackpbase = 0;
+	for (i=0; i<USERTHREADSTACK_MAX; i++) {
+		as->as_threadstackpbase[i] = 0;
+	}
 
 	return as;
 }
@@ -360,10 +381,58 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * The stack is contiguous in physical memory, so it can be reached
+ * through the kernel's direct mapping.
+ */
+void *
+as_map_stack(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	vaddr_t stackbase;
+
+	KASSERT(as->as_stackpbase != 0);
+
+	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+	if (vaddr < stackbase || vaddr > USERSTACK ||
+	    len > USERSTACK - vaddr) {
+		return NULL;
+	}
+	return (void *)PADDR_TO_KVADDR(as->as_stackpbase +
+				       (vaddr - stackbase));
+}
+
+/*
+ * Thread stacks get physical memory the first time their slot is
+ * used; after that the slot keeps it (like everything else, it's
+ * never given back), and a thread reusing the slot gets it zeroed.
+ * Different slots can be set up at once by different threads, since
+ * each only touches its own entry.
+ */
+int
+as_define_threadstack(struct addrspace *as, unsigned slot, vaddr_t *stackptr)
+{
+	if (slot >= USERTHREADSTACK_MAX) {
+		return EINVAL;
+	}
+	if (as->as_threadstackpbase[slot] == 0) {
+		as->as_threadstackpbase[slot] =
+			getppages(USERTHREADSTACK_PAGES);
+		if (as->as_threadstackpbase[slot] == 0) {
+			return ENOMEM;
+		}
+	}
+	as_zero_region(as->as_threadstackpbase[slot], USERTHREADSTACK_PAGES);
+
+	*stackptr = USERTHREADSTACK_TOP -
+		slot * USERTHREADSTACK_PAGES * PAGE_SIZE;
+	return 0;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *new;
+	unsigned i;
 
 	new = as_create();
 	if (new==NULL) {
@@ -397,6 +466,21 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		(const void *)PADDR_TO_KVADDR(old->as_stackpbase),
 		DUMBVM_STACKPAGES*PAGE_SIZE);
 
+	/* Thread stacks too; the forking thread might be on one. */
+	for (i=0; i<USERTHREADSTACK_MAX; i++) {
+		if (old->as_threadstackpbase[i] == 0) {
+			continue;
+		}
+		new->as_threadstackpbase[i] = getppages(USERTHREADSTACK_PAGES);
+		if (new->as_threadstackpbase[i] == 0) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+		memmove((void *)PADDR_TO_KVADDR(new->as_threadstackpbase[i]),
+			(const void *)PADDR_TO_KVADDR(old->as_threadstackpbase[i]),
+			USERTHREADSTACK_PAGES*PAGE_SIZE);
+	}
+
 	*ret = new;
 	return 0;
 }
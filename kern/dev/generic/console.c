@@ -49,6 +49,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/poll.h>
 #include <lib.h>
 #include <uio.h>
 #include <cpu.h>
@@ -58,6 +59,7 @@
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
+#include <poll.h>
 #include "autoconf.h"
 
 /*
@@ -72,6 +74,11 @@ static struct con_softc *the_console = NULL;
 static struct lock *con_userlock_read = NULL;
 static struct lock *con_userlock_write = NULL;
 
+/*
+ * Threads in poll() waiting for input.
+ */
+static struct pollhead con_pollhead;
+
 //////////////////////////////////////////////////
 
 /*
@@ -134,21 +141,50 @@ putch_intr(struct con_softc *cs, int ch)
 }
 
 /*
- * Read a character, using interrupts to wait for I/O completion.
+ * Take a character out of the input buffer. The caller must have
+ * done P on cs_rsem.
  */
 static
-int
-getch_intr(struct con_softc *cs)
+unsigned char
+getch_take(struct con_softc *cs)
 {
 	unsigned char ret;
 
-	P(cs->cs_rsem);
 	ret = cs->cs_gotchars[cs->cs_gotchars_tail];
 	cs->cs_gotchars_tail =
 		(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
 	return ret;
 }
 
+/*
+ * Read a character, using interrupts to wait for I/O completion.
+ */
+static
+int
+getch_intr(struct con_softc *cs)
+{
+	P(cs->cs_rsem);
+	return getch_take(cs);
+}
+
+/*
+ * Read a character on behalf of a user process. Like getch_intr, but
+ * gives up with EINTR if the process is exiting.
+ */
+static
+int
+getch_user(struct con_softc *cs, char *ch)
+{
+	int result;
+
+	result = P_intr(cs->cs_rsem);
+	if (result) {
+		return result;
+	}
+	*ch = getch_take(cs);
+	return 0;
+}
+
 /*
  * Called from underlying device when a read-ready interrupt occurs.
  *
@@ -174,6 +210,7 @@ con_input(void *vcs, int ch)
 	cs->cs_gotchars_head = nexthead;
 
 	V(cs->cs_rsem);
+	pollwakeup(&con_pollhead);
 }
 
 /*
@@ -262,7 +299,11 @@ con_io(struct device *dev, struct uio *uio)
 
 	while (uio->uio_resid > 0) {
 		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
+			result = getch_user(the_console, &ch);
+			if (result) {
+				lock_release(lk);
+				return result;
+			}
 			if (ch=='\r') {
 				ch = '\n';
 			}
@@ -302,10 +343,31 @@ con_ioctl(struct device *dev, int op, userptr_t data)
 	return EINVAL;
 }
 
+/*
+ * Readable when there's a character waiting. (A read waits for a
+ * whole line, so it can still block if the line isn't finished.)
+ * Output is always possible.
+ */
+static
+int
+con_poll(struct device *dev, int events, struct pollwaiter *pw)
+{
+	struct con_softc *cs = dev->d_data;
+	int revents;
+
+	pollwait(&con_pollhead, pw);
+	revents = events & POLLOUT;
+	if (cs->cs_gotchars_head != cs->cs_gotchars_tail) {
+		revents |= events & POLLIN;
+	}
+	return revents;
+}
+
 static const struct device_ops console_devops = {
 	.devop_eachopen = con_eachopen,
 	.devop_io = con_io,
 	.devop_ioctl = con_ioctl,
+	.devop_poll = con_poll,
 };
 
 static
@@ -386,6 +448,7 @@ config_con(struct con_softc *cs, int unit)
 	cs->cs_wsem = wsem;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	pollhead_init(&con_pollhead);
 
 	the_console = cs;
 	con_userlock_read = rlk;
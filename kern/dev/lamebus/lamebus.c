@@ -530,6 +530,10 @@ lamebus_interrupt(struct lamebus_softc *lamebus)
 		data = lamebus->ls_devdata[slot];
 		spinlock_release(&lamebus->ls_lock);
 
+		if (slot < CPUSTAT_NIRQ) {
+			curcpu->c_stat.cs_irqs[slot]++;
+		}
+
 		handler(data);
 
 		spinlock_acquire(&lamebus->ls_lock);
@@ -33,6 +33,7 @@
 #include <array.h>
 #include <fs.h>
 #include <vnode.h>
+#include <poll.h>
 
 #ifndef SEMFS_INLINE
 #define SEMFS_INLINE INLINE
@@ -43,6 +44,7 @@
  */
 
 #define SEMFS_ROOTDIR	0xffffffffU		/* semnum for root dir */
+#define SEMFS_DIRHASH	64			/* buckets in name hash */
 
 /*
  * A user-facing semaphore.
@@ -55,8 +57,10 @@ struct semfs_sem {
 	struct lock *sems_lock;			/* Lock to protect count */
 	struct cv *sems_cv;			/* CV to wait */
 	unsigned sems_count;			/* Semaphore count */
+	unsigned sems_batchwaiters;		/* semop()s waiting on us */
 	bool sems_hasvnode;			/* The vnode exists */
 	bool sems_linked;			/* In the directory */
+	struct pollhead sems_pollhead;		/* poll()ers waiting for V */
 };
 DECLARRAY(semfs_sem, SEMFS_INLINE);
 
@@ -66,6 +70,8 @@ DECLARRAY(semfs_sem, SEMFS_INLINE);
 struct semfs_direntry {
 	char *semd_name;			/* Name */
 	unsigned semd_semnum;			/* Which semaphore */
+	unsigned semd_slot;			/* Index in semfs_dents */
+	struct semfs_direntry *semd_hashnext;	/* Next in hash chain */
 };
 DECLARRAY(semfs_direntry, SEMFS_INLINE);
 
@@ -82,6 +88,16 @@ struct semfs_vnode {
 	unsigned semv_semnum;			/* Which semaphore */
 };
 
+/*
+ * Stack of free slot numbers in one of the arrays below, so finding
+ * a slot for a new entry doesn't mean scanning the whole array.
+ */
+struct semfs_freelist {
+	unsigned *sfl_slots;
+	unsigned sfl_num;
+	unsigned sfl_max;
+};
+
 /*
  * The structure for the semaphore file system. Ordinarily there
  * is only one of these.
@@ -89,12 +105,18 @@ struct semfs_vnode {
 struct semfs {
 	struct fs semfs_absfs;			/* Abstract fs object */
 
-	struct lock *semfs_tablelock;		/* Lock for following */
+	struct rwlock *semfs_tablelock;		/* Lock for following */
 	struct vnodearray *semfs_vnodes;	/* Currently extant vnodes */
 	struct semfs_semarray *semfs_sems;	/* Semaphores */
+	struct semfs_freelist semfs_freesems;	/* Free slots in semfs_sems */
 
 	struct lock *semfs_dirlock;		/* Lock for following */
 	struct semfs_direntryarray *semfs_dents; /* The root directory */
+	struct semfs_freelist semfs_freedents;	/* Free slots in semfs_dents */
+	struct semfs_direntry *semfs_dirhash[SEMFS_DIRHASH]; /* By name */
+
+	struct lock *semfs_oplock;		/* Lock for semop() sleeps */
+	struct cv *semfs_opcv;			/* CV for semop() sleeps */
 };
 
 /*
@@ -110,11 +132,17 @@ DEFARRAY(semfs_direntry, SEMFS_INLINE);
  */
 
 /* in semfs_obj.c */
+void semfs_freelist_init(struct semfs_freelist *);
+void semfs_freelist_cleanup(struct semfs_freelist *);
 struct semfs_sem *semfs_sem_create(const char *name);
 int semfs_sem_insert(struct semfs *, struct semfs_sem *, unsigned *);
+void semfs_sem_remove(struct semfs *, unsigned semnum);
 void semfs_sem_destroy(struct semfs_sem *);
 struct semfs_direntry *semfs_direntry_create(const char *name, unsigned semno);
 void semfs_direntry_destroy(struct semfs_direntry *);
+struct semfs_direntry *semfs_dir_find(struct semfs *, const char *name);
+int semfs_dir_insert(struct semfs *, struct semfs_direntry *);
+void semfs_dir_remove(struct semfs *, struct semfs_direntry *);
 
 /* in semfs_vnops.c */
 int semfs_getvnode(struct semfs *, unsigned, struct vnode **ret);
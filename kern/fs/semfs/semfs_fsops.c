@@ -109,11 +109,15 @@ semfs_destroy(struct semfs *semfs)
 	}
 	semfs_direntryarray_setsize(semfs->semfs_dents, 0);
 
+	cv_destroy(semfs->semfs_opcv);
+	lock_destroy(semfs->semfs_oplock);
+	semfs_freelist_cleanup(&semfs->semfs_freedents);
 	semfs_direntryarray_destroy(semfs->semfs_dents);
 	lock_destroy(semfs->semfs_dirlock);
+	semfs_freelist_cleanup(&semfs->semfs_freesems);
 	semfs_semarray_destroy(semfs->semfs_sems);
 	vnodearray_destroy(semfs->semfs_vnodes);
-	lock_destroy(semfs->semfs_tablelock);
+	rwlock_destroy(semfs->semfs_tablelock);
 	kfree(semfs);
 }
 
@@ -127,13 +131,13 @@ semfs_unmount(struct fs *fs)
 {
 	struct semfs *semfs = fs->fs_data;
 
-	lock_acquire(semfs->semfs_tablelock);
+	rwlock_acquire_read(semfs->semfs_tablelock);
 	if (vnodearray_num(semfs->semfs_vnodes) > 0) {
-		lock_release(semfs->semfs_tablelock);
+		rwlock_release_read(semfs->semfs_tablelock);
 		return EBUSY;
 	}
 
-	lock_release(semfs->semfs_tablelock);
+	rwlock_release_read(semfs->semfs_tablelock);
 	semfs_destroy(semfs);
 
 	return 0;
@@ -157,13 +161,14 @@ struct semfs *
 semfs_create(void)
 {
 	struct semfs *semfs;
+	unsigned i;
 
 	semfs = kmalloc(sizeof(*semfs));
 	if (semfs == NULL) {
 		goto fail_total;
 	}
 
-	semfs->semfs_tablelock = lock_create("semfs_table");
+	semfs->semfs_tablelock = rwlock_create("semfs_table");
 	if (semfs->semfs_tablelock == NULL) {
 		goto fail_semfs;
 	}
@@ -184,11 +189,30 @@ semfs_create(void)
 	if (semfs->semfs_dents == NULL) {
 		goto fail_dirlock;
 	}
+	for (i=0; i<SEMFS_DIRHASH; i++) {
+		semfs->semfs_dirhash[i] = NULL;
+	}
+
+	semfs->semfs_oplock = lock_create("semfs_op");
+	if (semfs->semfs_oplock == NULL) {
+		goto fail_dents;
+	}
+	semfs->semfs_opcv = cv_create("semfs_op");
+	if (semfs->semfs_opcv == NULL) {
+		goto fail_oplock;
+	}
+
+	semfs_freelist_init(&semfs->semfs_freesems);
+	semfs_freelist_init(&semfs->semfs_freedents);
 
 	semfs->semfs_absfs.fs_data = semfs;
 	semfs->semfs_absfs.fs_ops = &semfs_fsops;
 	return semfs;
 
+ fail_oplock:
+	lock_destroy(semfs->semfs_oplock);
+ fail_dents:
+	semfs_direntryarray_destroy(semfs->semfs_dents);
  fail_dirlock:
 	lock_destroy(semfs->semfs_dirlock);
  fail_sems:
@@ -196,7 +220,7 @@ semfs_create(void)
  fail_vnodes:
 	vnodearray_destroy(semfs->semfs_vnodes);
  fail_tablelock:
-	lock_destroy(semfs->semfs_tablelock);
+	rwlock_destroy(semfs->semfs_tablelock);
  fail_semfs:
 	kfree(semfs);
  fail_total:
@@ -34,6 +34,72 @@
 #define SEMFS_INLINE
 #include "semfs.h"
 
+////////////////////////////////////////////////////////////
+// semfs_freelist
+
+/*
+ * Initializer for semfs_freelist.
+ */
+void
+semfs_freelist_init(struct semfs_freelist *fl)
+{
+	fl->sfl_slots = NULL;
+	fl->sfl_num = 0;
+	fl->sfl_max = 0;
+}
+
+/*
+ * Cleanup for semfs_freelist.
+ */
+void
+semfs_freelist_cleanup(struct semfs_freelist *fl)
+{
+	kfree(fl->sfl_slots);
+	fl->sfl_slots = NULL;
+	fl->sfl_num = fl->sfl_max = 0;
+}
+
+/*
+ * Remember that SLOT is free. If we can't get memory to remember it,
+ * the slot just stays empty and unused, which is harmless.
+ */
+static
+void
+semfs_freelist_push(struct semfs_freelist *fl, unsigned slot)
+{
+	unsigned *newslots;
+	unsigned newmax, i;
+
+	if (fl->sfl_num == fl->sfl_max) {
+		newmax = fl->sfl_max ? fl->sfl_max * 2 : 8;
+		newslots = kmalloc(newmax * sizeof(unsigned));
+		if (newslots == NULL) {
+			return;
+		}
+		for (i=0; i<fl->sfl_num; i++) {
+			newslots[i] = fl->sfl_slots[i];
+		}
+		kfree(fl->sfl_slots);
+		fl->sfl_slots = newslots;
+		fl->sfl_max = newmax;
+	}
+	fl->sfl_slots[fl->sfl_num++] = slot;
+}
+
+/*
+ * Get a free slot, if there is one.
+ */
+static
+bool
+semfs_freelist_pop(struct semfs_freelist *fl, unsigned *ret)
+{
+	if (fl->sfl_num == 0) {
+		return false;
+	}
+	*ret = fl->sfl_slots[--fl->sfl_num];
+	return true;
+}
+
 ////////////////////////////////////////////////////////////
 // semfs_sem
 
@@ -63,8 +129,10 @@ semfs_sem_create(const char *name)
 		goto fail_lock;
 	}
 	sem->sems_count = 0;
+	sem->sems_batchwaiters = 0;
 	sem->sems_hasvnode = false;
 	sem->sems_linked = false;
+	pollhead_init(&sem->sems_pollhead);
 	return sem;
 
  fail_lock:
@@ -81,6 +149,7 @@ semfs_sem_create(const char *name)
 void
 semfs_sem_destroy(struct semfs_sem *sem)
 {
+	pollhead_cleanup(&sem->sems_pollhead);
 	cv_destroy(sem->sems_cv);
 	lock_destroy(sem->sems_lock);
 	kfree(sem);
@@ -94,22 +163,32 @@ semfs_sem_insert(struct semfs *semfs, struct semfs_sem *sem, unsigned *ret)
 {
 	unsigned i, num;
 
-	KASSERT(lock_do_i_hold(semfs->semfs_tablelock));
+	KASSERT(rwlock_do_i_hold_write(semfs->semfs_tablelock));
+	if (semfs_freelist_pop(&semfs->semfs_freesems, &i)) {
+		KASSERT(semfs_semarray_get(semfs->semfs_sems, i) == NULL);
+		semfs_semarray_set(semfs->semfs_sems, i, sem);
+		*ret = i;
+		return 0;
+	}
 	num = semfs_semarray_num(semfs->semfs_sems);
 	if (num == SEMFS_ROOTDIR) {
 		/* Too many */
 		return ENOSPC;
 	}
-	for (i=0; i<num; i++) {
-		if (semfs_semarray_get(semfs->semfs_sems, i) == NULL) {
-			semfs_semarray_set(semfs->semfs_sems, i, sem);
-			*ret = i;
-			return 0;
-		}
-	}
 	return semfs_semarray_add(semfs->semfs_sems, sem, ret);
 }
 
+/*
+ * Helper to take a semfs_sem out of the semaphore table.
+ */
+void
+semfs_sem_remove(struct semfs *semfs, unsigned semnum)
+{
+	KASSERT(rwlock_do_i_hold_write(semfs->semfs_tablelock));
+	semfs_semarray_set(semfs->semfs_sems, semnum, NULL);
+	semfs_freelist_push(&semfs->semfs_freesems, semnum);
+}
+
 ////////////////////////////////////////////////////////////
 // semfs_direntry
 
@@ -131,6 +210,8 @@ semfs_direntry_create(const char *name, unsigned semnum)
 		return NULL;
 	}
 	dent->semd_semnum = semnum;
+	dent->semd_slot = 0;
+	dent->semd_hashnext = NULL;
 	return dent;
 }
 
@@ -143,3 +224,89 @@ semfs_direntry_destroy(struct semfs_direntry *dent)
 	kfree(dent->semd_name);
 	kfree(dent);
 }
+
+////////////////////////////////////////////////////////////
+// directory
+
+/*
+ * Hash function for names in the directory.
+ */
+static
+unsigned
+semfs_dirhash(const char *name)
+{
+	unsigned h = 0;
+
+	while (*name != 0) {
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h % SEMFS_DIRHASH;
+}
+
+/*
+ * Look up a directory entry by name.
+ */
+struct semfs_direntry *
+semfs_dir_find(struct semfs *semfs, const char *name)
+{
+	struct semfs_direntry *dent;
+
+	KASSERT(lock_do_i_hold(semfs->semfs_dirlock));
+	for (dent = semfs->semfs_dirhash[semfs_dirhash(name)];
+	     dent != NULL; dent = dent->semd_hashnext) {
+		if (!strcmp(dent->semd_name, name)) {
+			return dent;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Add a directory entry, reusing an empty slot if there is one.
+ */
+int
+semfs_dir_insert(struct semfs *semfs, struct semfs_direntry *dent)
+{
+	unsigned slot, bucket;
+	int result;
+
+	KASSERT(lock_do_i_hold(semfs->semfs_dirlock));
+	if (semfs_freelist_pop(&semfs->semfs_freedents, &slot)) {
+		KASSERT(semfs_direntryarray_get(semfs->semfs_dents,
+						slot) == NULL);
+		semfs_direntryarray_set(semfs->semfs_dents, slot, dent);
+	}
+	else {
+		result = semfs_direntryarray_add(semfs->semfs_dents, dent,
+						 &slot);
+		if (result) {
+			return result;
+		}
+	}
+	dent->semd_slot = slot;
+
+	bucket = semfs_dirhash(dent->semd_name);
+	dent->semd_hashnext = semfs->semfs_dirhash[bucket];
+	semfs->semfs_dirhash[bucket] = dent;
+	return 0;
+}
+
+/*
+ * Remove a directory entry. Does not destroy it.
+ */
+void
+semfs_dir_remove(struct semfs *semfs, struct semfs_direntry *dent)
+{
+	struct semfs_direntry **dp;
+
+	KASSERT(lock_do_i_hold(semfs->semfs_dirlock));
+	for (dp = &semfs->semfs_dirhash[semfs_dirhash(dent->semd_name)];
+	     *dp != dent; dp = &(*dp)->semd_hashnext) {
+		KASSERT(*dp != NULL);
+	}
+	*dp = dent->semd_hashnext;
+	dent->semd_hashnext = NULL;
+
+	semfs_direntryarray_set(semfs->semfs_dents, dent->semd_slot, NULL);
+	semfs_freelist_push(&semfs->semfs_freedents, dent->semd_slot);
+}
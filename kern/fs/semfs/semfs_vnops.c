@@ -30,6 +30,8 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/poll.h>
+#include <kern/sem.h>
 #include <stat.h>
 #include <uio.h>
 #include <synch.h>
@@ -116,9 +118,9 @@ semfs_getsembynum(struct semfs *semfs, unsigned semnum)
 {
 	struct semfs_sem *sem;
 
-	lock_acquire(semfs->semfs_tablelock);
+	rwlock_acquire_read(semfs->semfs_tablelock);
 	sem = semfs_semarray_get(semfs->semfs_sems, semnum);
-	lock_release(semfs->semfs_tablelock);
+	rwlock_release_read(semfs->semfs_tablelock);
 
 	return sem;
 }
@@ -137,11 +139,19 @@ semfs_getsem(struct semfs_vnode *semv)
  * should only be the case if the old count is 0; and we only
  * potentially need to wake more than one sleeper if the new count
  * will be more than 1.
+ *
+ * semop() callers may be waiting for more than one unit, so they get
+ * woken on any increase.
  */
 static
 void
-semfs_wakeup(struct semfs_sem *sem, unsigned newcount)
+semfs_wakeup(struct semfs *semfs, struct semfs_sem *sem, unsigned newcount)
 {
+	if (sem->sems_batchwaiters > 0 && newcount > sem->sems_count) {
+		lock_acquire(semfs->semfs_oplock);
+		cv_broadcast(semfs->semfs_opcv, semfs->semfs_oplock);
+		lock_release(semfs->semfs_oplock);
+	}
 	if (sem->sems_count > 0 || newcount == 0) {
 		return;
 	}
@@ -191,6 +201,7 @@ semfs_read(struct vnode *vn, struct uio *uio)
 	struct semfs_vnode *semv = vn->vn_data;
 	struct semfs_sem *sem;
 	size_t consume;
+	int result;
 
 	sem = semfs_getsem(semv);
 
@@ -214,7 +225,12 @@ semfs_read(struct vnode *vn, struct uio *uio)
 		if (sem->sems_count == 0) {
 			DEBUG(DB_SEMFS, "semfs: sem%u: blocking\n",
 			      semv->semv_semnum);
-			cv_wait(sem->sems_cv, sem->sems_lock);
+			result = cv_wait_intr(sem->sems_cv, sem->sems_lock);
+			if (result) {
+				/* exiting; what we took stays taken */
+				lock_release(sem->sems_lock);
+				return result;
+			}
 		}
 	}
 	lock_release(sem->sems_lock);
@@ -245,9 +261,10 @@ semfs_write(struct vnode *vn, struct uio *uio)
 		}
 		DEBUG(DB_SEMFS, "semfs: sem%u: V, count %u -> %u\n",
 		      semv->semv_semnum, sem->sems_count, newcount);
-		semfs_wakeup(sem, newcount);
+		semfs_wakeup(semv->semv_semfs, sem, newcount);
 		sem->sems_count = newcount;
 		uio->uio_resid = 0;
+		pollwakeup(&sem->sems_pollhead);
 	}
 	lock_release(sem->sems_lock);
 	return 0;
@@ -282,13 +299,41 @@ semfs_truncate(struct vnode *vn, off_t len)
 	sem = semfs_getsem(semv);
 
 	lock_acquire(sem->sems_lock);
-	semfs_wakeup(sem, newcount);
+	semfs_wakeup(semv->semv_semfs, sem, newcount);
 	sem->sems_count = newcount;
+	if (newcount > 0) {
+		pollwakeup(&sem->sems_pollhead);
+	}
 	lock_release(sem->sems_lock);
 
 	return 0;
 }
 
+/*
+ * Poll. A semaphore is readable (P won't block) while its count is
+ * nonzero; V never blocks.
+ */
+static
+int
+semfs_poll(struct vnode *vn, int events, struct pollwaiter *pw)
+{
+	struct semfs_vnode *semv = vn->vn_data;
+	struct semfs_sem *sem;
+	int revents;
+
+	sem = semfs_getsem(semv);
+
+	lock_acquire(sem->sems_lock);
+	pollwait(&sem->sems_pollhead, pw);
+	revents = events & POLLOUT;
+	if (sem->sems_count > 0) {
+		revents |= events & POLLIN;
+	}
+	lock_release(sem->sems_lock);
+
+	return revents;
+}
+
 ////////////////////////////////////////////////////////////
 // directory ops
 
@@ -376,7 +421,7 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 	struct semfs *semfs = dirsemv->semv_semfs;
 	struct semfs_direntry *dent;
 	struct semfs_sem *sem;
-	unsigned i, num, empty, semnum;
+	unsigned semnum;
 	int result;
 
 	(void)mode;
@@ -385,27 +430,16 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 	}
 
 	lock_acquire(semfs->semfs_dirlock);
-	num = semfs_direntryarray_num(semfs->semfs_dents);
-	empty = num;
-	for (i=0; i<num; i++) {
-		dent = semfs_direntryarray_get(semfs->semfs_dents, i);
-		if (dent == NULL) {
-			if (empty == num) {
-				empty = i;
-			}
-			continue;
-		}
-		if (!strcmp(dent->semd_name, name)) {
-			/* found */
-			if (excl) {
-				lock_release(semfs->semfs_dirlock);
-				return EEXIST;
-			}
-			result = semfs_getvnode(semfs, dent->semd_semnum,
-						resultvn);
+	dent = semfs_dir_find(semfs, name);
+	if (dent != NULL) {
+		/* found */
+		if (excl) {
 			lock_release(semfs->semfs_dirlock);
-			return result;
+			return EEXIST;
 		}
+		result = semfs_getvnode(semfs, dent->semd_semnum, resultvn);
+		lock_release(semfs->semfs_dirlock);
+		return result;
 	}
 
 	/* create it */
@@ -414,9 +448,9 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 		result = ENOMEM;
 		goto fail_unlock;
 	}
-	lock_acquire(semfs->semfs_tablelock);
+	rwlock_acquire_write(semfs->semfs_tablelock);
 	result = semfs_sem_insert(semfs, sem, &semnum);
-	lock_release(semfs->semfs_tablelock);
+	rwlock_release_write(semfs->semfs_tablelock);
 	if (result) {
 		goto fail_uncreate;
 	}
@@ -426,15 +460,9 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 		goto fail_uninsert;
 	}
 
-	if (empty < num) {
-		semfs_direntryarray_set(semfs->semfs_dents, empty, dent);
-	}
-	else {
-		result = semfs_direntryarray_add(semfs->semfs_dents, dent,
-						 &empty);
-		if (result) {
-			goto fail_undent;
-		}
+	result = semfs_dir_insert(semfs, dent);
+	if (result) {
+		goto fail_undent;
 	}
 
 	result = semfs_getvnode(semfs, semnum, resultvn);
@@ -447,13 +475,13 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 	return 0;
 
  fail_undir:
-	semfs_direntryarray_set(semfs->semfs_dents, empty, NULL);
+	semfs_dir_remove(semfs, dent);
  fail_undent:
 	semfs_direntry_destroy(dent);
  fail_uninsert:
-	lock_acquire(semfs->semfs_tablelock);
-	semfs_semarray_set(semfs->semfs_sems, semnum, NULL);
-	lock_release(semfs->semfs_tablelock);
+	rwlock_acquire_write(semfs->semfs_tablelock);
+	semfs_sem_remove(semfs, semnum);
+	rwlock_release_write(semfs->semfs_tablelock);
  fail_uncreate:
 	semfs_sem_destroy(sem);
  fail_unlock:
@@ -473,47 +501,37 @@ semfs_remove(struct vnode *dirvn, const char *name)
 	struct semfs *semfs = dirsemv->semv_semfs;
 	struct semfs_direntry *dent;
 	struct semfs_sem *sem;
-	unsigned i, num;
-	int result;
 
 	if (!strcmp(name, ".") || !strcmp(name, "..")) {
 		return EINVAL;
 	}
 
 	lock_acquire(semfs->semfs_dirlock);
-	num = semfs_direntryarray_num(semfs->semfs_dents);
-	for (i=0; i<num; i++) {
-		dent = semfs_direntryarray_get(semfs->semfs_dents, i);
-		if (dent == NULL) {
-			continue;
-		}
-		if (!strcmp(name, dent->semd_name)) {
-			/* found */
-			sem = semfs_getsembynum(semfs, dent->semd_semnum);
-			lock_acquire(sem->sems_lock);
-			KASSERT(sem->sems_linked);
-			sem->sems_linked = false;
-			if (sem->sems_hasvnode == false) {
-				lock_acquire(semfs->semfs_tablelock);
-				semfs_semarray_set(semfs->semfs_sems,
-						   dent->semd_semnum, NULL);
-				lock_release(semfs->semfs_tablelock);
-				lock_release(sem->sems_lock);
-				semfs_sem_destroy(sem);
-			}
-			else {
-				lock_release(sem->sems_lock);
-			}
-			semfs_direntryarray_set(semfs->semfs_dents, i, NULL);
-			semfs_direntry_destroy(dent);
-			result = 0;
-			goto out;
-		}
+	dent = semfs_dir_find(semfs, name);
+	if (dent == NULL) {
+		lock_release(semfs->semfs_dirlock);
+		return ENOENT;
+	}
+
+	sem = semfs_getsembynum(semfs, dent->semd_semnum);
+	lock_acquire(sem->sems_lock);
+	KASSERT(sem->sems_linked);
+	sem->sems_linked = false;
+	if (sem->sems_hasvnode == false) {
+		rwlock_acquire_write(semfs->semfs_tablelock);
+		semfs_sem_remove(semfs, dent->semd_semnum);
+		rwlock_release_write(semfs->semfs_tablelock);
+		lock_release(sem->sems_lock);
+		semfs_sem_destroy(sem);
 	}
-	result = ENOENT;
- out:
+	else {
+		lock_release(sem->sems_lock);
+	}
+	semfs_dir_remove(semfs, dent);
+	semfs_direntry_destroy(dent);
+
 	lock_release(semfs->semfs_dirlock);
-	return result;
+	return 0;
 }
 
 /*
@@ -526,7 +544,6 @@ semfs_lookup(struct vnode *dirvn, char *path, struct vnode **resultvn)
 	struct semfs_vnode *dirsemv = dirvn->vn_data;
 	struct semfs *semfs = dirsemv->semv_semfs;
 	struct semfs_direntry *dent;
-	unsigned i, num;
 	int result;
 
 	if (!strcmp(path, ".") || !strcmp(path, "..")) {
@@ -536,21 +553,14 @@ semfs_lookup(struct vnode *dirvn, char *path, struct vnode **resultvn)
 	}
 
 	lock_acquire(semfs->semfs_dirlock);
-	num = semfs_direntryarray_num(semfs->semfs_dents);
-	for (i=0; i<num; i++) {
-		dent = semfs_direntryarray_get(semfs->semfs_dents, i);
-		if (dent == NULL) {
-			continue;
-		}
-		if (!strcmp(path, dent->semd_name)) {
-			result = semfs_getvnode(semfs, dent->semd_semnum,
-						resultvn);
-			lock_release(semfs->semfs_dirlock);
-			return result;
-		}
+	dent = semfs_dir_find(semfs, path);
+	if (dent == NULL) {
+		lock_release(semfs->semfs_dirlock);
+		return ENOENT;
 	}
+	result = semfs_getvnode(semfs, dent->semd_semnum, resultvn);
 	lock_release(semfs->semfs_dirlock);
-	return ENOENT;
+	return result;
 }
 
 /*
@@ -599,7 +609,7 @@ semfs_reclaim(struct vnode *vn)
 	struct semfs_sem *sem;
 	unsigned i, num;
 
-	lock_acquire(semfs->semfs_tablelock);
+	rwlock_acquire_write(semfs->semfs_tablelock);
 
 	/* vnode refcount is protected by the vnode's ->vn_countlock */
 	spinlock_acquire(&vn->vn_countlock);
@@ -608,7 +618,7 @@ semfs_reclaim(struct vnode *vn)
 		vn->vn_refcount--;
 
 		spinlock_release(&vn->vn_countlock);
-		lock_release(semfs->semfs_tablelock);
+		rwlock_release_write(semfs->semfs_tablelock);
 		return EBUSY;
 	}
 
@@ -629,14 +639,13 @@ semfs_reclaim(struct vnode *vn)
 		KASSERT(sem->sems_hasvnode);
 		sem->sems_hasvnode = false;
 		if (sem->sems_linked == false) {
-			semfs_semarray_set(semfs->semfs_sems,
-					   semv->semv_semnum, NULL);
+			semfs_sem_remove(semfs, semv->semv_semnum);
 			semfs_sem_destroy(sem);
 		}
 	}
 
 	/* done with the table */
-	lock_release(semfs->semfs_tablelock);
+	rwlock_release_write(semfs->semfs_tablelock);
 
 	/* destroy it */
 	semfs_vnode_destroy(semv);
@@ -664,6 +673,7 @@ static const struct vnode_ops semfs_dirops = {
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
 	.vop_namefile = semfs_namefile,
+	.vop_poll = vopready_poll,
 
 	.vop_creat = semfs_creat,
 	.vop_symlink = vopfail_symlink_nosys,
@@ -697,6 +707,7 @@ static const struct vnode_ops semfs_semops = {
 	.vop_mmap = vopfail_mmap_perm,
 	.vop_truncate = semfs_truncate,
 	.vop_namefile = vopfail_uio_notdir,
+	.vop_poll = semfs_poll,
 
 	.vop_creat = vopfail_creat_notdir,
 	.vop_symlink = vopfail_symlink_notdir,
@@ -757,7 +768,7 @@ semfs_getvnode(struct semfs *semfs, unsigned semnum, struct vnode **ret)
 	int result;
 
 	/* Lock the vnode table */
-	lock_acquire(semfs->semfs_tablelock);
+	rwlock_acquire_write(semfs->semfs_tablelock);
 
 	/* Look for it */
 	num = vnodearray_num(semfs->semfs_vnodes);
@@ -766,7 +777,7 @@ semfs_getvnode(struct semfs *semfs, unsigned semnum, struct vnode **ret)
 		semv = vn->vn_data;
 		if (semv->semv_semnum == semnum) {
 			VOP_INCREF(vn);
-			lock_release(semfs->semfs_tablelock);
+			rwlock_release_write(semfs->semfs_tablelock);
 			*ret = vn;
 			return 0;
 		}
@@ -775,13 +786,13 @@ semfs_getvnode(struct semfs *semfs, unsigned semnum, struct vnode **ret)
 	/* Make it */
 	semv = semfs_vnode_create(semfs, semnum);
 	if (semv == NULL) {
-		lock_release(semfs->semfs_tablelock);
+		rwlock_release_write(semfs->semfs_tablelock);
 		return ENOMEM;
 	}
 	result = vnodearray_add(semfs->semfs_vnodes, &semv->semv_absvn, NULL);
 	if (result) {
 		semfs_vnode_destroy(semv);
-		lock_release(semfs->semfs_tablelock);
+		rwlock_release_write(semfs->semfs_tablelock);
 		return ENOMEM;
 	}
 	if (semnum != SEMFS_ROOTDIR) {
@@ -790,8 +801,161 @@ semfs_getvnode(struct semfs *semfs, unsigned semnum, struct vnode **ret)
 		KASSERT(sem->sems_hasvnode == false);
 		sem->sems_hasvnode = true;
 	}
-	lock_release(semfs->semfs_tablelock);
+	rwlock_release_write(semfs->semfs_tablelock);
 
 	*ret = &semv->semv_absvn;
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// batched ops
+
+struct semfs_semop {
+	unsigned sso_semnum;
+	struct semfs_sem *sso_sem;
+	int sso_op;
+};
+
+/*
+ * semop(): apply P (negative) and V (positive) operations to several
+ * semaphores at once. Nothing happens until every P can be satisfied;
+ * then the whole batch is applied with all the semaphores locked.
+ *
+ * The semaphores are locked in semnum order, so two batches can't
+ * deadlock against each other. To wait, we mark each semaphore as
+ * having a batch waiter and sleep on the fs-wide semop cv;
+ * semfs_wakeup kicks that cv when any of them is raised.
+ */
+int
+semfs_semop(struct vnode **vns, const int *ops, unsigned nops)
+{
+	/* No INT_MAX in the kernel either */
+	const int opmax = 0x7fffffff;
+	const int opmin = -opmax - 1;
+
+	struct semfs_semop sops[SEMOP_MAX], tmp;
+	struct semfs_vnode *semv;
+	struct semfs *semfs;
+	struct semfs_sem *sem;
+	unsigned i, j, n, newcount;
+	bool ready, waited;
+	int result;
+
+	KASSERT(nops <= SEMOP_MAX);
+
+	/* Collect the semaphores, combining repeats. */
+	semfs = NULL;
+	n = 0;
+	for (i=0; i<nops; i++) {
+		if (vns[i]->vn_ops != &semfs_semops) {
+			return EINVAL;
+		}
+		semv = vns[i]->vn_data;
+		if (semfs == NULL) {
+			semfs = semv->semv_semfs;
+		}
+		KASSERT(semv->semv_semfs == semfs);
+
+		for (j=0; j<n; j++) {
+			if (sops[j].sso_semnum == semv->semv_semnum) {
+				break;
+			}
+		}
+		if (j == n) {
+			sops[n].sso_semnum = semv->semv_semnum;
+			sops[n].sso_sem = semfs_getsem(semv);
+			sops[n].sso_op = 0;
+			n++;
+		}
+		if ((ops[i] > 0 && sops[j].sso_op > opmax - ops[i]) ||
+		    (ops[i] < 0 && sops[j].sso_op < opmin - ops[i])) {
+			/* the repeats don't add up to an int */
+			return EINVAL;
+		}
+		sops[j].sso_op += ops[i];
+	}
+	if (n == 0) {
+		return 0;
+	}
+
+	/* Sort by semnum to fix the locking order. */
+	for (i=1; i<n; i++) {
+		tmp = sops[i];
+		for (j=i; j>0 && sops[j-1].sso_semnum > tmp.sso_semnum; j--) {
+			sops[j] = sops[j-1];
+		}
+		sops[j] = tmp;
+	}
+
+	waited = false;
+	while (1) {
+		ready = true;
+		result = 0;
+		for (i=0; i<n; i++) {
+			sem = sops[i].sso_sem;
+			lock_acquire(sem->sems_lock);
+			if (waited) {
+				KASSERT(sem->sems_batchwaiters > 0);
+				sem->sems_batchwaiters--;
+			}
+			if (sops[i].sso_op < 0 &&
+			    sem->sems_count < -(unsigned)sops[i].sso_op) {
+				ready = false;
+			}
+			if (sops[i].sso_op > 0 &&
+			    sem->sems_count + sops[i].sso_op < sem->sems_count) {
+				/* overflow */
+				result = EFBIG;
+			}
+		}
+		if (result || ready) {
+			break;
+		}
+
+		/*
+		 * Sleep. Take the semop lock before dropping the
+		 * semaphores so a V in between can't be missed.
+		 */
+		for (i=0; i<n; i++) {
+			sops[i].sso_sem->sems_batchwaiters++;
+		}
+		lock_acquire(semfs->semfs_oplock);
+		for (i=n; i-- > 0; ) {
+			lock_release(sops[i].sso_sem->sems_lock);
+		}
+		DEBUG(DB_SEMFS, "semfs: semop: blocking\n");
+		result = cv_wait_intr(semfs->semfs_opcv, semfs->semfs_oplock);
+		lock_release(semfs->semfs_oplock);
+		if (result) {
+			/* exiting; take back our batchwaiters counts */
+			for (i=0; i<n; i++) {
+				sem = sops[i].sso_sem;
+				lock_acquire(sem->sems_lock);
+				KASSERT(sem->sems_batchwaiters > 0);
+				sem->sems_batchwaiters--;
+				lock_release(sem->sems_lock);
+			}
+			return result;
+		}
+		waited = true;
+	}
+
+	if (result == 0) {
+		for (i=0; i<n; i++) {
+			sem = sops[i].sso_sem;
+			newcount = sem->sems_count + sops[i].sso_op;
+			DEBUG(DB_SEMFS, "semfs: sem%u: semop, count %u -> %u\n",
+			      sops[i].sso_semnum, sem->sems_count, newcount);
+			semfs_wakeup(semfs, sem, newcount);
+			sem->sems_count = newcount;
+			if (sops[i].sso_op > 0) {
+				pollwakeup(&sem->sems_pollhead);
+			}
+		}
+	}
+
+	for (i=n; i-- > 0; ) {
+		lock_release(sops[i].sso_sem->sems_lock);
+	}
+	return result;
+}
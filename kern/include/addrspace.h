@@ -41,6 +41,16 @@
 struct vnode;
 
 
+/*
+ * Stacks for additional user threads. Slot N occupies
+ * USERTHREADSTACK_PAGES pages ending N slots below
+ * USERTHREADSTACK_TOP, which leaves the main stack room to grow.
+ * Slots are handed out by proc_getustack.
+ */
+#define USERTHREADSTACK_PAGES	16
+#define USERTHREADSTACK_MAX	32
+#define USERTHREADSTACK_TOP	(USERSTACK - 1024*1024)
+
 /*
  * Address space - data structure associated with the virtual memory
  * space of a process.
@@ -57,6 +67,8 @@ struct addrspace {
         paddr_t as_pbase2;
         size_t as_npages2;
         paddr_t as_stackpbase;
+        /* thread stack slots; 0 until first used */
+        paddr_t as_threadstackpbase[USERTHREADSTACK_MAX];
 #else
         /* Put stuff here for your VM system */
         vaddr_t as_vbase1;
@@ -106,6 +118,16 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_define_threadstack - set up the stack for an additional user
+ *                thread in stack slot SLOT (see below). Hands back
+ *                the thread's initial stack pointer.
+ *
+ *    as_map_stack - return a kernel pointer through which the LEN
+ *                bytes of AS's stack at VADDR can be written even
+ *                while AS isn't active, or NULL if the VM can't do
+ *                that. execv uses it to put the argv straight onto
+ *                the new stack.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -124,6 +146,10 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_define_threadstack(struct addrspace *as, unsigned slot,
+                                        vaddr_t *initstackptr);
+void             *as_map_stack(struct addrspace *as, vaddr_t vaddr,
+                                size_t len);
 
 
 /*
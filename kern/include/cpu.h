@@ -33,9 +33,36 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <workqueue.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
+/*
+ * Per-cpu statistics, printed by the "cpustat" menu command.
+ *
+ * Each cpu updates its own counters with interrupts off, so no
+ * locking is needed; readers on other cpus may see slightly stale
+ * values. The exception is cs_migrations_in, which is bumped by the
+ * cpu doing the migration while it holds our run queue lock.
+ *
+ * cs_irqs is indexed by the platform's interrupt source number (the
+ * LAMEbus slot on System/161).
+ */
+#define CPUSTAT_NIPI	4		/* IPI types counted */
+#define CPUSTAT_NIRQ	32		/* Device interrupt sources counted */
+
+struct cpustat {
+	unsigned cs_vswitches;		/* Voluntary context switches */
+	unsigned cs_ivswitches;		/* Preemptions */
+	unsigned cs_idleticks;		/* Hardclocks that found us idle */
+	unsigned cs_rqtotal;		/* Run queue length, summed per tick */
+	unsigned cs_ipisent[CPUSTAT_NIPI];
+	unsigned cs_ipirecv[CPUSTAT_NIPI];
+	unsigned cs_irqs[CPUSTAT_NIRQ];	/* Device interrupts taken */
+	unsigned cs_migrations_out;	/* Threads pushed to other cpus */
+	unsigned cs_migrations_in;	/* Threads pushed to us */
+};
+
 /*
  * Per-cpu structure
  *
@@ -61,6 +88,15 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	struct work c_reapwork;		/* Deferred exorcise() */
+	bool c_rcu_online;		/* Taking part in RCU (see rcu.c) */
+	unsigned c_rcu_gp;		/* Last RCU grace period seen */
+	struct cpustat c_stat;		/* Statistics (see above) */
+
+	/*
+	 * Set once at startup.
+	 */
+	struct workqueue *c_workqueue;	/* Worker threads for this cpu */
 
 	/*
 	 * Accessed by other cpus.
@@ -100,12 +136,16 @@ struct cpu {
  *
  * cpu_create calls cpu_machdep_init.
  *
+ * cpu_get returns the cpu with the given cpu number, or NULL if there
+ * isn't one.
+ *
  * cpu_start_secondary is the platform-dependent assembly language
  * entry point for new CPUs; it can be found in start.S. It calls
  * cpu_hatch after having claimed the startup stack and thread created
  * for the cpu.
  */
 struct cpu *cpu_create(unsigned hardware_number);
+struct cpu *cpu_get(unsigned software_number);
 void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
@@ -115,6 +155,12 @@ void cpu_hatch(unsigned software_number);
  */
 void cpu_identify(char *buf, size_t max);
 
+/*
+ * Print each cpu's statistics as changes since the last call (or
+ * since boot, the first time).
+ */
+void cpustat_report(void);
+
 /*
  * Hardware-level interrupt on/off, for the current CPU.
  *
@@ -35,28 +35,43 @@
 #define _FILETABLE_H_
 
 #include <limits.h> /* for OPEN_MAX */
+#include <spinlock.h>
+#include <rcu.h>
+
+struct bitmap;
 
 
 /*
  * The file table is an array of open files.
  *
- * There is no particular reason to use a fixed size array (of size
- * OPEN_MAX) instead of a dynamically sized array (using array.h) --
- * the code was just written this way years ago and there's no
- * compelling reason to change it that outweighs this benefit: you can
- * look through the code to see what it would take to make it dynamic,
- * or even to make it dynamic with the limit being user-settable. (See
- * setrlimit(2) on a Unix machine.)
+ * The array starts at FILETABLE_MINSIZE slots and doubles as needed up
+ * to OPEN_MAX. A bitmap of the slots in use makes finding the lowest
+ * free descriptor a find-first-zero, and ft_top (one past the highest
+ * open descriptor) lets fork copy only the part that's populated.
  *
- * Because we only have single-threaded processes, the file table is
- * never shared and so it doesn't require synchronization. On fork,
- * the table is copied. Another exercise: what would you need to do to
- * make this code safe for multithreaded processes? What happens if
- * one thread calls close() while another one is in the middle of e.g.
- * read() using the same file handle?
+ * The threads of a process share its file table. Changes to the
+ * table are made under ft_lock; lookups (filetable_get, which happens
+ * on every read and write) take no lock at all but run under RCU and
+ * take their own reference to the openfile, which openfile_decref
+ * doesn't free until a grace period has passed. So if one thread
+ * calls close() while another is in the middle of read() on the same
+ * file handle, the read finishes with the file it started with. When
+ * the array grows, the old one is likewise freed after a grace
+ * period. On fork, the table is copied.
  */
+#define FILETABLE_MINSIZE	32
+
+struct fdarray {
+	unsigned fa_size;
+	struct rcu_head fa_rcu;
+	struct openfile *volatile fa_files[];
+};
+
 struct filetable {
-	struct openfile *ft_openfiles[OPEN_MAX];
+	struct spinlock ft_lock;
+	struct fdarray *volatile ft_files;
+	struct bitmap *ft_used;		/* fds in use; fa_size bits */
+	unsigned ft_top;		/* one past highest fd in use */
 };
 
 /*
@@ -69,9 +84,11 @@ struct filetable {
  * get/put - Retrieve a fd for use and put it back when done. (Checks
  *           okfd and also fails on files not open; returned openfile
  *           is not NULL.) Call put with the file returned from get.
+ *           The file stays valid in between even if the fd is closed.
  * place -   Insert a file and return the fd.
  * placeat - Insert a file at a specific slot and return the file
- *           previously there.
+ *           previously there. Can only fail (with ENOMEM, growing
+ *           the table) when the file inserted isn't NULL.
  */
 
 struct filetable *filetable_create(void);
@@ -83,8 +100,8 @@ int filetable_get(struct filetable *ft, int fd, struct openfile **ret);
 void filetable_put(struct filetable *ft, int fd, struct openfile *file);
 
 int filetable_place(struct filetable *ft, struct openfile *file, int *fd);
-void filetable_placeat(struct filetable *ft, struct openfile *newfile, int fd,
-		       struct openfile **oldfile_ret);
+int filetable_placeat(struct filetable *ft, struct openfile *newfile, int fd,
+		      struct openfile **oldfile_ret);
 
 
 #endif /* _FILETABLE_H_ */
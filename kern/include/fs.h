@@ -85,5 +85,8 @@ struct fs_ops {
 /* Initialization functions for builtin fake file systems. */
 void semfs_bootstrap(void);
 
+/* Apply a batch of P (negative) and V (positive) ops to semfs vnodes. */
+int semfs_semop(struct vnode **vns, const int *ops, unsigned nops);
+
 
 #endif /* _FS_H_ */
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_URING_H_
+#define _KERN_URING_H_
+
+/*
+ * Definitions for uring_enter(), batched I/O through rings in user
+ * memory.
+ *
+ * A ring area starts with a struct uring, followed by the submission
+ * queue (u_sqmask+1 struct uring_sqe) and then the completion queue
+ * (u_cqmask+1 struct uring_cqe). Both sizes must be powers of two, no
+ * more than URING_MAXENTRIES. The head and tail counters run freely
+ * and are reduced with the mask to index the queues.
+ *
+ * The program fills in entries at sq tail and advances u_sqtail;
+ * uring_enter runs entries from u_sqhead on, in order, writes a
+ * completion for each at cq tail, and advances u_sqhead and u_cqtail.
+ * The program takes completions from u_cqhead and advances that. The
+ * kernel never runs more entries than there's completion space for.
+ */
+
+struct uring_sqe {
+	__i32 sqe_op;			/* URING_OP_* */
+	__i32 sqe_fd;			/* file handle */
+#ifdef _KERNEL
+	userptr_t sqe_buf;		/* buffer, or path for open */
+#else
+	void *sqe_buf;			/* buffer, or path for open */
+#endif
+	__u32 sqe_len;			/* buffer length */
+	off_t sqe_off;			/* pread/pwrite position; lseek offset */
+	__i32 sqe_flags;		/* open flags; lseek whence */
+	__u32 sqe_mode;			/* open mode */
+	__u64 sqe_data;			/* anything; copied to the completion */
+};
+
+struct uring_cqe {
+	__u64 cqe_data;			/* sqe_data of the entry */
+	__i64 cqe_res;			/* call's result, or -errno */
+};
+
+struct uring {
+	__u32 u_sqhead;			/* next entry to run (kernel sets) */
+	__u32 u_sqtail;			/* next entry to fill (program sets) */
+	__u32 u_sqmask;			/* submission entries, less 1 */
+	__u32 u_cqhead;			/* next completion (program sets) */
+	__u32 u_cqtail;			/* next free completion (kernel sets) */
+	__u32 u_cqmask;			/* completion entries, less 1 */
+	__u32 u_reserved[2];		/* set to 0 */
+};
+
+/* Operations. */
+#define URING_OP_NOP	0	/* Do nothing; result 0. */
+#define URING_OP_READ	1	/* read(fd, buf, len) */
+#define URING_OP_WRITE	2	/* write(fd, buf, len) */
+#define URING_OP_PREAD	3	/* pread(fd, buf, len, off) */
+#define URING_OP_PWRITE	4	/* pwrite(fd, buf, len, off) */
+#define URING_OP_LSEEK	5	/* lseek(fd, off, flags) */
+#define URING_OP_OPEN	6	/* open(buf, flags, mode) */
+#define URING_OP_CLOSE	7	/* close(fd) */
+
+/* Largest queue. */
+#define URING_MAXENTRIES	4096
+
+/* Size of a ring area, and the queues within one. */
+#define URING_SIZE(nsq, ncq) \
+	(sizeof(struct uring) + (nsq) * sizeof(struct uring_sqe) + \
+	 (ncq) * sizeof(struct uring_cqe))
+#define URING_SQ(u)	((struct uring_sqe *)((u) + 1))
+#define URING_CQ(u)	((struct uring_cqe *)(URING_SQ(u) + (u)->u_sqmask + 1))
+
+
+#endif /* _KERN_URING_H_ */
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics.
+ *
+ * With "options lockstat" in the kernel config, spinlock_acquire,
+ * lock_acquire, and wchan_sleep count acquisitions, contended
+ * acquisitions, spin iterations, and time spent waiting. Sleep locks
+ * and wait channels are tracked by name; spinlocks have no names, so
+ * they're tracked by the address spinlock_acquire was called from.
+ *
+ * Counters are kept per cpu so that recording them needs no locking;
+ * the recording functions must be called with interrupts off (which
+ * is always the case, as the caller holds a spinlock). The report
+ * adds up the per-cpu counters without stopping the other cpus, so
+ * the numbers are approximate while the system is busy.
+ *
+ * Nothing is recorded until lockstat_start is called, because wait
+ * times need the clock and the clock isn't there until autoconf has
+ * run.
+ *
+ * Without the option, none of this is compiled.
+ */
+
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+
+struct timespec;
+
+/* Start recording; call once the clock is attached. */
+void lockstat_start(void);
+
+/*
+ * Get the current time for a wait start. Before lockstat_start this
+ * gives zero, which the recording functions ignore.
+ */
+void lockstat_gettime(struct timespec *ts);
+
+/*
+ * Recording functions.
+ *
+ * spinlock	A spinlock was acquired from PC after SPINS turns
+ *		around the wait loop.
+ * lock		A sleep lock called NAME was acquired; if it was
+ *		contended, we started waiting at WAITSTART and went
+ *		around the adaptive spin loop SPINS times.
+ * wchan	A thread slept on the wait channel NAME from
+ *		SLEEPSTART until now.
+ */
+void lockstat_spinlock(const void *pc, unsigned spins);
+void lockstat_lock(const char *name, bool contended, unsigned spins,
+		   const struct timespec *waitstart);
+void lockstat_wchan(const char *name, const struct timespec *sleepstart);
+
+/* Print the most contended locks, then zero all the counters. */
+void lockstat_report(void);
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
@@ -35,6 +35,7 @@
 #define _OPENFILE_H_
 
 #include <spinlock.h>
+#include <rcu.h>
 
 
 /*
@@ -45,8 +46,11 @@
  * seek position.
  *
  * Open files are reference-counted because they get shared via fork
- * and dup2 calls. And they need locking because that sharing can be
- * among multiple concurrent processes.
+ * and dup2 calls. The count is updated with atomic operations rather
+ * than under a lock, since filetable_get and filetable_put adjust it
+ * on every read and write and that sharing can be among multiple
+ * concurrent processes and threads. The structure itself is freed
+ * via call_rcu so filetable_get can look at it without locking.
  */
 struct openfile {
 	struct vnode *of_vnode;
@@ -55,16 +59,21 @@ struct openfile {
 	struct lock *of_offsetlock;	/* lock for of_offset */
 	off_t of_offset;
 
-	struct spinlock of_reflock;	/* lock for of_refcount */
-	int of_refcount;
+	volatile spinlock_data_t of_refcount;	/* atomic */
+
+	struct rcu_head of_rcu;		/* for deferred free */
 };
 
 /* open a file (args must be kernel pointers; destroys filename) */
 int openfile_open(char *filename, int openflags, mode_t mode,
 		  struct openfile **ret);
 
+/* wrap an existing vnode, e.g. a pipe end (consumes the vnode ref) */
+int openfile_fromvnode(struct vnode *vn, int accmode, struct openfile **ret);
+
 /* adjust the refcount on an openfile */
 void openfile_incref(struct openfile *);
+bool openfile_tryincref(struct openfile *);
 void openfile_decref(struct openfile *);
 
 
@@ -66,9 +66,16 @@ void pid_setexitstatus(int status);
 
 /*
  * Causes the current thread to wait for the thread with pid PID to
- * exit, returning the exit status when it does.
+ * exit, returning the exit status when it does. PID may be WAIT_ANY.
  */
 int pid_wait(pid_t targetpid, int *status, int flags, pid_t *retpid);
 
+/*
+ * Collect up to MAX exited children at once (waiting for the first
+ * unless WNOHANG is given).
+ */
+int pid_waitmany(pid_t *pids, int *statuses, unsigned max, int flags,
+		 unsigned *count);
+
 
 #endif /* _PID_H_ */
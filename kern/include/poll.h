@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _POLL_H_
+#define _POLL_H_
+
+/*
+ * Wait queues for poll() and select().
+ *
+ * An object that can block (a pipe, the console, a semfs semaphore)
+ * embeds a struct pollhead. A thread in poll() creates a pollwaiter
+ * and passes it to VOP_POLL on each file; the object calls pollwait
+ * to hook the waiter onto its pollhead, and later calls pollwakeup on
+ * its pollhead whenever it might have become readable or writable.
+ * That wakes only the threads polling that object, and the poller
+ * rescans its files only when one of them has been poked.
+ *
+ * The hookup has to come before the object checks its own state, and
+ * pollwakeup after the object changes it, so a change can't slip by
+ * in between.
+ *
+ * pollhead_init     - Initialize a pollhead.
+ * pollhead_cleanup  - Clean up a pollhead; no waiters may be hooked on.
+ * pollwait          - Hook waiter PW onto PH. PW may be NULL, meaning
+ *                     the caller only wants the current state, in
+ *                     which case nothing happens.
+ * pollwakeup        - Wake every waiter hooked onto PH. May be called
+ *                     from an interrupt handler.
+ *
+ * pollwaiter_create - Make a waiter that can be hooked onto up to
+ *                     MAXHOOKS pollheads, and that times out after
+ *                     MSECS milliseconds (never if MSECS is negative).
+ * pollwaiter_destroy - Unhook a waiter from everything and drop it.
+ * pollwaiter_clear  - Forget earlier wakeups; call before rescanning.
+ * pollwaiter_sleep  - Sleep until woken through some pollhead (0),
+ *                     until the timeout runs out (ETIMEDOUT), or
+ *                     until the process starts exiting (EINTR).
+ */
+
+#include <spinlock.h>
+
+struct pollwaiter;
+
+struct pollhook {
+	struct pollhook *hk_next;	/* Next hook on the pollhead */
+	struct pollhead *hk_head;	/* Pollhead we're on */
+	struct pollwaiter *hk_waiter;	/* Waiter to wake */
+};
+
+struct pollhead {
+	struct spinlock ph_lock;
+	struct pollhook *ph_hooks;	/* Waiters hooked on */
+};
+
+void pollhead_init(struct pollhead *ph);
+void pollhead_cleanup(struct pollhead *ph);
+void pollwait(struct pollhead *ph, struct pollwaiter *pw);
+void pollwakeup(struct pollhead *ph);
+
+struct pollwaiter *pollwaiter_create(unsigned maxhooks, int msecs);
+void pollwaiter_destroy(struct pollwaiter *pw);
+void pollwaiter_clear(struct pollwaiter *pw);
+int pollwaiter_sleep(struct pollwaiter *pw);
+
+
+#endif /* _POLL_H_ */
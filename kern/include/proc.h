@@ -38,9 +38,11 @@
 
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
+#include "opt-syscallstat.h"
 
 struct addrspace;
 struct vnode;
+struct syscalltrace;
 
 /*
  * Process structure.
@@ -58,6 +60,15 @@ struct proc {
 	struct vnode *p_cwd;		/* current working directory */
 	struct filetable *p_filetable;	/* table of open files */
 
+	/* user-level threads; protected by p_lock */
+	uint32_t p_ustacks;		/* thread stack slots in use */
+	volatile bool p_exiting;	/* a thread has called _exit */
+	int p_exitstatus;		/* the status it gave */
+
+#if OPT_SYSCALLSTAT
+	struct syscalltrace *p_syscalltrace;	/* trace ring, or NULL */
+#endif
+
 	/* add more material here as needed */
 };
 
@@ -73,7 +84,10 @@ int proc_create_runprogram(const char *name, struct proc **ret);
 /* Create a fresh process for use by fork() */
 int proc_fork(struct proc **ret);
 
-/* Undo proc_fork if nothing's run in the new process yet. */
+/* Create a fresh process for spawn(), without copying the address space. */
+int proc_spawn(const char *name, struct proc **ret);
+
+/* Undo proc_fork or proc_spawn if nothing's run in the new process yet. */
 void proc_unfork(struct proc *proc);
 
 /* Destroy a process. */
@@ -81,12 +95,36 @@ void proc_destroy(struct proc *proc);
 
 /*
  * Cause the current process to exit. The current thread switches
- * itself into the kernel process.
+ * itself into the kernel process. Any other threads in the process
+ * exit the next time they head back to user mode (see
+ * proc_exitcheck), and the last one out finishes off the process.
+ * Threads blocked in interruptible sleeps (see wchan_sleep_intr) are
+ * woken first, so a read or wait that would never finish can't keep
+ * the process alive.
  *
  * The status code should be prepared with one of the _MKWAIT macros
  * defined in <kern/wait.h>.
  */
-void proc_exit(int status);
+__DEAD void proc_exit(int status);
+
+/*
+ * Cause just the current thread to exit. If it's the last thread,
+ * the whole process exits with status 0.
+ */
+__DEAD void proc_exitthread(void);
+
+/*
+ * Call on the way back to user mode: if another thread in the
+ * process has called _exit, exit this thread too.
+ */
+void proc_exitcheck(void);
+
+/* Get and release a user thread stack slot in the current process. */
+int proc_getustack(unsigned *slot);
+void proc_putustack(unsigned slot);
+
+/* Number of threads in a process. */
+unsigned proc_nthreads(struct proc *proc);
 
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _RCU_H_
+#define _RCU_H_
+
+/*
+ * Read-copy-update.
+ *
+ * RCU lets readers of a shared structure run without taking any lock.
+ * A reader brackets its accesses with rcu_read_lock/rcu_read_unlock;
+ * inside that it may not sleep, and the current thread isn't
+ * preempted (hardclock skips the yield). An updater publishes a new
+ * version with rcu_assign, and must not free the old one until every
+ * reader that might still see it is done: synchronize_rcu waits for
+ * that, and call_rcu arranges for a function to be called afterward.
+ * Updaters still need their own lock to serialize among themselves.
+ *
+ * Waiting is based on quiescent states: a cpu that has switched
+ * threads, or taken a clock tick outside a read section, can't still
+ * be inside a read section that began earlier. Once every cpu has
+ * been through one since an update, the update's grace period is
+ * over.
+ */
+
+#include <membar.h>
+#include <thread.h>
+#include <current.h>
+
+#ifndef RCU_INLINE
+#define RCU_INLINE INLINE
+#endif
+
+/*
+ * Deferred-call record for call_rcu. Embed one in the object to be
+ * freed. The caller must not touch it until the call happens.
+ */
+struct rcu_head {
+	void (*rh_func)(void *data);	/* Function to call */
+	void *rh_data;			/* Its argument */
+	struct rcu_head *rh_next;	/* Link on pending list */
+	unsigned rh_gp;			/* Grace period to wait for */
+};
+
+/*
+ * Functions.
+ *
+ * rcu_bootstrap   Set up. Call early, before anything uses call_rcu.
+ *
+ * rcu_read_lock   Begin a read section. Sections nest.
+ * rcu_read_unlock End a read section.
+ * rcu_read_held   True if the current thread is in a read section
+ *                 (for assertions).
+ *
+ * rcu_assign      Publish a pointer: make sure the object it points
+ *                 to is fully initialized before it becomes visible.
+ *
+ * synchronize_rcu Wait until every read section that began before
+ *                 the call has ended. Sleeps; needs the clock
+ *                 running, so don't use it during early boot.
+ *
+ * call_rcu        Call FUNC(DATA), in thread context, once every read
+ *                 section that began before the call has ended.
+ *                 Doesn't sleep; may be used at any time.
+ *
+ * rcu_quiescent   Report a quiescent state for the current cpu.
+ *                 Called from thread_switch and hardclock.
+ */
+void rcu_bootstrap(void);
+
+RCU_INLINE void rcu_read_lock(void);
+RCU_INLINE void rcu_read_unlock(void);
+RCU_INLINE bool rcu_read_held(void);
+#define rcu_assign(p, v) \
+	do { membar_store_store(); (p) = (v); } while (0)
+
+void synchronize_rcu(void);
+void call_rcu(struct rcu_head *rh, void (*func)(void *), void *data);
+void rcu_quiescent(void);
+
+
+RCU_INLINE
+void
+rcu_read_lock(void)
+{
+	curthread->t_rcu_nest++;
+	/* keep the compiler from moving loads above this */
+	__asm volatile("" ::: "memory");
+}
+
+RCU_INLINE
+void
+rcu_read_unlock(void)
+{
+	__asm volatile("" ::: "memory");
+	KASSERT(curthread->t_rcu_nest > 0);
+	curthread->t_rcu_nest--;
+}
+
+RCU_INLINE
+bool
+rcu_read_held(void)
+{
+	return curthread->t_rcu_nest > 0;
+}
+
+
+#endif /* _RCU_H_ */
@@ -48,6 +48,11 @@
 /*
  * Basic spinlock.
  *
+ * This is a ticket lock: each acquirer takes the next number from
+ * splk_next and waits until splk_serving reaches it, so the lock is
+ * handed out in the order it was asked for and a waiting CPU can't
+ * be starved by others that keep winning the race.
+ *
  * Note that spinlocks are held by CPUs, not by threads.
  *
  * This structure is made public so spinlocks do not have to be
@@ -55,14 +60,16 @@
  * the structure directly but always use the spinlock API functions.
  */
 struct spinlock {
-	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
-	struct cpu *splk_holder;	    /* CPU holding this lock. */
+	volatile spinlock_data_t splk_next;    /* Next ticket to hand out. */
+	volatile spinlock_data_t splk_serving; /* Memory word where we spin. */
+	struct cpu *splk_holder;	       /* CPU holding this lock. */
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL }
 
 /*
  * Spinlock functions.
@@ -71,6 +78,8 @@ struct spinlock {
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
+ * tryacquire	Get the lock only if it's free right now; returns whether
+ *		it did. For taking locks out of the usual order.
  * release	Release the lock. May re-enable interrupts.
  *
  * do_i_hold	Check if the current CPU holds the lock.
@@ -80,6 +89,7 @@ void spinlock_init(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
+bool spinlock_tryacquire(struct spinlock *lk);
 void spinlock_release(struct spinlock *lk);
 
 bool spinlock_do_i_hold(struct spinlock *lk);
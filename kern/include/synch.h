@@ -58,8 +58,13 @@ void sem_destroy(struct semaphore *);
  *     P (proberen): decrement count. If the count is 0, block until
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *
+ * P_intr is P that gives up with EINTR, without decrementing, if the
+ * current process is exiting (see wchan_sleep_intr); otherwise it
+ * returns 0.
  */
 void P(struct semaphore *);
+int P_intr(struct semaphore *);
 void V(struct semaphore *);
 
 
@@ -76,9 +81,10 @@ struct lock {
         char *lk_name;
         // add what you need here
         // (don't forget to mark things volatile as needed)
-        struct thread *lk_holder;
+        struct thread *volatile lk_holder;
         struct wchan *lk_wc;
         struct spinlock lk_splk;
+        struct lock *lk_nextheld;	/* next in holder's t_heldlocks */
 };
 
 struct lock *lock_create(const char *name);
@@ -87,9 +93,13 @@ void lock_destroy(struct lock *);
 /*
  * Operations:
  *    lock_acquire - Get the lock. Only one thread can hold the lock at the
- *                   same time.
+ *                   same time. If the holder is running on another
+ *                   cpu, spin for a while instead of sleeping; it is
+ *                   likely to release the lock soon. Before sleeping,
+ *                   lend our priority to the holder (and to whatever
+ *                   it in turn is waiting for).
  *    lock_release - Free the lock. Only the thread holding the lock may do
- *                   this.
+ *                   this. Gives back any priority lent through it.
  *    lock_do_i_hold - Return true if the current thread holds the lock;
  *                   false otherwise.
  *
@@ -132,15 +142,62 @@ void cv_destroy(struct cv *);
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
  *
- * For all three operations, the current thread must hold the lock passed
+ *    cv_wait_intr - Like cv_wait, but returns EINTR (with the lock
+ *                   re-acquired) if the current process is exiting,
+ *                   either before sleeping or on waking; otherwise 0.
+ *                   See wchan_sleep_intr.
+ *
+ * For all the operations, the current thread must hold the lock passed
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
  * These operations must be atomic. You get to write them.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
+int cv_wait_intr(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers block
+ * until it has been through. (So a thread that already holds the
+ * lock for reading must not try to get it for reading again.)
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+struct rwlock {
+        char *rwlock_name;
+        struct spinlock rw_splk;
+        struct wchan *rw_readwc;		/* readers waiting */
+        struct wchan *rw_writewc;		/* writers waiting */
+        volatile unsigned rw_readers;		/* readers holding */
+        volatile unsigned rw_waitingwriters;	/* writers waiting */
+        struct thread *volatile rw_writer;	/* writer holding */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading (shared).
+ *    rwlock_release_read  - Release a shared hold on the lock.
+ *    rwlock_acquire_write - Get the lock for writing (exclusive).
+ *    rwlock_release_write - Release an exclusive hold; only the
+ *                           thread holding the lock may do this.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the lock for writing.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
@@ -33,6 +33,7 @@
 
 #include <cdefs.h> /* for __DEAD */
 struct trapframe; /* from <machine/trapframe.h> */
+struct addrspace; /* from <addrspace.h> */
 
 /*
  * The system call dispatcher.
@@ -51,9 +52,17 @@ void enter_forked_process(struct trapframe *tf);
 __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 		       vaddr_t stackptr, vaddr_t entrypoint);
 
+/* Enter user mode in a new thread, calling entrypoint(arg). */
+__DEAD void enter_new_thread(vaddr_t entrypoint, vaddr_t arg,
+			     vaddr_t stackptr);
+
 /* Setup function for exec. */
 void exec_bootstrap(void);
 
+/* Setup function for futexes, and hook for process exit. */
+void futex_bootstrap(void);
+void futex_wakeproc(struct addrspace *as);
+
 
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
@@ -67,19 +76,42 @@ int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
 
 int sys_fork(struct trapframe *tf, pid_t *retval);
 int sys_execv(userptr_t prog, userptr_t args);
+int sys_spawn(userptr_t prog, userptr_t args, userptr_t actions,
+	      unsigned nactions, pid_t *retval);
 __DEAD void sys__exit(int code);
 int sys_waitpid(pid_t pid, userptr_t returncode, int flags, pid_t *retval);
+int sys_waitmany(userptr_t pids, userptr_t statuses, unsigned max, int flags,
+		 int *retval);
 int sys_getpid(pid_t *retval);
+int sys___threadfork(userptr_t entrypoint, userptr_t arg, int *retval);
+__DEAD void sys_threadexit(void);
+int sys_futex(userptr_t addr, int op, int val, int *retval);
 
 int sys_open(const_userptr_t filename, int flags, mode_t mode, int *retval);
 int sys_dup2(int oldfd, int newfd, int *retval);
 int sys_close(int fd);
+int sys_pipe(userptr_t fds);
 int sys_read(int fd, userptr_t buf, size_t size, int *retval);
 int sys_write(int fd, userptr_t buf, size_t size, int *retval);
+int sys_pread(int fd, userptr_t buf, size_t size, off_t pos, int *retval);
+int sys_pwrite(int fd, userptr_t buf, size_t size, off_t pos, int *retval);
+int sys_readv(int fd, const_userptr_t iov, int iovcnt, int *retval);
+int sys_writev(int fd, const_userptr_t iov, int iovcnt, int *retval);
+int sys_preadv(int fd, const_userptr_t iov, int iovcnt, off_t pos,
+	       int *retval);
+int sys_pwritev(int fd, const_userptr_t iov, int iovcnt, off_t pos,
+		int *retval);
+int sys_copy_file_range(int infd, userptr_t inpos, int outfd, userptr_t outpos,
+			size_t len, unsigned flags, int *retval);
 int sys_lseek(int fd, off_t offset, int code, off_t *retval);
 
 int sys_chdir(const_userptr_t path);
 int sys___getcwd(userptr_t buf, size_t buflen, int *retval);
+int sys_semop(const_userptr_t ops, unsigned nops);
+int sys_poll(userptr_t fds, unsigned nfds, int timeout, int *retval);
+int sys_select(int nfds, userptr_t readfds, userptr_t writefds,
+	       userptr_t exceptfds, userptr_t timeout, int *retval);
+int sys_uring_enter(userptr_t uring, unsigned to_submit, int *retval);
 
 
 #endif /* _SYSCALL_H_ */
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SYSCALLSTAT_H_
+#define _SYSCALLSTAT_H_
+
+/*
+ * System call statistics and tracing.
+ *
+ * With "options syscallstat" in the kernel config, syscall() times
+ * every call that returns to it and counts, per call number, calls,
+ * errors, total and worst time, and a histogram of times in
+ * power-of-two microsecond buckets. Times come from gettime(), so
+ * they're only as fine as the clock behind it. Calls that don't come
+ * back (_exit, threadexit, execv that works) aren't counted.
+ *
+ * As with lockstat, the counters are per cpu and are updated with
+ * interrupts off, so recording needs no lock and the report is
+ * approximate while the system is busy.
+ *
+ * A process can also be traced: then each of its calls is put in a
+ * small ring of the most recent ones, which is printed when the
+ * process goes away. Children forked by a traced process are traced
+ * too. The "strace" menu command runs a program this way.
+ *
+ * Without the option, none of this is compiled.
+ */
+
+#include "opt-syscallstat.h"
+
+#if OPT_SYSCALLSTAT
+
+struct timespec;
+struct proc;
+
+/* Set up the per-cpu counters. Call once the cpus are all known. */
+void syscallstat_bootstrap(void);
+
+/*
+ * Record that the current thread made syscall CALLNO, which started
+ * at START and returned ERR, or RETVAL if ERR is 0.
+ */
+void syscallstat_record(int callno, int err, int32_t retval,
+			const struct timespec *start);
+
+/* Print the counters for the calls that were made, then zero them. */
+void syscallstat_report(void);
+
+/*
+ * Tracing.
+ *
+ * start	Start tracing PROC, which must not be running yet.
+ * fork		Trace CHILD, a new process, if PARENT is traced.
+ * finish	Print and discard PROC's trace, if it has one. Called by
+ *		the process's last thread on the way out, while it
+ *		still has its pid, and from proc_destroy to free a
+ *		trace that's left (which is printed only if it has
+ *		anything in it).
+ */
+int syscalltrace_start(struct proc *proc);
+int syscalltrace_fork(struct proc *parent, struct proc *child);
+void syscalltrace_finish(struct proc *proc);
+
+#endif /* OPT_SYSCALLSTAT */
+
+#endif /* _SYSCALLSTAT_H_ */
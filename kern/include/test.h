@@ -59,9 +59,16 @@ int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int rwtest(int, char **);
+int pitest(int, char **);
 /* thread unit tests */
 int lockunittest(int, char **);
 
+/* lock contention benchmarks */
+int lockbench1(int, char **);
+int lockbench2(int, char **);
+int lockbench3(int, char **);
+
 /* filesystem tests */
 int fstest(int, char **);
 int readstress(int, char **);
@@ -41,6 +41,7 @@
 #include <threadlist.h>
 
 struct cpu;
+struct lock;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -56,6 +57,14 @@ struct cpu;
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
 
+/*
+ * Scheduling priorities. Higher numbers run first; threads of equal
+ * priority are scheduled round-robin.
+ */
+#define PRI_MIN		0
+#define PRI_DEFAULT	10
+#define PRI_MAX		20
+
 /* States a thread can be in. */
 typedef enum {
 	S_RUN,		/* running */
@@ -83,6 +92,7 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	bool t_pinned;			/* Never migrate to another cpu */
 
 	/*
 	 * Interrupt state fields.
@@ -100,11 +110,46 @@ struct thread {
 	bool t_in_interrupt;		/* Are we in an interrupt? */
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
+	unsigned t_rcu_nest;		/* Depth of rcu_read_lock calls */
+
+	/*
+	 * Priority fields.
+	 *
+	 * t_basepri is the thread's own priority. t_pri is the
+	 * priority it actually runs at: while it holds a lock that a
+	 * more important thread is waiting for, it runs at that
+	 * thread's priority instead (priority inheritance). t_pri and
+	 * t_prigen are protected by a spinlock in thread.c;
+	 * t_waitlock (the lock we're blocked on, if any) by that
+	 * lock's spinlock; t_heldlocks (the sleep locks we hold,
+	 * linked through lk_nextheld) is only touched by the thread
+	 * itself.
+	 */
+	int t_basepri;			/* Own priority */
+	volatile int t_pri;		/* Effective priority */
+	volatile unsigned t_prigen;	/* Bumped when t_pri is raised */
+	struct lock *t_waitlock;	/* Lock we're waiting for */
+	struct lock *t_heldlocks;	/* Locks we hold */
+
+	/*
+	 * Interruptible sleep fields.
+	 *
+	 * While the thread is in wchan_sleep_intr, t_intrwc and
+	 * t_intrlk say where it's sleeping. They're protected by
+	 * t_intrlock, and the thread only changes them while it also
+	 * holds t_intrlk, so holding both keeps the sleep in place;
+	 * see thread_interrupt.
+	 */
+	struct spinlock t_intrlock;
+	struct wchan *t_intrwc;		/* Wait channel, if interruptible */
+	struct spinlock *t_intrlk;	/* Its lock */
 
 	/*
 	 * Public fields
 	 */
 
+	int t_ustack;			/* User stack slot, -1 for main stack */
+
 	/* add more here as needed */
 };
 
@@ -144,6 +189,13 @@ int thread_fork(const char *name, struct proc *proc,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2);
 
+/*
+ * Like thread_fork, but make a kernel thread that runs only on cpu C.
+ */
+int thread_fork_oncpu(const char *name, struct cpu *c,
+                      void (*func)(void *, unsigned long),
+                      void *data1, unsigned long data2);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -162,6 +214,30 @@ void thread_yield(void);
  */
 void schedule(void);
 
+/*
+ * Priority control.
+ *
+ * thread_setpriority sets the current thread's own priority.
+ *
+ * thread_lend_priority raises thread T to at least priority PRI (used
+ * by lock_acquire) and returns true if that changed anything.
+ *
+ * thread_recompute_priority resets the current thread's effective
+ * priority from its own priority and the waiters on the locks it
+ * still holds (used by lock_release).
+ */
+void thread_setpriority(int pri);
+bool thread_lend_priority(struct thread *t, int pri);
+void thread_recompute_priority(void);
+
+/*
+ * Wake thread T if it's in an interruptible sleep (see
+ * wchan_sleep_intr), so it notices that its process is exiting.
+ * Returns false if T's sleep lock was busy; the caller should let go
+ * of any spinlocks it holds and try again.
+ */
+bool thread_interrupt(struct thread *t);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
@@ -33,6 +33,7 @@
 #include <spinlock.h>
 struct uio;
 struct stat;
+struct pollwaiter;
 
 
 /*
@@ -132,6 +133,14 @@ struct vnode {
  *                      uio. Need not work on objects that are not
  *                      directories.
  *
+ *    vop_poll        - Return which of the poll conditions EVENTS
+ *                      (POLLIN, POLLOUT; see kern/poll.h) hold now,
+ *                      plus POLLERR or POLLHUP if they apply. If the
+ *                      waiter PW isn't NULL, first hook it (with
+ *                      pollwait) onto whatever will be poked when
+ *                      the answer might change. Objects that never
+ *                      block can use vopready_poll.
+ *
  *****************************************
  *
  *    vop_creat       - Create a regular file named NAME in the passed
@@ -196,6 +205,8 @@ struct vnode_ops {
 	int (*vop_mmap)(struct vnode *file /* add stuff */);
 	int (*vop_truncate)(struct vnode *file, off_t len);
 	int (*vop_namefile)(struct vnode *file, struct uio *uio);
+	int (*vop_poll)(struct vnode *object, int events,
+			struct pollwaiter *pw);
 
 
 	int (*vop_creat)(struct vnode *dir,
@@ -240,6 +251,7 @@ struct vnode_ops {
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
 #define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
+#define VOP_POLL(vn, events, pw)        (__VOP(vn, poll)(vn, events, pw))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
 #define VOP_SYMLINK(vn, name, content)  (__VOP(vn, symlink)(vn, name, content))
@@ -312,5 +324,11 @@ int vopfail_lookup_notdir(struct vnode *vn, char *path, struct vnode **result);
 int vopfail_lookparent_notdir(struct vnode *vn, char *path,
 			      struct vnode **result, char *buf, size_t len);
 
+/*
+ * Common stub for vop_poll on objects that never block: always
+ * readable and writable.
+ */
+int vopready_poll(struct vnode *vn, int events, struct pollwaiter *pw);
+
 
 #endif /* _VNODE_H_ */
@@ -66,6 +66,14 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
  */
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Like wchan_sleep, but give up if the current process is exiting:
+ * returns EINTR, with the lock held, either at once or when woken by
+ * thread_interrupt. Returns 0 after an ordinary wakeup. Use it for
+ * sleeps that might wait indefinitely on behalf of a user process.
+ */
+int wchan_sleep_intr(struct wchan *wc, struct spinlock *lk);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The associated spinlock should be locked.
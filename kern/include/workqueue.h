@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Workqueues: deferred work run by kernel worker threads.
+ *
+ * Each cpu has a small pool of worker threads that never migrate.
+ * workqueue_enqueue puts a work item on the current cpu's queue and
+ * returns at once; a worker later calls the item's function, in
+ * thread context, so it may sleep. Workers take up to a batch of
+ * items at a time, and enqueueing an item that's already queued does
+ * nothing, so a burst of requests for the same cleanup costs one run.
+ *
+ * The caller owns the struct work and must not reuse or free it while
+ * it's queued. The queued flag is protected by the lock of the queue
+ * the item is on, so an item must not be enqueued from two cpus at
+ * once; the usual pattern is one item per cpu, or one per object
+ * whose enqueues are already serialized. The same goes for cancelling
+ * an item: it must not race with enqueueing it.
+ *
+ * Enqueueing is allowed in interrupt handlers.
+ */
+
+struct work {
+	void (*w_func)(void *data);	/* Function to call */
+	void *w_data;			/* Its argument */
+	struct work *w_next;		/* Link on queue */
+	unsigned w_due;			/* Hardclock tick to run at */
+	bool w_queued;			/* On a queue */
+	struct workqueue *w_wq;		/* Queue it was last put on */
+};
+
+#define WORK_INITIALIZER(func, data) { func, data, NULL, 0, false, NULL }
+
+/*
+ * Functions.
+ *
+ * work_init            Initialize a work item to call FUNC(DATA).
+ *
+ * workqueue_bootstrap  Start the worker threads; call after the
+ *                      secondary cpus are running.
+ *
+ * workqueue_enqueue    Run W soon. Returns false (and does nothing)
+ *                      if the worker threads aren't running yet, in
+ *                      which case the caller should do the work
+ *                      itself.
+ *
+ * workqueue_enqueue_delayed
+ *                      Like workqueue_enqueue, but run W no sooner
+ *                      than MSECS milliseconds from now. If W is
+ *                      already queued it keeps its old time.
+ *
+ * workqueue_cancel     Take W off its queue if it hasn't started to
+ *                      run. Returns true if it was taken off; false
+ *                      if it wasn't queued, or a worker already has
+ *                      it, in which case its function may still be
+ *                      running.
+ *
+ * workqueue_hardclock  Called on each clock tick to start delayed
+ *                      work that has come due.
+ */
+void work_init(struct work *w, void (*func)(void *), void *data);
+void workqueue_bootstrap(void);
+bool workqueue_enqueue(struct work *w);
+bool workqueue_enqueue_delayed(struct work *w, unsigned msecs);
+bool workqueue_cancel(struct work *w);
+void workqueue_hardclock(void);
+
+#endif /* _WORKQUEUE_H_ */
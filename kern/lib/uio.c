@@ -185,3 +185,24 @@ uio_uinit(struct iovec *iov, struct uio *u,
 	u->uio_rw = rw;
 	u->uio_space = proc_getas();
 }
+
+/*
+ * Set up a uio for a userspace transfer with several buffers.
+ */
+
+void
+uio_uinitv(struct iovec *iov, unsigned iovcnt, struct uio *u,
+	   size_t len, off_t offset, enum uio_rw rw)
+{
+	DEBUGASSERT(iov != NULL);
+	DEBUGASSERT(iovcnt > 0);
+	DEBUGASSERT(u != NULL);
+
+	u->uio_iov = iov;
+	u->uio_iovcnt = iovcnt;
+	u->uio_offset = offset;
+	u->uio_resid = len;
+	u->uio_segflg = UIO_USERSPACE;
+	u->uio_rw = rw;
+	u->uio_space = proc_getas();
+}
@@ -49,6 +49,10 @@
 #include <pid.h>
 #include <syscall.h>
 #include <test.h>
+#include <workqueue.h>
+#include <rcu.h>
+#include <syscallstat.h>
+#include <lockstat.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
 
@@ -111,6 +115,7 @@ boot(void)
 	ram_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
+	rcu_bootstrap();
 	pid_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
@@ -124,13 +129,22 @@ boot(void)
 	/* Now do pseudo-devices. */
 	pseudoconfig();
 	kprintf("\n");
+#if OPT_LOCKSTAT
+	/* The clock is attached now. */
+	lockstat_start();
+#endif
 	kheap_nextgeneration();
 
 	/* Late phase of initialization. */
 	vm_bootstrap();
 	kprintf_bootstrap();
 	exec_bootstrap();
+	futex_bootstrap();
 	thread_start_cpus();
+	workqueue_bootstrap();
+#if OPT_SYSCALLSTAT
+	syscallstat_bootstrap();
+#endif
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
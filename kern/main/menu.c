@@ -36,6 +36,7 @@
 #include <lib.h>
 #include <uio.h>
 #include <clock.h>
+#include <cpu.h>
 #include <thread.h>
 #include <proc.h>
 #include <vfs.h>
@@ -43,6 +44,8 @@
 #include <pid.h>
 #include <syscall.h>
 #include <test.h>
+#include <lockstat.h>
+#include <syscallstat.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
@@ -101,11 +104,12 @@ cmd_progthread(void *ptr, unsigned long nargs)
 }
 
 /*
- * Common code for cmd_prog and cmd_shell.
+ * Common code for cmd_prog, cmd_shell, and cmd_strace. If TRACE is
+ * set, the program's system calls are traced.
  */
 static
 int
-common_prog(int nargs, char **args)
+common_prog(int nargs, char **args, bool trace)
 {
 	struct proc *proc;
 	int result;
@@ -124,6 +128,18 @@ common_prog(int nargs, char **args)
 	}
 	childpid = proc->p_pid;
 
+#if OPT_SYSCALLSTAT
+	if (trace) {
+		result = syscalltrace_start(proc);
+		if (result) {
+			proc_unfork(proc);
+			return result;
+		}
+	}
+#else
+	(void)trace;
+#endif
+
 	result = thread_fork(args[0] /* thread name */,
 			proc /* new process */,
 			cmd_progthread /* thread function */,
@@ -167,9 +183,30 @@ cmd_prog(int nargs, char **args)
 	args++;
 	nargs--;
 
-	return common_prog(nargs, args);
+	return common_prog(nargs, args, false);
 }
 
+#if OPT_SYSCALLSTAT
+/*
+ * Command for running a program with its system calls traced.
+ */
+static
+int
+cmd_strace(int nargs, char **args)
+{
+	if (nargs < 2) {
+		kprintf("Usage: strace program [arguments]\n");
+		return EINVAL;
+	}
+
+	/* drop the leading "strace" */
+	args++;
+	nargs--;
+
+	return common_prog(nargs, args, true);
+}
+#endif
+
 /*
  * Command for starting the system shell.
  */
@@ -185,7 +222,7 @@ cmd_shell(int nargs, char **args)
 
 	args[0] = (char *)_PATH_SHELL;
 
-	return common_prog(nargs, args);
+	return common_prog(nargs, args, false);
 }
 
 /*
@@ -414,6 +451,55 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Command to print per-cpu statistics since the last time.
+ */
+static
+int
+cmd_cpustat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	cpustat_report();
+
+	return 0;
+}
+
+#if OPT_LOCKSTAT
+/*
+ * Command to print and reset the lock contention statistics.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	lockstat_report();
+
+	return 0;
+}
+#endif
+
+#if OPT_SYSCALLSTAT
+/*
+ * Command to print and reset the system call statistics.
+ */
+static
+int
+cmd_sysstat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	syscallstat_report();
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -446,6 +532,9 @@ showmenu(const char *name, const char *x[])
 static const char *opsmenu[] = {
 	"[s]       Shell                     ",
 	"[p]       Other program             ",
+#if OPT_SYSCALLSTAT
+	"[strace]  Program, tracing syscalls ",
+#endif
 	"[mount]   Mount a filesystem        ",
 	"[unmount] Unmount a filesystem      ",
 	"[bootfs]  Set \"boot\" filesystem     ",
@@ -487,6 +576,8 @@ static const char *testmenu[] = {
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy4] CV test #2            (1)     ",
+	"[rwt1] Reader-writer lock test      ",
+	"[sy5] Priority inheritance test     ",
 	"[wt]  waitpid test                  ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
@@ -495,6 +586,9 @@ static const char *testmenu[] = {
 	"[fs5] FS long stress                ",
 	"[fs6] FS create stress              ",
 	"[lkut] Lock test             		 ",
+	"[lb1] vfs_biglock contention bench  ",
+	"[lb2] pid alloc contention bench    ",
+	"[lb3] spinlock fairness bench       ",
 	NULL
 };
 
@@ -522,6 +616,13 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[cpustat] Per-cpu statistics        ",
+#if OPT_LOCKSTAT
+	"[lockstat] Lock contention stats    ",
+#endif
+#if OPT_SYSCALLSTAT
+	"[sysstat] System call stats         ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -555,6 +656,9 @@ static struct {
 	/* operations */
 	{ "s",		cmd_shell },
 	{ "p",		cmd_prog },
+#if OPT_SYSCALLSTAT
+	{ "strace",	cmd_strace },
+#endif
 	{ "mount",	cmd_mount },
 	{ "unmount",	cmd_unmount },
 	{ "bootfs",	cmd_bootfs },
@@ -576,6 +680,13 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "cpustat",	cmd_cpustat },
+#if OPT_LOCKSTAT
+	{ "lockstat",	cmd_lockstat },
+#endif
+#if OPT_SYSCALLSTAT
+	{ "sysstat",	cmd_sysstat },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -597,10 +708,17 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "rwt1",	rwtest },
+	{ "sy5",	pitest },
 
 	/* Added unit tests for synchronization assignment */
 	{ "lkut",	lockunittest},
 
+	/* lock contention benchmarks */
+	{ "lb1",	lockbench1 },
+	{ "lb2",	lockbench2 },
+	{ "lb3",	lockbench3 },
+
 	/* system call assignment tests */
 	/* For testing the wait implementation. */
 	{ "wt",		waittest },
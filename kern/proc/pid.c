@@ -41,70 +41,151 @@
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
+#include <spinlock.h>
+#include <wchan.h>
 #include <synch.h>
+#include <rcu.h>
 #include <pid.h>
 
 /*
  * Structure for holding exit data of a thread.
  *
  * If pi_ppid is INVALID_PID, the parent has gone away and will not be
- * waiting. If pi_ppid is INVALID_PID and pi_exited is true, the
- * structure can be freed.
+ * waiting. Once pi_ppid is INVALID_PID, pi_exited is true, and no
+ * waiter is still looking at it (pi_refs is 0), the structure can be
+ * freed; whoever makes the last of these true does so.
+ *
+ * pi_lock protects pi_ppid, pi_exited, pi_exitstatus and pi_refs,
+ * and goes with pi_cv. A process's children are on its pi_children
+ * list, which is protected by the parent's pi_lock. Changing a
+ * child's pi_ppid takes both the parent's and the child's pi_lock,
+ * so either is enough to read it. Always lock the parent first.
+ *
+ * Children that have exited but not been collected are also queued
+ * on the parent's pi_zombies, oldest first, for waiting on any child.
+ * That queue, and pi_zgen, are protected by the parent's pi_zlock,
+ * a spinlock taken after any pi_lock; an exiting child adds itself
+ * holding only its own pi_lock and the parent's pi_zlock, and can't
+ * be removed without the parent's pi_lock. pi_zgen counts changes
+ * to the parent's children (exits and removals) so a waiter can
+ * sleep on pi_zwchan without missing one.
  */
 struct pidinfo {
 	pid_t pi_pid;			// process id of this thread
 	pid_t pi_ppid;			// process id of parent thread
 	volatile bool pi_exited;	// true if thread has exited
 	int pi_exitstatus;		// status (only valid if exited)
+	unsigned pi_refs;		// waiters still using this
+	struct lock *pi_lock;		// lock for the above
 	struct cv *pi_cv;		// use to wait for thread exit
+	struct pidinfo *pi_children;	// list of our children
+	struct pidinfo *pi_sibling;	// next on parent's child list
+	struct pidinfo **pi_siblingp;	// what points to us on that list
+	struct spinlock pi_zlock;	// lock for exited-children queue
+	struct wchan *pi_zwchan;	// wait here for any child
+	unsigned pi_zgen;		// bumped when the children change
+	struct pidinfo *pi_zombies;	// exited children, oldest first
+	struct pidinfo **pi_zombiestail; // end of pi_zombies
+	struct pidinfo *pi_znext;	// next on parent's exited queue
+	struct pidinfo **pi_zprevp;	// what points to us on that queue
+	struct rcu_head pi_rcu;		// for deferred free
 };
 
 
 /*
- * Global pid and exit data.
+ * Global pid data.
  *
  * The process table is an el-cheapo hash table. It's indexed by
- * (pid % PROCS_MAX), and only allows one process per slot. If a
- * new pid allocation would cause a hash collision, we just don't
- * use that pid.
+ * (pid % PROCS_MAX), and only allows one process per slot.
+ *
+ * To allocate, we take a free slot and give out the next pid that
+ * maps to it. Free slots are kept in a FIFO (pidfree, a ring of slot
+ * numbers), so the slot that has been free longest is reused first,
+ * and each slot steps through its pids in order; together these
+ * keep a pid from coming back soon after it's released. Allocation
+ * is O(1) no matter how full the table is.
+ *
+ * The table and the FIFO are protected by pidtable_lock, which is
+ * only ever held for a few instructions; everything else about a
+ * process is under its own pi_lock. pi_get may also be used without
+ * the table lock, inside an RCU read section: table slots are
+ * published with rcu_assign and pidinfo structures are freed via
+ * call_rcu, so what it returns stays readable until the section
+ * ends (though the fields may be changing).
  */
-static struct lock *pidlock;		// lock for global exit data
-static struct pidinfo *pidinfo[PROCS_MAX]; // actual pid info
-static pid_t nextpid;			// next candidate pid
+static struct spinlock pidtable_lock = SPINLOCK_INITIALIZER;
+static struct pidinfo *volatile pidinfo[PROCS_MAX]; // actual pid info
+static pid_t pidslot_last[PROCS_MAX];	// last pid given out per slot
+static unsigned pidfree[PROCS_MAX];	// free slots, oldest first
+static unsigned pidfree_head;		// index of oldest in pidfree
 static int nprocs;			// number of allocated pids
 
 
 
 /*
- * Create a pidinfo structure for the specified pid.
+ * Create a pidinfo structure with the specified parent. It gets its
+ * own pid from pi_put.
  */
 static
 struct pidinfo *
-pidinfo_create(pid_t pid, pid_t ppid)
+pidinfo_create(pid_t ppid)
 {
 	struct pidinfo *pi;
 
-	KASSERT(pid != INVALID_PID);
-
 	pi = kmalloc(sizeof(struct pidinfo));
 	if (pi==NULL) {
 		return NULL;
 	}
 
+	pi->pi_lock = lock_create("pidinfo lock");
+	if (pi->pi_lock == NULL) {
+		kfree(pi);
+		return NULL;
+	}
+
 	pi->pi_cv = cv_create("pidinfo cv");
 	if (pi->pi_cv == NULL) {
+		lock_destroy(pi->pi_lock);
 		kfree(pi);
 		return NULL;
 	}
 
-	pi->pi_pid = pid;
+	pi->pi_zwchan = wchan_create("pidinfo");
+	if (pi->pi_zwchan == NULL) {
+		cv_destroy(pi->pi_cv);
+		lock_destroy(pi->pi_lock);
+		kfree(pi);
+		return NULL;
+	}
+
+	pi->pi_pid = INVALID_PID;
 	pi->pi_ppid = ppid;
 	pi->pi_exited = false;
 	pi->pi_exitstatus = 0xbeef;  /* Recognizably invalid value */
+	pi->pi_refs = 0;
+	pi->pi_children = NULL;
+	pi->pi_sibling = NULL;
+	pi->pi_siblingp = NULL;
+	spinlock_init(&pi->pi_zlock);
+	pi->pi_zgen = 0;
+	pi->pi_zombies = NULL;
+	pi->pi_zombiestail = &pi->pi_zombies;
+	pi->pi_znext = NULL;
+	pi->pi_zprevp = NULL;
 
 	return pi;
 }
 
+/*
+ * Free a pidinfo's memory once lock-free lookups are done with it.
+ */
+static
+void
+pidinfo_free(void *data)
+{
+	kfree(data);
+}
+
 /*
  * Clean up a pidinfo structure.
  */
@@ -114,8 +195,15 @@ pidinfo_destroy(struct pidinfo *pi)
 {
 	KASSERT(pi->pi_exited == true);
 	KASSERT(pi->pi_ppid == INVALID_PID);
+	KASSERT(pi->pi_refs == 0);
+	KASSERT(pi->pi_children == NULL);
+	KASSERT(pi->pi_zombies == NULL);
+	KASSERT(pi->pi_zprevp == NULL);
+	lock_destroy(pi->pi_lock);
 	cv_destroy(pi->pi_cv);
-	kfree(pi);
+	wchan_destroy(pi->pi_zwchan);
+	spinlock_cleanup(&pi->pi_zlock);
+	call_rcu(&pi->pi_rcu, pidinfo_free, pi);
 }
 
 ////////////////////////////////////////////////////////////
@@ -126,29 +214,38 @@ pidinfo_destroy(struct pidinfo *pi)
 void
 pid_bootstrap(void)
 {
+	struct pidinfo *pi;
 	int i;
 
-	pidlock = lock_create("pidlock");
-	if (pidlock == NULL) {
-		panic("Out of memory creating pid lock\n");
-	}
-
 	/* not really necessary - should start zeroed */
 	for (i=0; i<PROCS_MAX; i++) {
 		pidinfo[i] = NULL;
 	}
 
-	pidinfo[KERNEL_PID] = pidinfo_create(KERNEL_PID, INVALID_PID);
-	if (pidinfo[KERNEL_PID]==NULL) {
+	pi = pidinfo_create(INVALID_PID);
+	if (pi==NULL) {
 		panic("Out of memory creating kernel pid data\n");
 	}
-
-	nextpid = PID_MIN;
+	pi->pi_pid = KERNEL_PID;
+	pidinfo[KERNEL_PID] = pi;
 	nprocs = 1;
+
+	/*
+	 * Queue the other slots in pid order, starting from PID_MIN,
+	 * and make each one's "last" pid the one before its first.
+	 */
+	pidfree_head = 0;
+	for (i=0; i<PROCS_MAX-1; i++) {
+		pidfree[i] = (PID_MIN + i) % PROCS_MAX;
+	}
+	for (i=0; i<PROCS_MAX; i++) {
+		pidslot_last[i] = i - PROCS_MAX;
+	}
 }
 
 /*
- * pi_get: look up a pidinfo in the process table.
+ * pi_get: look up a pidinfo in the process table. Call with
+ * pidtable_lock held or in an RCU read section.
  */
 static
 struct pidinfo *
@@ -158,7 +255,7 @@ pi_get(pid_t pid)
 
 	KASSERT(pid>=0);
 	KASSERT(pid != INVALID_PID);
-	KASSERT(lock_do_i_hold(pidlock));
+	KASSERT(rcu_read_held() || spinlock_do_i_hold(&pidtable_lock));
 
 	pi = pidinfo[pid % PROCS_MAX];
 	if (pi==NULL) {
@@ -171,111 +268,293 @@ pi_get(pid_t pid)
 }
 
 /*
- * pi_put: insert a new pidinfo in the process table. The right slot
- * must be empty.
+ * pi_self: get the current process's pidinfo. It can't be freed
+ * until we've exited, so it's safe to use outside an RCU section.
  */
 static
-void
-pi_put(pid_t pid, struct pidinfo *pi)
+struct pidinfo *
+pi_self(void)
 {
-	KASSERT(lock_do_i_hold(pidlock));
+	struct pidinfo *pi;
 
-	KASSERT(pid != INVALID_PID);
+	KASSERT(curproc->p_pid != INVALID_PID);
+
+	rcu_read_lock();
+	pi = pi_get(curproc->p_pid);
+	rcu_read_unlock();
+
+	KASSERT(pi != NULL);
+	return pi;
+}
+
+/*
+ * pi_getchild: look up one of our children. Call with our own
+ * pi_lock held; since the child can't stop being ours without that
+ * lock, it also can't be freed until we let go of it.
+ */
+static
+int
+pi_getchild(struct pidinfo *us, pid_t pid, struct pidinfo **ret)
+{
+	struct pidinfo *pi;
+	int result;
+
+	KASSERT(lock_do_i_hold(us->pi_lock));
+
+	rcu_read_lock();
+	pi = pi_get(pid);
+	if (pi == NULL) {
+		result = ESRCH;
+	}
+	else if (pi->pi_ppid != us->pi_pid) {
+		result = EPERM;
+	}
+	else {
+		result = 0;
+	}
+	rcu_read_unlock();
+
+	*ret = pi;
+	return result;
+}
+
+/*
+ * Helper function for pi_put: the next pid for a slot.
+ */
+static
+pid_t
+pidslot_nextpid(unsigned slot)
+{
+	pid_t pid;
+
+	KASSERT(spinlock_do_i_hold(&pidtable_lock));
+
+	pid = pidslot_last[slot] + PROCS_MAX;
+	if (pid > PID_MAX) {
+		/* wrap around to the slot's first pid */
+		pid = slot;
+	}
+	if (pid < PID_MIN) {
+		pid += PROCS_MAX;
+	}
+	KASSERT(pid >= PID_MIN && pid <= PID_MAX);
+	return pid;
+}
+
+/*
+ * pi_put: give a new pidinfo a pid and insert it in the process
+ * table, using the slot that's been free longest.
+ */
+static
+int
+pi_put(struct pidinfo *pi)
+{
+	pid_t pid;
+
+	KASSERT(pi->pi_pid == INVALID_PID);
+
+	spinlock_acquire(&pidtable_lock);
+
+	if (nprocs == PROCS_MAX) {
+		spinlock_release(&pidtable_lock);
+		return EAGAIN;
+	}
+
+	pid = pidslot_nextpid(pidfree[pidfree_head]);
+	pidfree_head = (pidfree_head + 1) % PROCS_MAX;
 
 	KASSERT(pidinfo[pid % PROCS_MAX] == NULL);
-	pidinfo[pid % PROCS_MAX] = pi;
+	pi->pi_pid = pid;
+	rcu_assign(pidinfo[pid % PROCS_MAX], pi);
+	pidslot_last[pid % PROCS_MAX] = pid;
 	nprocs++;
+
+	spinlock_release(&pidtable_lock);
+	return 0;
 }
 
 /*
  * pi_drop: remove a pidinfo structure from the process table and free
  * it. It should reflect a process that has already exited and been
- * waited for.
+ * waited for, and that nobody else can find any more except by
+ * lock-free lookup.
  */
 static
 void
-pi_drop(pid_t pid)
+pi_drop(struct pidinfo *pi)
 {
-	struct pidinfo *pi;
+	pid_t pid = pi->pi_pid;
 
-	KASSERT(lock_do_i_hold(pidlock));
+	spinlock_acquire(&pidtable_lock);
 
-	pi = pidinfo[pid % PROCS_MAX];
-	KASSERT(pi != NULL);
-	KASSERT(pi->pi_pid == pid);
-
-	pidinfo_destroy(pi);
+	KASSERT(pidinfo[pid % PROCS_MAX] == pi);
 	pidinfo[pid % PROCS_MAX] = NULL;
 	nprocs--;
-}
 
-////////////////////////////////////////////////////////////
+	/* Back of the line for reuse. */
+	pidfree[(pidfree_head + PROCS_MAX - 1 - nprocs) % PROCS_MAX] =
+		pid % PROCS_MAX;
+
+	spinlock_release(&pidtable_lock);
+
+	pidinfo_destroy(pi);
+}
 
 /*
- * Helper function for pid_alloc.
+ * pi_dropall: pi_drop everything on a list linked through pi_sibling.
  */
 static
 void
-inc_nextpid(void)
+pi_dropall(struct pidinfo *list)
 {
-	KASSERT(lock_do_i_hold(pidlock));
+	struct pidinfo *pi;
 
-	nextpid++;
-	if (nextpid > PID_MAX) {
-		nextpid = PID_MIN;
+	while ((pi = list) != NULL) {
+		list = pi->pi_sibling;
+		pi->pi_sibling = NULL;
+		pi_drop(pi);
 	}
 }
 
 /*
- * pid_alloc: allocate a process id.
+ * pi_unused: check if nobody needs a pidinfo any more, in which case
+ * the caller should pi_drop it after unlocking it.
  */
-int
-pid_alloc(pid_t *retval)
+static
+bool
+pi_unused(struct pidinfo *pi)
 {
-	struct pidinfo *pi;
-	pid_t pid;
-	int count;
+	KASSERT(lock_do_i_hold(pi->pi_lock));
 
-	KASSERT(curproc->p_pid != INVALID_PID);
+	return pi->pi_exited && pi->pi_ppid == INVALID_PID &&
+		pi->pi_refs == 0;
+}
 
-	/* lock the table */
-	lock_acquire(pidlock);
+/*
+ * pi_addchild: put a new child on its parent's list.
+ */
+static
+void
+pi_addchild(struct pidinfo *parent, struct pidinfo *kid)
+{
+	KASSERT(lock_do_i_hold(parent->pi_lock));
+	KASSERT(kid->pi_ppid == parent->pi_pid);
 
-	if (nprocs == PROCS_MAX) {
-		lock_release(pidlock);
-		return EAGAIN;
+	kid->pi_sibling = parent->pi_children;
+	if (kid->pi_sibling != NULL) {
+		kid->pi_sibling->pi_siblingp = &kid->pi_sibling;
 	}
+	kid->pi_siblingp = &parent->pi_children;
+	parent->pi_children = kid;
+}
 
-	/*
-	 * The above test guarantees that this loop terminates, unless
-	 * our nprocs count is off. Even so, assert we aren't looping
-	 * forever.
-	 */
-	count = 0;
-	while (pidinfo[nextpid % PROCS_MAX] != NULL) {
-
-		/* avoid various boundary cases by allowing extra loops */
-		KASSERT(count < PROCS_MAX*2+5);
-		count++;
+/*
+ * pi_orphan: cut a child loose from its parent. Both must be locked.
+ * Returns whether the child can now be dropped.
+ */
+static
+bool
+pi_orphan(struct pidinfo *parent, struct pidinfo *kid)
+{
+	KASSERT(lock_do_i_hold(parent->pi_lock));
+	KASSERT(lock_do_i_hold(kid->pi_lock));
+	KASSERT(kid->pi_ppid == parent->pi_pid);
 
-		inc_nextpid();
+	*kid->pi_siblingp = kid->pi_sibling;
+	if (kid->pi_sibling != NULL) {
+		kid->pi_sibling->pi_siblingp = kid->pi_siblingp;
 	}
+	kid->pi_sibling = NULL;
+	kid->pi_siblingp = NULL;
+	kid->pi_ppid = INVALID_PID;
+
+	spinlock_acquire(&parent->pi_zlock);
+	if (kid->pi_zprevp != NULL) {
+		/* it had exited; take it off the queue */
+		*kid->pi_zprevp = kid->pi_znext;
+		if (kid->pi_znext != NULL) {
+			kid->pi_znext->pi_zprevp = kid->pi_zprevp;
+		}
+		else {
+			parent->pi_zombiestail = kid->pi_zprevp;
+		}
+		kid->pi_znext = NULL;
+		kid->pi_zprevp = NULL;
+	}
+	/* Let anyone waiting for any child recheck (maybe for ECHILD). */
+	parent->pi_zgen++;
+	wchan_wakeall(parent->pi_zwchan, &parent->pi_zlock);
+	spinlock_release(&parent->pi_zlock);
 
-	pid = nextpid;
+	return pi_unused(kid);
+}
 
-	pi = pidinfo_create(pid, curproc->p_pid);
+/*
+ * pi_queueexited: put an exiting child on its parent's queue of
+ * exited children and wake anyone waiting for any child. The child
+ * must be locked, which also keeps the parent from going away.
+ */
+static
+void
+pi_queueexited(struct pidinfo *kid)
+{
+	struct pidinfo *parent;
+
+	KASSERT(lock_do_i_hold(kid->pi_lock));
+	KASSERT(kid->pi_exited);
+	KASSERT(kid->pi_ppid != INVALID_PID);
+
+	rcu_read_lock();
+	parent = pi_get(kid->pi_ppid);
+	rcu_read_unlock();
+	KASSERT(parent != NULL);
+
+	spinlock_acquire(&parent->pi_zlock);
+	KASSERT(kid->pi_zprevp == NULL);
+	kid->pi_znext = NULL;
+	kid->pi_zprevp = parent->pi_zombiestail;
+	*parent->pi_zombiestail = kid;
+	parent->pi_zombiestail = &kid->pi_znext;
+	parent->pi_zgen++;
+	wchan_wakeall(parent->pi_zwchan, &parent->pi_zlock);
+	spinlock_release(&parent->pi_zlock);
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * pid_alloc: allocate a process id.
+ */
+int
+pid_alloc(pid_t *retval)
+{
+	struct pidinfo *us, *pi;
+	int result;
+
+	KASSERT(curproc->p_pid != INVALID_PID);
+
+	pi = pidinfo_create(curproc->p_pid);
 	if (pi==NULL) {
-		lock_release(pidlock);
 		return ENOMEM;
 	}
 
-	pi_put(pid, pi);
-
-	inc_nextpid();
+	us = pi_self();
+	lock_acquire(us->pi_lock);
+
+	result = pi_put(pi);
+	if (result) {
+		lock_release(us->pi_lock);
+		/* keep pidinfo_destroy from complaining */
+		pi->pi_exited = true;
+		pi->pi_ppid = INVALID_PID;
+		pidinfo_destroy(pi);
+		return result;
+	}
+	pi_addchild(us, pi);
 
-	lock_release(pidlock);
+	lock_release(us->pi_lock);
 
-	*retval = pid;
+	*retval = pi->pi_pid;
 	return 0;
 }
 
@@ -286,25 +565,32 @@ pid_alloc(pid_t *retval)
 void
 pid_unalloc(pid_t theirpid)
 {
-	struct pidinfo *them;
+	struct pidinfo *us, *them;
+	bool drop;
+	int result;
 
 	KASSERT(theirpid >= PID_MIN && theirpid <= PID_MAX);
 
-	lock_acquire(pidlock);
+	us = pi_self();
+	lock_acquire(us->pi_lock);
 
-	them = pi_get(theirpid);
-	KASSERT(them != NULL);
+	result = pi_getchild(us, theirpid, &them);
+	KASSERT(result == 0);
+
+	lock_acquire(them->pi_lock);
 	KASSERT(them->pi_exited == false);
-	KASSERT(them->pi_ppid == curproc->p_pid);
 
 	/* keep pidinfo_destroy from complaining */
 	them->pi_exitstatus = 0xdead;
 	them->pi_exited = true;
-	them->pi_ppid = INVALID_PID;
+	drop = pi_orphan(us, them);
 
-	pi_drop(theirpid);
+	lock_release(them->pi_lock);
+	lock_release(us->pi_lock);
 
-	lock_release(pidlock);
+	if (drop) {
+		pi_drop(them);
+	}
 }
 
 /*
@@ -314,22 +600,27 @@ pid_unalloc(pid_t theirpid)
 void
 pid_disown(pid_t theirpid)
 {
-	struct pidinfo *them;
+	struct pidinfo *us, *them;
+	bool drop;
+	int result;
 
 	KASSERT(theirpid >= PID_MIN && theirpid <= PID_MAX);
 
-	lock_acquire(pidlock);
+	us = pi_self();
+	lock_acquire(us->pi_lock);
 
-	them = pi_get(theirpid);
-	KASSERT(them != NULL);
-	KASSERT(them->pi_ppid==curproc->p_pid);
+	result = pi_getchild(us, theirpid, &them);
+	KASSERT(result == 0);
 
-	them->pi_ppid = INVALID_PID;
-	if (them->pi_exited) {
-		pi_drop(them->pi_pid);
-	}
+	lock_acquire(them->pi_lock);
+	drop = pi_orphan(us, them);
+	lock_release(them->pi_lock);
+
+	lock_release(us->pi_lock);
 
-	lock_release(pidlock);
+	if (drop) {
+		pi_drop(them);
+	}
 }
 
 /*
@@ -343,42 +634,145 @@ pid_disown(pid_t theirpid)
 void
 pid_setexitstatus(int status)
 {
-	struct pidinfo *us;
-	int i;
+	struct pidinfo *us, *kid, *dead;
+	bool drop;
 
-	lock_acquire(pidlock);
-	KASSERT(curproc->p_pid != INVALID_PID);
+	us = pi_self();
+	lock_acquire(us->pi_lock);
 
-	/* First, disown all children */
-	for (i=0; i<PROCS_MAX; i++) {
-		if (pidinfo[i]==NULL) {
-			continue;
-		}
-		if (pidinfo[i]->pi_ppid == curproc->p_pid) {
-			pidinfo[i]->pi_ppid = INVALID_PID;
-			if (pidinfo[i]->pi_exited) {
-				pi_drop(pidinfo[i]->pi_pid);
-			}
+	/*
+	 * First, disown all children. Collect the ones that have
+	 * already exited on a local list (reusing pi_sibling) and
+	 * drop them after unlocking. (Nobody can be waiting on our
+	 * pi_zwchan now, as we're the last thread.)
+	 */
+	dead = NULL;
+	while ((kid = us->pi_children) != NULL) {
+		lock_acquire(kid->pi_lock);
+		drop = pi_orphan(us, kid);
+		lock_release(kid->pi_lock);
+		if (drop) {
+			kid->pi_sibling = dead;
+			dead = kid;
 		}
 	}
 
 	/* Now, wake up our parent */
-	us = pi_get(curproc->p_pid);
-	KASSERT(us != NULL);
-
 	us->pi_exitstatus = status;
 	us->pi_exited = true;
+	cv_broadcast(us->pi_cv, us->pi_lock);
+	if (us->pi_ppid != INVALID_PID) {
+		pi_queueexited(us);
+	}
+
+	/* If there's no parent, nobody will wait for us. */
+	drop = pi_unused(us);
 
-	if (us->pi_ppid == INVALID_PID) {
-		/* no parent */
-		pi_drop(curproc->p_pid);
+	curproc->p_pid = INVALID_PID;
+	lock_release(us->pi_lock);
+
+	pi_dropall(dead);
+	if (drop) {
+		pi_drop(us);
 	}
-	else {
-		cv_broadcast(us->pi_cv, pidlock);
+}
+
+/*
+ * Collects up to MAX children that have exited, in the order they
+ * exited, putting their pids and exit statuses in PIDS and STATUSES
+ * and the number collected in COUNT. If none have exited yet, waits
+ * for one, unless WNOHANG is set, in which case COUNT is 0. Fails
+ * with ECHILD if there are no children at all.
+ *
+ * STATUSES may be null, in which case the statuses are thrown away.
+ */
+int
+pid_waitmany(pid_t *pids, int *statuses, unsigned max, int flags,
+	     unsigned *count)
+{
+	struct pidinfo *us, *kid, *dead;
+	unsigned gen, n;
+
+	KASSERT(curproc->p_pid != INVALID_PID);
+
+	/* Only valid options */
+	if (flags != 0 && flags != WNOHANG) {
+		return EINVAL;
+	}
+	if (max == 0) {
+		return EINVAL;
 	}
 
-	curproc->p_pid = INVALID_PID;
-	lock_release(pidlock);
+	us = pi_self();
+	lock_acquire(us->pi_lock);
+
+	while (1) {
+		spinlock_acquire(&us->pi_zlock);
+		if (us->pi_zombies != NULL) {
+			spinlock_release(&us->pi_zlock);
+			break;
+		}
+		gen = us->pi_zgen;
+		spinlock_release(&us->pi_zlock);
+
+		if (us->pi_children == NULL) {
+			lock_release(us->pi_lock);
+			return ECHILD;
+		}
+		if (flags == WNOHANG) {
+			lock_release(us->pi_lock);
+			*count = 0;
+			return 0;
+		}
+
+		/* Sleep without our own lock so fork isn't held up. */
+		lock_release(us->pi_lock);
+		spinlock_acquire(&us->pi_zlock);
+		while (us->pi_zgen == gen) {
+			if (wchan_sleep_intr(us->pi_zwchan, &us->pi_zlock)) {
+				/* We're exiting; give up. */
+				spinlock_release(&us->pi_zlock);
+				return EINTR;
+			}
+		}
+		spinlock_release(&us->pi_zlock);
+		lock_acquire(us->pi_lock);
+	}
+
+	/*
+	 * Collect what's queued. Nothing can leave the queue without
+	 * our pi_lock, so the head stays put once we've read it.
+	 */
+	dead = NULL;
+	n = 0;
+	while (n < max) {
+		spinlock_acquire(&us->pi_zlock);
+		kid = us->pi_zombies;
+		spinlock_release(&us->pi_zlock);
+		if (kid == NULL) {
+			break;
+		}
+
+		lock_acquire(kid->pi_lock);
+		KASSERT(kid->pi_exited);
+		pids[n] = kid->pi_pid;
+		if (statuses != NULL) {
+			statuses[n] = kid->pi_exitstatus;
+		}
+		n++;
+		if (pi_orphan(us, kid)) {
+			kid->pi_sibling = dead;
+			dead = kid;
+		}
+		lock_release(kid->pi_lock);
+	}
+
+	lock_release(us->pi_lock);
+
+	pi_dropall(dead);
+
+	*count = n;
+	return 0;
 }
 
 /*
@@ -386,13 +780,19 @@ pid_setexitstatus(int status)
  * status and ret are a kernel pointers, but pid/flags may come from
  * userland and may thus be maliciously invalid.
  *
+ * theirpid may be WAIT_ANY to take whichever child exited first.
+ *
  * status may be null, in which case the status is thrown away. ret
  * may only be null if WNOHANG is not set.
  */
 int
 pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 {
-	struct pidinfo *them;
+	struct pidinfo *us, *them;
+	pid_t anypid;
+	unsigned count;
+	bool drop;
+	int result;
 
 	KASSERT(curproc->p_pid != INVALID_PID);
 
@@ -401,10 +801,21 @@ pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 		return EINVAL;
 	}
 
+	if (theirpid == WAIT_ANY) {
+		result = pid_waitmany(&anypid, status, 1, flags, &count);
+		if (result) {
+			return result;
+		}
+		if (ret != NULL) {
+			*ret = count > 0 ? anypid : 0;
+		}
+		return 0;
+	}
+
 	/*
-	 * We don't support the Unix meanings of negative pids or 0
-	 * (0 is INVALID_PID) and other code may break on them, so
-	 * check now.
+	 * We don't support the Unix meanings of other negative pids
+	 * or 0 (0 is INVALID_PID) and other code may break on them,
+	 * so check now.
 	 */
 	if (theirpid == INVALID_PID || theirpid<0) {
 		return ENOSYS;
@@ -415,32 +826,79 @@ pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 		return EINVAL;
 	}
 
-	lock_acquire(pidlock);
-
+	/*
+	 * Check without any locks first. Nobody else can make the pid
+	 * our child, so if it isn't one now the answer stands; and a
+	 * WNOHANG poll of a child that's still running needn't lock
+	 * anything either.
+	 */
+	rcu_read_lock();
 	them = pi_get(theirpid);
-	if (them==NULL) {
-		lock_release(pidlock);
+	if (them == NULL) {
+		rcu_read_unlock();
 		return ESRCH;
 	}
-
-	KASSERT(them->pi_pid==theirpid);
-
-	/* Only allow waiting for own children. */
 	if (them->pi_ppid != curproc->p_pid) {
-		lock_release(pidlock);
+		rcu_read_unlock();
 		return EPERM;
 	}
+	if (flags == WNOHANG && them->pi_exited == false) {
+		rcu_read_unlock();
+		KASSERT(ret != NULL);
+		*ret = 0;
+		return 0;
+	}
+	rcu_read_unlock();
+
+	us = pi_self();
+	lock_acquire(us->pi_lock);
+
+	result = pi_getchild(us, theirpid, &them);
+	if (result) {
+		lock_release(us->pi_lock);
+		return result;
+	}
 
+	KASSERT(them->pi_pid==theirpid);
+
+	lock_acquire(them->pi_lock);
 	if (them->pi_exited == false) {
 		if (flags == WNOHANG) {
-			lock_release(pidlock);
+			lock_release(them->pi_lock);
+			lock_release(us->pi_lock);
 			KASSERT(ret != NULL);
 			*ret = 0;
 			return 0;
 		}
-		/* don't need to loop on this */
-		cv_wait(them->pi_cv, pidlock);
-		KASSERT(them->pi_exited == true);
+
+		/*
+		 * Don't hold our own lock while we sleep; hold a
+		 * reference instead so the child can't be freed.
+		 */
+		them->pi_refs++;
+		lock_release(us->pi_lock);
+		while (them->pi_exited == false) {
+			result = cv_wait_intr(them->pi_cv, them->pi_lock);
+			if (result) {
+				/* We're exiting; give up. */
+				break;
+			}
+		}
+		lock_release(them->pi_lock);
+
+		lock_acquire(us->pi_lock);
+		lock_acquire(them->pi_lock);
+		them->pi_refs--;
+		if (result || them->pi_ppid != us->pi_pid) {
+			/* Or another of our threads collected it first. */
+			drop = pi_unused(them);
+			lock_release(them->pi_lock);
+			lock_release(us->pi_lock);
+			if (drop) {
+				pi_drop(them);
+			}
+			return result ? result : ESRCH;
+		}
 	}
 
 	if (status != NULL) {
@@ -451,15 +909,18 @@ pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 		 * In Unix you can wait for any of several possible
 		 * processes by passing particular magic values of
 		 * pid. wait then returns the pid you actually
-		 * found. We don't support this, so always return the
-		 * pid we looked for.
+		 * found. Other than WAIT_ANY (handled above) we don't
+		 * support this, so return the pid we looked for.
 		 */
 		*ret = theirpid;
 	}
 
-	them->pi_ppid = 0;
-	pi_drop(them->pi_pid);
+	drop = pi_orphan(us, them);
+	lock_release(them->pi_lock);
+	lock_release(us->pi_lock);
 
-	lock_release(pidlock);
+	if (drop) {
+		pi_drop(them);
+	}
 	return 0;
 }
@@ -44,6 +44,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/wait.h>
 #include <spl.h>
 #include <proc.h>
 #include <current.h>
@@ -51,12 +52,16 @@
 #include <vnode.h>
 #include <pid.h>
 #include <filetable.h>
+#include <syscall.h>
+#include <syscallstat.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+static bool proc_remthread_locked(struct proc *proc, struct thread *t);
+
 /*
  * Create a proc structure.
  */
@@ -87,6 +92,15 @@ proc_create(const char *name)
 	proc->p_cwd = NULL;
 	proc->p_filetable = NULL;
 
+	/* user-level threads */
+	proc->p_ustacks = 0;
+	proc->p_exiting = false;
+	proc->p_exitstatus = 0;
+
+#if OPT_SYSCALLSTAT
+	proc->p_syscalltrace = NULL;
+#endif
+
 	return proc;
 }
 
@@ -174,6 +188,10 @@ proc_destroy(struct proc *proc)
 		as_destroy(as);
 	}
 
+#if OPT_SYSCALLSTAT
+	syscalltrace_finish(proc);
+#endif
+
 	KASSERT(proc->p_pid == INVALID_PID);
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
@@ -244,24 +262,20 @@ proc_create_runprogram(const char *name, struct proc **ret)
 }
 
 /*
- * Clone the current process.
- *
- * The new thread is given a copy of the caller's file handles if RET
- * is not null. (If RET is null, what we're creating is a kernel-only
- * thread and it doesn't need an address space or file handles.)
- * However, the new thread always inherits its current working
- * directory from the caller. The new thread is given no address space
- * (the caller decides that).
+ * Common code for proc_fork and proc_spawn: make a process with a
+ * copy of the caller's file handles and current directory, and a
+ * copy of its address space too if COPYAS is set.
  */
+static
 int
-proc_fork(struct proc **ret)
+proc_fork_common(const char *name, bool copyas, struct proc **ret)
 {
 	struct proc *newproc;
 	struct addrspace *as;
 	struct filetable *tbl;
 	int result;
 
-	newproc = proc_create(curproc->p_name);
+	newproc = proc_create(name);
 	if (newproc == NULL) {
 		return ENOMEM;
 	}
@@ -283,7 +297,7 @@ proc_fork(struct proc **ret)
 #endif
 
 	/* VM fields */
-	as = proc_getas();
+	as = copyas ? proc_getas() : NULL;
 	if (as != NULL) {
 		result = as_copy(as, &newproc->p_addrspace);
 		if (result) {
@@ -320,10 +334,49 @@ proc_fork(struct proc **ret)
 	}
 	spinlock_release(&curproc->p_lock);
 
+#if OPT_SYSCALLSTAT
+	result = syscalltrace_fork(curproc, newproc);
+	if (result) {
+		proc_unfork(newproc);
+		return result;
+	}
+#endif
+
+	/*
+	 * The child's one thread carries on on the forking thread's
+	 * stack, so keep that slot reserved.
+	 */
+	if (copyas && curthread->t_ustack >= 0) {
+		newproc->p_ustacks = (uint32_t)1 << curthread->t_ustack;
+	}
+
 	*ret = newproc;
 	return 0;
 }
 
+/*
+ * Clone the current process.
+ *
+ * The new process gets a copy of the caller's address space, file
+ * handles, and current working directory.
+ */
+int
+proc_fork(struct proc **ret)
+{
+	return proc_fork_common(curproc->p_name, true, ret);
+}
+
+/*
+ * Create a process for spawn(). It's like proc_fork, except that it
+ * gets no address space, because its first thread is about to load
+ * a new program anyway. Clean up with proc_unfork.
+ */
+int
+proc_spawn(const char *name, struct proc **ret)
+{
+	return proc_fork_common(name, false, ret);
+}
+
 /*
  * Undo proc_fork if nothing's run in the new process yet.
  */
@@ -336,18 +389,185 @@ proc_unfork(struct proc *newproc)
 }
 
 /*
- * Make the current process exit.
+ * Check whether another thread has called _exit, and if so, exit.
+ * Called on the way back to user mode.
+ */
+void
+proc_exitcheck(void)
+{
+	if (curproc->p_exiting) {
+		proc_exitthread();
+	}
+}
+
+/*
+ * Reserve a stack slot for a new user thread in the current process.
+ */
+int
+proc_getustack(unsigned *ret)
+{
+	struct proc *proc = curproc;
+	unsigned i;
+
+	spinlock_acquire(&proc->p_lock);
+	if (proc->p_exiting) {
+		spinlock_release(&proc->p_lock);
+		return ESRCH;
+	}
+	for (i=0; i<USERTHREADSTACK_MAX; i++) {
+		if ((proc->p_ustacks & ((uint32_t)1 << i)) == 0) {
+			proc->p_ustacks |= (uint32_t)1 << i;
+			spinlock_release(&proc->p_lock);
+			*ret = i;
+			return 0;
+		}
+	}
+	spinlock_release(&proc->p_lock);
+	return EAGAIN;
+}
+
+/*
+ * Give back a stack slot from proc_getustack.
+ */
+void
+proc_putustack(unsigned slot)
+{
+	struct proc *proc = curproc;
+
+	KASSERT(slot < USERTHREADSTACK_MAX);
+
+	spinlock_acquire(&proc->p_lock);
+	KASSERT(proc->p_ustacks & ((uint32_t)1 << slot));
+	proc->p_ustacks &= ~((uint32_t)1 << slot);
+	spinlock_release(&proc->p_lock);
+}
+
+/*
+ * Count the threads in a process.
+ */
+unsigned
+proc_nthreads(struct proc *proc)
+{
+	unsigned num;
+
+	spinlock_acquire(&proc->p_lock);
+	num = threadarray_num(&proc->p_threads);
+	spinlock_release(&proc->p_lock);
+	return num;
+}
+
+/*
+ * Wake the other threads of PROC out of interruptible sleeps. If one
+ * of their sleep locks is busy, let go of p_lock and start over;
+ * threads already woken are skipped quickly the second time.
+ */
+static
+void
+proc_interruptall(struct proc *proc)
+{
+	struct thread *t;
+	unsigned i, num;
+	bool done;
+
+	do {
+		done = true;
+		spinlock_acquire(&proc->p_lock);
+		num = threadarray_num(&proc->p_threads);
+		for (i=0; i<num; i++) {
+			t = threadarray_get(&proc->p_threads, i);
+			if (t != curthread && !thread_interrupt(t)) {
+				done = false;
+				break;
+			}
+		}
+		spinlock_release(&proc->p_lock);
+	} while (!done);
+}
+
+/*
+ * Make the current process exit. Other threads in it see p_exiting
+ * in proc_exitcheck and leave through proc_exitthread; whichever
+ * thread is last does the actual work. Threads blocked in the kernel
+ * on the process's behalf are woken here and get EINTR.
  */
 void
 proc_exit(int status)
 {
 	struct proc *proc = curproc;
+	bool multi;
+
+	/* The kernel isn't supposed to exit. */
+	KASSERT(proc != kproc);
+
+	spinlock_acquire(&proc->p_lock);
+	if (!proc->p_exiting) {
+		proc->p_exiting = true;
+		proc->p_exitstatus = status;
+	}
+	multi = threadarray_num(&proc->p_threads) > 1;
+	spinlock_release(&proc->p_lock);
+
+	/* Don't leave other threads asleep in the kernel. */
+	if (multi) {
+		proc_interruptall(proc);
+		futex_wakeproc(proc->p_addrspace);
+	}
+
+	proc_exitthread();
+}
+
+/*
+ * Make the current thread exit. If other threads remain, just leave
+ * the process; otherwise the process exits too, with the status from
+ * _exit if some thread called it and 0 if they all just finished.
+ */
+void
+proc_exitthread(void)
+{
+	struct proc *proc = curproc;
+	int spl;
 
 	/* The kernel isn't supposed to exit. */
 	KASSERT(proc != kproc);
+	KASSERT(curthread->t_proc == proc);
+
+	spinlock_acquire(&proc->p_lock);
+	if (curthread->t_ustack >= 0) {
+		proc->p_ustacks &= ~((uint32_t)1 << curthread->t_ustack);
+		curthread->t_ustack = -1;
+	}
+	if (threadarray_num(&proc->p_threads) > 1) {
+		/* Not the last one; just detach. */
+		if (!proc_remthread_locked(proc, curthread)) {
+			panic("proc_exitthread: thread not in process\n");
+		}
+		spinlock_release(&proc->p_lock);
+
+		spl = splhigh();
+		curthread->t_proc = NULL;
+		splx(spl);
+
+		proc_addthread(kproc, curthread);
+		thread_exit();
+	}
+
+	/*
+	 * We're the last thread. Nobody can add another now that
+	 * p_exiting is set (see proc_getustack).
+	 */
+	if (!proc->p_exiting) {
+		proc->p_exiting = true;
+		proc->p_exitstatus = _MKWAIT_EXIT(0);
+	}
+	spinlock_release(&proc->p_lock);
+
+#if OPT_SYSCALLSTAT
+	/* Print the trace (if any) while we still have our pid. */
+	syscalltrace_finish(proc);
+#endif
 
 	/* Set exit status and wake up anyone waiting for us. */
-	pid_setexitstatus(status);
+	pid_setexitstatus(proc->p_exitstatus);
 
 	/* Detach from the process and attach to the kernel process. */
 	KASSERT(curthread->t_proc == proc);
@@ -392,6 +612,29 @@ proc_addthread(struct proc *proc, struct thread *t)
 	return 0;
 }
 
+/*
+ * Find thread T in PROC's thread array and take it out. The process
+ * must be locked. Returns false if it isn't there.
+ */
+static
+bool
+proc_remthread_locked(struct proc *proc, struct thread *t)
+{
+	unsigned i, num;
+
+	KASSERT(spinlock_do_i_hold(&proc->p_lock));
+
+	/* ugh: find the thread in the array */
+	num = threadarray_num(&proc->p_threads);
+	for (i=0; i<num; i++) {
+		if (threadarray_get(&proc->p_threads, i) == t) {
+			threadarray_remove(&proc->p_threads, i);
+			return true;
+		}
+	}
+	return false;
+}
+
 /*
  * Remove a thread from its process. Either the thread or the process
  * might or might not be current.
@@ -405,37 +648,32 @@ void
 proc_remthread(struct thread *t)
 {
 	struct proc *proc;
-	unsigned i, num;
 	int spl;
 
 	proc = t->t_proc;
 	KASSERT(proc != NULL);
 
 	spinlock_acquire(&proc->p_lock);
-	/* ugh: find the thread in the array */
-	num = threadarray_num(&proc->p_threads);
-	for (i=0; i<num; i++) {
-		if (threadarray_get(&proc->p_threads, i) == t) {
-			threadarray_remove(&proc->p_threads, i);
-			spinlock_release(&proc->p_lock);
-			spl = splhigh();
-			t->t_proc = NULL;
-			splx(spl);
-			return;
-		}
+	if (!proc_remthread_locked(proc, t)) {
+		/* Did not find it. */
+		spinlock_release(&proc->p_lock);
+		panic("Thread (%p) has escaped from its process (%p)\n",
+		      t, proc);
 	}
-	/* Did not find it. */
 	spinlock_release(&proc->p_lock);
-	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
+
+	spl = splhigh();
+	t->t_proc = NULL;
+	splx(spl);
 }
 
 /*
  * Fetch the address space of (the current) process.
  *
- * Caution: address spaces aren't refcounted. If you implement
- * multithreaded processes, make sure to set up a refcount scheme or
- * some other method to make this safe. Otherwise the returned address
- * space might disappear under you.
+ * Caution: address spaces aren't refcounted. This is still safe for
+ * multithreaded processes because the address space is only replaced
+ * by execv, which refuses to run while there are other threads, and
+ * only destroyed by the last thread to exit.
  */
 struct addrspace *
 proc_getas(void)
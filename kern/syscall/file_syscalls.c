@@ -36,17 +36,22 @@
 #include <kern/fcntl.h>
 #include <kern/limits.h>
 #include <kern/seek.h>
+#include <kern/sem.h>
 #include <kern/stat.h>
+#include <limits.h>
 #include <lib.h>
 #include <uio.h>
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
+#include <vm.h>
 #include <copyinout.h>
+#include <fs.h>
 #include <vfs.h>
 #include <vnode.h>
 #include <openfile.h>
 #include <filetable.h>
+#include <pipe.h>
 #include <syscall.h>
 
 /*
@@ -105,19 +110,20 @@ sys_open(const_userptr_t upath, int flags, mode_t mode, int *retval)
 }
 
 /*
- * Common logic for read and write.
+ * Common logic for read and write, and readv and writev.
  *
- * Look up the fd, then use VOP_READ or VOP_WRITE.
+ * Look up the fd, then use VOP_READ or VOP_WRITE. The user buffers
+ * are IOV (IOVCNT of them), holding SIZE bytes in all; they all go
+ * in one uio, so one VOP call does the whole transfer.
  */
 static
 int
-sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
-	      int badaccmode, ssize_t *retval)
+sys_readwrite(int fd, struct iovec *iov, unsigned iovcnt, size_t size,
+	      enum uio_rw rw, int badaccmode, ssize_t *retval)
 {
 	struct openfile *file;
 	bool locked;
 	off_t pos;
-	struct iovec iov;
 	struct uio useruio;
 	int result;
 
@@ -142,8 +148,8 @@ sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
 		goto fail;
 	}
 
-	/* set up a uio with the buffer, its size, and the current offset */
-	uio_uinit(&iov, &useruio, buf, size, pos, rw);
+	/* set up a uio with the buffers, their size, and the current offset */
+	uio_uinitv(iov, iovcnt, &useruio, size, pos, rw);
 
 	/* do the read or write */
 	result = (rw == UIO_READ) ?
@@ -177,13 +183,135 @@ fail:
 	return result;
 }
 
+/*
+ * Common logic for pread and pwrite, and preadv and pwritev.
+ *
+ * Like sys_readwrite, but the position comes from the caller and the
+ * file's own seek position isn't used or changed. So of_offsetlock
+ * isn't taken either, and processes and threads sharing the openfile
+ * can do positional I/O on it in parallel.
+ */
+static
+int
+sys_preadwrite(int fd, struct iovec *iov, unsigned iovcnt, size_t size,
+	       off_t pos, enum uio_rw rw, int badaccmode, ssize_t *retval)
+{
+	struct openfile *file;
+	struct uio useruio;
+	int result;
+
+	/* better be a valid file descriptor */
+	result = filetable_get(curproc->p_filetable, fd, &file);
+	if (result) {
+		return result;
+	}
+
+	if (file->of_accmode == badaccmode) {
+		result = EBADF;
+		goto out;
+	}
+
+	/* positions only mean something on seekable objects */
+	if (!VOP_ISSEEKABLE(file->of_vnode)) {
+		result = ESPIPE;
+		goto out;
+	}
+	if (pos < 0) {
+		result = EINVAL;
+		goto out;
+	}
+
+	/* set up a uio with the buffers, their size, and the given offset */
+	uio_uinitv(iov, iovcnt, &useruio, size, pos, rw);
+
+	/* do the read or write */
+	result = (rw == UIO_READ) ?
+		VOP_READ(file->of_vnode, &useruio) :
+		VOP_WRITE(file->of_vnode, &useruio);
+	if (result) {
+		goto out;
+	}
+
+	/* as for read and write */
+	*retval = size - useruio.uio_resid;
+
+out:
+	filetable_put(curproc->p_filetable, fd, file);
+	return result;
+}
+
+/*
+ * Copy in an iovec array for the vectored calls and total up the
+ * lengths. Only the lengths are checked here; the buffer pointers
+ * get checked by uiomove as the I/O happens.
+ *
+ * Arrays of up to IOV_SMALL entries go in SMALLIOV, which the caller
+ * supplies; bigger ones are allocated, and the caller frees *KIOV_RET
+ * if it isn't SMALLIOV.
+ */
+#define IOV_SMALL	8
+
+static
+int
+iov_copyin(const_userptr_t uiov, int iovcnt, struct iovec *smalliov,
+	   struct iovec **kiov_ret, size_t *size_ret)
+{
+	struct iovec *kiov;
+	size_t size;
+	int i, result;
+
+	if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+		return EINVAL;
+	}
+
+	if (iovcnt <= IOV_SMALL) {
+		kiov = smalliov;
+	}
+	else {
+		kiov = kmalloc(iovcnt * sizeof(*kiov));
+		if (kiov == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	result = copyin(uiov, kiov, iovcnt * sizeof(*kiov));
+	if (result) {
+		goto fail;
+	}
+
+	/* the total has to fit in the ssize_t return value */
+	size = 0;
+	for (i=0; i<iovcnt; i++) {
+		if (size + kiov[i].iov_len < size ||
+		    (ssize_t)(size + kiov[i].iov_len) < 0) {
+			result = EINVAL;
+			goto fail;
+		}
+		size += kiov[i].iov_len;
+	}
+
+	*kiov_ret = kiov;
+	*size_ret = size;
+	return 0;
+
+fail:
+	if (kiov != smalliov) {
+		kfree(kiov);
+	}
+	return result;
+}
+
 /*
  * read() - use sys_readwrite
  */
 int
 sys_read(int fd, userptr_t buf, size_t size, int *retval)
 {
-	return sys_readwrite(fd, buf, size, UIO_READ, O_WRONLY, retval);
+	struct iovec iov;
+
+	iov.iov_ubase = buf;
+	iov.iov_len = size;
+	return sys_readwrite(fd, &iov, 1, size, UIO_READ, O_WRONLY, retval);
 }
 
 /*
@@ -192,7 +320,419 @@ sys_read(int fd, userptr_t buf, size_t size, int *retval)
 int
 sys_write(int fd, userptr_t buf, size_t size, int *retval)
 {
-	return sys_readwrite(fd, buf, size, UIO_WRITE, O_RDONLY, retval);
+	struct iovec iov;
+
+	iov.iov_ubase = buf;
+	iov.iov_len = size;
+	return sys_readwrite(fd, &iov, 1, size, UIO_WRITE, O_RDONLY, retval);
+}
+
+/*
+ * pread() - use sys_preadwrite
+ */
+int
+sys_pread(int fd, userptr_t buf, size_t size, off_t pos, int *retval)
+{
+	struct iovec iov;
+
+	iov.iov_ubase = buf;
+	iov.iov_len = size;
+	return sys_preadwrite(fd, &iov, 1, size, pos, UIO_READ, O_WRONLY,
+			      retval);
+}
+
+/*
+ * pwrite() - use sys_preadwrite
+ */
+int
+sys_pwrite(int fd, userptr_t buf, size_t size, off_t pos, int *retval)
+{
+	struct iovec iov;
+
+	iov.iov_ubase = buf;
+	iov.iov_len = size;
+	return sys_preadwrite(fd, &iov, 1, size, pos, UIO_WRITE, O_RDONLY,
+			      retval);
+}
+
+/*
+ * Common logic for readv and writev: copy in the iovecs, then use
+ * sys_readwrite.
+ */
+static
+int
+sys_readwritev(int fd, const_userptr_t uiov, int iovcnt, enum uio_rw rw,
+	       ssize_t *retval)
+{
+	struct iovec smalliov[IOV_SMALL], *kiov;
+	size_t size;
+	int result;
+
+	result = iov_copyin(uiov, iovcnt, smalliov, &kiov, &size);
+	if (result) {
+		return result;
+	}
+	result = sys_readwrite(fd, kiov, iovcnt, size, rw,
+			       rw == UIO_READ ? O_WRONLY : O_RDONLY, retval);
+	if (kiov != smalliov) {
+		kfree(kiov);
+	}
+	return result;
+}
+
+/*
+ * Common logic for preadv and pwritev: copy in the iovecs, then use
+ * sys_preadwrite.
+ */
+static
+int
+sys_preadwritev(int fd, const_userptr_t uiov, int iovcnt, off_t pos,
+		enum uio_rw rw, ssize_t *retval)
+{
+	struct iovec smalliov[IOV_SMALL], *kiov;
+	size_t size;
+	int result;
+
+	result = iov_copyin(uiov, iovcnt, smalliov, &kiov, &size);
+	if (result) {
+		return result;
+	}
+	result = sys_preadwrite(fd, kiov, iovcnt, size, pos, rw,
+				rw == UIO_READ ? O_WRONLY : O_RDONLY, retval);
+	if (kiov != smalliov) {
+		kfree(kiov);
+	}
+	return result;
+}
+
+/*
+ * readv() - use sys_readwritev
+ */
+int
+sys_readv(int fd, const_userptr_t iov, int iovcnt, int *retval)
+{
+	return sys_readwritev(fd, iov, iovcnt, UIO_READ, retval);
+}
+
+/*
+ * writev() - use sys_readwritev
+ */
+int
+sys_writev(int fd, const_userptr_t iov, int iovcnt, int *retval)
+{
+	return sys_readwritev(fd, iov, iovcnt, UIO_WRITE, retval);
+}
+
+/*
+ * preadv() - use sys_preadwritev
+ */
+int
+sys_preadv(int fd, const_userptr_t iov, int iovcnt, off_t pos, int *retval)
+{
+	return sys_preadwritev(fd, iov, iovcnt, pos, UIO_READ, retval);
+}
+
+/*
+ * pwritev() - use sys_preadwritev
+ */
+int
+sys_pwritev(int fd, const_userptr_t iov, int iovcnt, off_t pos, int *retval)
+{
+	return sys_preadwritev(fd, iov, iovcnt, pos, UIO_WRITE, retval);
+}
+
+/*
+ * Buffer for copy_file_range. It's a multiple of the SFS block size,
+ * and chunks after the first start at a multiple of it in the source,
+ * so when both files are lined up the same way (as when cp copies a
+ * whole file) every block goes straight from the disk into the
+ * buffer and back out, without sfs_partialio's read-modify-write.
+ */
+#define COPY_BUFSIZE	(2 * PAGE_SIZE)
+
+/*
+ * One side of a copy_file_range.
+ */
+struct copyend {
+	struct openfile *ce_file;
+	userptr_t ce_upos;	/* user's position, or NULL for the file's */
+	bool ce_useoffset;	/* using (and holding the lock on) of_offset */
+	off_t ce_pos;
+};
+
+/*
+ * Check one side of a copy and get its position if it comes from
+ * the user. The file's own offset is fetched later, once it's locked.
+ */
+static
+int
+copyend_setup(struct copyend *ce, int badaccmode)
+{
+	struct vnode *vn = ce->ce_file->of_vnode;
+	int result;
+
+	if (ce->ce_file->of_accmode == badaccmode) {
+		return EBADF;
+	}
+
+	ce->ce_useoffset = false;
+	ce->ce_pos = 0;
+	if (ce->ce_upos != NULL) {
+		/* as for pread and pwrite */
+		if (!VOP_ISSEEKABLE(vn)) {
+			return ESPIPE;
+		}
+		result = copyin(ce->ce_upos, &ce->ce_pos, sizeof(ce->ce_pos));
+		if (result) {
+			return result;
+		}
+		if (ce->ce_pos < 0) {
+			return EINVAL;
+		}
+	}
+	else if (VOP_ISSEEKABLE(vn)) {
+		ce->ce_useoffset = true;
+	}
+	return 0;
+}
+
+/*
+ * Move up to LEN bytes from IN to OUT through a kernel buffer.
+ * Stops early at EOF, or after a short read from something like a
+ * pipe. An error only counts if nothing was copied; otherwise the
+ * caller gets the short count, as with a short write.
+ */
+static
+int
+copy_range(struct copyend *in, struct copyend *out, size_t len,
+	   size_t *done_ret)
+{
+	struct iovec iov;
+	struct uio ku;
+	char *buf;
+	size_t done, chunk, got, put;
+	int result;
+
+	buf = kmalloc(COPY_BUFSIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	done = 0;
+	result = 0;
+	while (done < len) {
+		chunk = COPY_BUFSIZE - in->ce_pos % COPY_BUFSIZE;
+		if (chunk > len - done) {
+			chunk = len - done;
+		}
+
+		uio_kinit(&iov, &ku, buf, chunk, in->ce_pos, UIO_READ);
+		result = VOP_READ(in->ce_file->of_vnode, &ku);
+		if (result) {
+			break;
+		}
+		got = chunk - ku.uio_resid;
+		if (got == 0) {
+			/* EOF */
+			break;
+		}
+
+		uio_kinit(&iov, &ku, buf, got, out->ce_pos, UIO_WRITE);
+		result = VOP_WRITE(out->ce_file->of_vnode, &ku);
+		put = got - ku.uio_resid;
+		in->ce_pos += put;
+		out->ce_pos += put;
+		done += put;
+		if (result || put < got || got < chunk) {
+			break;
+		}
+	}
+
+	kfree(buf);
+	*done_ret = done;
+	return done > 0 ? 0 : result;
+}
+
+/*
+ * copy_file_range() - copy up to LEN bytes from INFD to OUTFD inside
+ * the kernel, so the data never crosses into user memory. If UINPOS
+ * (or UOUTPOS) isn't NULL it points to the position to use on that
+ * side, which is updated and the file's own offset left alone, as
+ * with pread/pwrite; otherwise the file's offset is used and
+ * advanced, as with read/write. No flags are defined.
+ */
+int
+sys_copy_file_range(int infd, userptr_t uinpos, int outfd, userptr_t uoutpos,
+		    size_t len, unsigned flags, int *retval)
+{
+	struct copyend in, out, *first, *second;
+	struct vnode *invn, *outvn;
+	size_t done;
+	int result;
+
+	if (flags != 0) {
+		return EINVAL;
+	}
+
+	result = filetable_get(curproc->p_filetable, infd, &in.ce_file);
+	if (result) {
+		return result;
+	}
+	result = filetable_get(curproc->p_filetable, outfd, &out.ce_file);
+	if (result) {
+		filetable_put(curproc->p_filetable, infd, in.ce_file);
+		return result;
+	}
+	in.ce_upos = uinpos;
+	out.ce_upos = uoutpos;
+	invn = in.ce_file->of_vnode;
+	outvn = out.ce_file->of_vnode;
+
+	result = copyend_setup(&in, O_WRONLY);
+	if (result) {
+		goto out;
+	}
+	result = copyend_setup(&out, O_RDONLY);
+	if (result) {
+		goto out;
+	}
+	if (in.ce_useoffset && out.ce_useoffset && in.ce_file == out.ce_file) {
+		/* both ends at the same place */
+		result = EINVAL;
+		goto out;
+	}
+
+	/*
+	 * Lock the offsets, if we're using them, in address order so
+	 * two copies going opposite ways can't deadlock.
+	 */
+	if (in.ce_file < out.ce_file) {
+		first = &in;
+		second = &out;
+	}
+	else {
+		first = &out;
+		second = &in;
+	}
+	if (first->ce_useoffset) {
+		lock_acquire(first->ce_file->of_offsetlock);
+		first->ce_pos = first->ce_file->of_offset;
+	}
+	if (second->ce_useoffset) {
+		lock_acquire(second->ce_file->of_offsetlock);
+		second->ce_pos = second->ce_file->of_offset;
+	}
+
+	if (invn == outvn && VOP_ISSEEKABLE(invn) &&
+	    in.ce_pos < out.ce_pos + (off_t)len &&
+	    out.ce_pos < in.ce_pos + (off_t)len) {
+		/* overlapping ranges of the same file */
+		result = EINVAL;
+		done = 0;
+	}
+	else {
+		result = copy_range(&in, &out, len, &done);
+	}
+
+	if (second->ce_useoffset) {
+		second->ce_file->of_offset = second->ce_pos;
+		lock_release(second->ce_file->of_offsetlock);
+	}
+	if (first->ce_useoffset) {
+		first->ce_file->of_offset = first->ce_pos;
+		lock_release(first->ce_file->of_offsetlock);
+	}
+	if (result) {
+		goto out;
+	}
+
+	if (uinpos != NULL) {
+		result = copyout(&in.ce_pos, uinpos, sizeof(in.ce_pos));
+		if (result) {
+			goto out;
+		}
+	}
+	if (uoutpos != NULL) {
+		result = copyout(&out.ce_pos, uoutpos, sizeof(out.ce_pos));
+		if (result) {
+			goto out;
+		}
+	}
+	*retval = done;
+
+out:
+	filetable_put(curproc->p_filetable, outfd, out.ce_file);
+	filetable_put(curproc->p_filetable, infd, in.ce_file);
+	return result;
+}
+
+/*
+ * Take back an fd pipe() placed. Another thread may have closed it or
+ * put something else there in the meantime, so close whatever is
+ * there now, if anything, as close() would.
+ */
+static
+void
+sys_pipe_unplace(struct filetable *ft, int fd)
+{
+	struct openfile *junk;
+
+	(void)filetable_placeat(ft, NULL, fd, &junk);
+	if (junk != NULL) {
+		openfile_decref(junk);
+	}
+}
+
+/*
+ * pipe() - make a pipe and put its two ends in the file table.
+ */
+int
+sys_pipe(userptr_t fdsptr)
+{
+	struct filetable *ft;
+	struct vnode *readvn, *writevn;
+	struct openfile *readfile, *writefile;
+	int fds[2];
+	int result;
+
+	ft = curproc->p_filetable;
+
+	result = pipe_create(&readvn, &writevn);
+	if (result) {
+		return result;
+	}
+	result = openfile_fromvnode(readvn, O_RDONLY, &readfile);
+	if (result) {
+		VOP_DECREF(writevn);
+		return result;
+	}
+	result = openfile_fromvnode(writevn, O_WRONLY, &writefile);
+	if (result) {
+		openfile_decref(readfile);
+		return result;
+	}
+
+	result = filetable_place(ft, readfile, &fds[0]);
+	if (result) {
+		openfile_decref(readfile);
+		openfile_decref(writefile);
+		return result;
+	}
+	result = filetable_place(ft, writefile, &fds[1]);
+	if (result) {
+		sys_pipe_unplace(ft, fds[0]);
+		openfile_decref(writefile);
+		return result;
+	}
+
+	result = copyout(fds, fdsptr, sizeof(fds));
+	if (result) {
+		/* can't tell the process the fds, so take them back */
+		sys_pipe_unplace(ft, fds[0]);
+		sys_pipe_unplace(ft, fds[1]);
+		return result;
+	}
+	return 0;
 }
 
 /*
@@ -211,8 +751,11 @@ sys_close(int fd)
 		return EBADF;
 	}
 
-	/* place null in the filetable and get the file previously there */
-	filetable_placeat(ft, NULL, fd, &file);
+	/*
+	 * place null in the filetable and get the file previously
+	 * there (placing null can't fail)
+	 */
+	(void)filetable_placeat(ft, NULL, fd, &file);
 
 	if (file == NULL) {
 		/* oops, it wasn't open, that's an error */
@@ -321,7 +864,11 @@ sys_dup2(int oldfd, int newfd, int *retval)
 	filetable_put(ft, oldfd, oldfdfile);
 
 	/* place it */
-	filetable_placeat(ft, oldfdfile, newfd, &newfdfile);
+	result = filetable_placeat(ft, oldfdfile, newfd, &newfdfile);
+	if (result) {
+		openfile_decref(oldfdfile);
+		return result;
+	}
 
 	/* if there was a file already there, drop that reference */
 	if (newfdfile != NULL) {
@@ -379,3 +926,54 @@ sys___getcwd(userptr_t buf, size_t buflen, int *retval)
 	*retval = buflen - useruio.uio_resid;
 	return 0;
 }
+
+/*
+ * semop() - apply a batch of semaphore operations. Look up all the
+ * files, check that each one is open for the direction it's used in
+ * (P reads, V writes), and hand the vnodes to semfs.
+ */
+int
+sys_semop(const_userptr_t uops, unsigned nops)
+{
+	struct sembuf ops[SEMOP_MAX];
+	struct openfile *files[SEMOP_MAX];
+	struct vnode *vns[SEMOP_MAX];
+	int deltas[SEMOP_MAX];
+	unsigned i, got;
+	int result;
+
+	if (nops > SEMOP_MAX) {
+		return E2BIG;
+	}
+	result = copyin(uops, ops, nops * sizeof(ops[0]));
+	if (result) {
+		return result;
+	}
+
+	for (got=0; got<nops; got++) {
+		result = filetable_get(curproc->p_filetable,
+				       ops[got].sem_fd, &files[got]);
+		if (result) {
+			goto out;
+		}
+		if ((ops[got].sem_op < 0 &&
+		     files[got]->of_accmode == O_WRONLY) ||
+		    (ops[got].sem_op > 0 &&
+		     files[got]->of_accmode == O_RDONLY)) {
+			filetable_put(curproc->p_filetable, ops[got].sem_fd,
+				      files[got]);
+			result = EBADF;
+			goto out;
+		}
+		vns[got] = files[got]->of_vnode;
+		deltas[got] = ops[got].sem_op;
+	}
+
+	result = semfs_semop(vns, deltas, nops);
+
+ out:
+	for (i=0; i<got; i++) {
+		filetable_put(curproc->p_filetable, ops[i].sem_fd, files[i]);
+	}
+	return result;
+}
@@ -34,52 +34,179 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <bitmap.h>
+#include <rcu.h>
 #include <openfile.h>
 #include <filetable.h>
 
 
 /*
- * Construct a filetable.
+ * Allocate an empty fd array of SIZE slots.
+ */
+static
+struct fdarray *
+fdarray_create(unsigned size)
+{
+	struct fdarray *fa;
+	unsigned fd;
+
+	fa = kmalloc(sizeof(*fa) + size * sizeof(fa->fa_files[0]));
+	if (fa == NULL) {
+		return NULL;
+	}
+	fa->fa_size = size;
+	for (fd = 0; fd < size; fd++) {
+		fa->fa_files[fd] = NULL;
+	}
+	return fa;
+}
+
+/*
+ * Free an fd array; call_rcu callback for ones replaced by growing.
+ */
+static
+void
+fdarray_free(void *data)
+{
+	kfree(data);
+}
+
+/*
+ * Construct a filetable with room for at least SIZE descriptors.
  */
+static
 struct filetable *
-filetable_create(void)
+filetable_create_size(unsigned size)
 {
 	struct filetable *ft;
-	int fd;
+	unsigned fasize;
+
+	fasize = FILETABLE_MINSIZE;
+	while (fasize < size) {
+		fasize *= 2;
+	}
 
 	ft = kmalloc(sizeof(struct filetable));
 	if (ft == NULL) {
 		return NULL;
 	}
-
-	/* the table starts empty */
-	for (fd = 0; fd < OPEN_MAX; fd++) {
-		ft->ft_openfiles[fd] = NULL;
+	ft->ft_files = fdarray_create(fasize);
+	if (ft->ft_files == NULL) {
+		kfree(ft);
+		return NULL;
 	}
+	ft->ft_used = bitmap_create(fasize);
+	if (ft->ft_used == NULL) {
+		kfree(ft->ft_files);
+		kfree(ft);
+		return NULL;
+	}
+
+	spinlock_init(&ft->ft_lock);
+	ft->ft_top = 0;
 
 	return ft;
 }
 
+/*
+ * Construct a filetable.
+ */
+struct filetable *
+filetable_create(void)
+{
+	return filetable_create_size(0);
+}
+
 /*
  * Destroy a filetable.
  */
 void
 filetable_destroy(struct filetable *ft)
 {
-	int fd;
+	struct fdarray *fa;
+	unsigned fd;
 
 	KASSERT(ft != NULL);
 
 	/* Close any open files. */
-	for (fd = 0; fd < OPEN_MAX; fd++) {
-		if (ft->ft_openfiles[fd] != NULL) {
-			openfile_decref(ft->ft_openfiles[fd]);
-			ft->ft_openfiles[fd] = NULL;
+	fa = ft->ft_files;
+	for (fd = 0; fd < ft->ft_top; fd++) {
+		if (fa->fa_files[fd] != NULL) {
+			openfile_decref(fa->fa_files[fd]);
+			fa->fa_files[fd] = NULL;
 		}
 	}
+	spinlock_cleanup(&ft->ft_lock);
+	bitmap_destroy(ft->ft_used);
+	kfree(fa);
 	kfree(ft);
 }
 
+/*
+ * Make the table big enough for SIZE descriptors, doubling it as
+ * needed. SIZE must be at most OPEN_MAX. The new array and bitmap are
+ * allocated without the lock held, so if somebody else grows the
+ * table meanwhile we throw ours away and look again.
+ */
+static
+int
+filetable_grow(struct filetable *ft, unsigned size)
+{
+	struct fdarray *oldfa, *newfa;
+	struct bitmap *oldused, *newused;
+	unsigned oldsize, newsize, fd;
+
+	KASSERT(size <= OPEN_MAX);
+
+	while (1) {
+		spinlock_acquire(&ft->ft_lock);
+		oldsize = ft->ft_files->fa_size;
+		spinlock_release(&ft->ft_lock);
+		if (oldsize >= size) {
+			return 0;
+		}
+
+		newsize = oldsize;
+		while (newsize < size) {
+			newsize *= 2;
+		}
+		newfa = fdarray_create(newsize);
+		if (newfa == NULL) {
+			return ENOMEM;
+		}
+		newused = bitmap_create(newsize);
+		if (newused == NULL) {
+			kfree(newfa);
+			return ENOMEM;
+		}
+
+		spinlock_acquire(&ft->ft_lock);
+		oldfa = ft->ft_files;
+		oldused = ft->ft_used;
+		if (oldfa->fa_size == oldsize) {
+			for (fd = 0; fd < ft->ft_top; fd++) {
+				newfa->fa_files[fd] = oldfa->fa_files[fd];
+				if (newfa->fa_files[fd] != NULL) {
+					bitmap_mark(newused, fd);
+				}
+			}
+			rcu_assign(ft->ft_files, newfa);
+			ft->ft_used = newused;
+		}
+		spinlock_release(&ft->ft_lock);
+
+		if (oldfa->fa_size == oldsize) {
+			/* lookups may still be looking at the old array */
+			call_rcu(&oldfa->fa_rcu, fdarray_free, oldfa);
+			bitmap_destroy(oldused);
+		}
+		else {
+			kfree(newfa);
+			bitmap_destroy(newused);
+		}
+	}
+}
+
 /*
  * Clone a filetable, for use in fork.
  *
@@ -94,13 +221,16 @@ filetable_destroy(struct filetable *ft)
  *
  * produce the intended output instead of having the second echo
  * command overwrite the first.
+ *
+ * Only the descriptors below ft_top are looked at; the copy is sized
+ * for those, not for however big the original has grown.
  */
 int
 filetable_copy(struct filetable *src, struct filetable **dest_ret)
 {
 	struct filetable *dest;
 	struct openfile *file;
-	int fd;
+	unsigned fd, top;
 
 	/* Copying the nonexistent table avoids special cases elsewhere */
 	if (src == NULL) {
@@ -108,19 +238,37 @@ filetable_copy(struct filetable *src, struct filetable **dest_ret)
 		return 0;
 	}
 
-	dest = filetable_create();
+	spinlock_acquire(&src->ft_lock);
+	top = src->ft_top;
+	spinlock_release(&src->ft_lock);
+
+	dest = filetable_create_size(top);
 	if (dest == NULL) {
 		return ENOMEM;
 	}
 
 	/* share the entries */
-	for (fd = 0; fd < OPEN_MAX; fd++) {
-		file = src->ft_openfiles[fd];
+	spinlock_acquire(&src->ft_lock);
+	while (src->ft_top > dest->ft_files->fa_size) {
+		/* another thread opened more files meanwhile */
+		top = src->ft_top;
+		spinlock_release(&src->ft_lock);
+		if (filetable_grow(dest, top)) {
+			filetable_destroy(dest);
+			return ENOMEM;
+		}
+		spinlock_acquire(&src->ft_lock);
+	}
+	for (fd = 0; fd < src->ft_top; fd++) {
+		file = src->ft_files->fa_files[fd];
 		if (file != NULL) {
 			openfile_incref(file);
+			bitmap_mark(dest->ft_used, fd);
 		}
-		dest->ft_openfiles[fd] = file;
+		dest->ft_files->fa_files[fd] = file;
 	}
+	dest->ft_top = src->ft_top;
+	spinlock_release(&src->ft_lock);
 
 	*dest_ret = dest;
 	return 0;
@@ -132,7 +280,7 @@ filetable_copy(struct filetable *src, struct filetable **dest_ret)
 bool
 filetable_okfd(struct filetable *ft, int fd)
 {
-	/* We have a fixed-size table so we don't need to check the size */
+	/* The table grows on demand, so check against the limit */
 	(void)ft;
 
 	return (fd >= 0 && fd < OPEN_MAX);
@@ -149,42 +297,74 @@ filetable_okfd(struct filetable *ft, int fd)
 int
 filetable_get(struct filetable *ft, int fd, struct openfile **ret)
 {
+	struct fdarray *fa;
 	struct openfile *file;
 
 	if (!filetable_okfd(ft, fd)) {
 		return EBADF;
 	}
 
-	file = ft->ft_openfiles[fd];
-	if (file == NULL) {
+	/*
+	 * No lock: neither the array nor the openfile can be freed
+	 * while we're in the read section, and if the openfile is
+	 * already on its way out (refcount zero) the fd was just
+	 * closed.
+	 */
+	rcu_read_lock();
+	fa = ft->ft_files;
+	file = (unsigned)fd < fa->fa_size ? fa->fa_files[fd] : NULL;
+	if (file == NULL || !openfile_tryincref(file)) {
+		rcu_read_unlock();
 		return EBADF;
 	}
+	rcu_read_unlock();
 
 	*ret = file;
 	return 0;
 }
 
 /*
- * Put a file handle back when done with it. This does not actually do
- * anything (other than crosscheck) but it's always good practice to
- * build things so when you take them out you put them back again
- * rather than dropping them on the floor. Then if you need to do
- * something at cleanup time you can put it in this function instead
- * of having to hunt for all the places to insert the new logic.
- *
- * (For example, if you have multithreaded processes you will need to
- * insert additional lock and/or refcount manipulations here and in
- * filetable_get.)
- *
- * The openfile should be the one returned from filetable_get. If you
- * want to manipulate the table so the assertion's no longer true, get
- * your own reference to the openfile (with openfile_incref) and call
- * filetable_put before mucking about.
+ * Put a file handle back when done with it. This drops the reference
+ * filetable_get took. The fd may have been closed, or even reused,
+ * in the meantime, so don't expect it to still refer to FILE.
  */
 void
 filetable_put(struct filetable *ft, int fd, struct openfile *file)
 {
-	KASSERT(ft->ft_openfiles[fd] == file);
+	KASSERT(filetable_okfd(ft, fd));
+	openfile_decref(file);
+}
+
+/*
+ * Set slot FD to FILE and return what was there. Updates the bitmap
+ * and ft_top. Call with ft_lock held; FD must be within the array.
+ */
+static
+struct openfile *
+filetable_setslot(struct filetable *ft, unsigned fd, struct openfile *file)
+{
+	struct fdarray *fa = ft->ft_files;
+	struct openfile *old;
+
+	KASSERT(spinlock_do_i_hold(&ft->ft_lock));
+	KASSERT(fd < fa->fa_size);
+
+	old = fa->fa_files[fd];
+	if (old == NULL && file != NULL) {
+		bitmap_mark(ft->ft_used, fd);
+	}
+	else if (old != NULL && file == NULL) {
+		bitmap_unmark(ft->ft_used, fd);
+	}
+	rcu_assign(fa->fa_files[fd], file);
+
+	if (file != NULL && fd >= ft->ft_top) {
+		ft->ft_top = fd + 1;
+	}
+	while (ft->ft_top > 0 && fa->fa_files[ft->ft_top - 1] == NULL) {
+		ft->ft_top--;
+	}
+	return old;
 }
 
 /*
@@ -200,17 +380,34 @@ filetable_put(struct filetable *ft, int fd, struct openfile *file)
 int
 filetable_place(struct filetable *ft, struct openfile *file, int *fd_ret)
 {
-	int fd;
+	unsigned fd, size;
+	int result;
+
+	KASSERT(file != NULL);
 
-	for (fd = 0; fd < OPEN_MAX; fd++) {
-		if (ft->ft_openfiles[fd] == NULL) {
-			ft->ft_openfiles[fd] = file;
+	while (1) {
+		spinlock_acquire(&ft->ft_lock);
+		if (bitmap_alloc(ft->ft_used, &fd) == 0) {
+			KASSERT(ft->ft_files->fa_files[fd] == NULL);
+			rcu_assign(ft->ft_files->fa_files[fd], file);
+			if (fd >= ft->ft_top) {
+				ft->ft_top = fd + 1;
+			}
+			spinlock_release(&ft->ft_lock);
 			*fd_ret = fd;
 			return 0;
 		}
-	}
+		size = ft->ft_files->fa_size;
+		spinlock_release(&ft->ft_lock);
 
-	return EMFILE;
+		if (size == OPEN_MAX) {
+			return EMFILE;
+		}
+		result = filetable_grow(ft, size + 1);
+		if (result) {
+			return result;
+		}
+	}
 }
 
 /*
@@ -221,17 +418,34 @@ filetable_place(struct filetable *ft, struct openfile *file, int *fd_ret)
  * reference to the old openfile object (if not NULL); this should
  * generally be decref'd.
  *
- * Doesn't fail.
+ * Fails only if the table needs to grow to hold NEWFILE and can't.
  *
  * Note that you can use this to place NULL in the filetable, which is
  * potentially handy.
  */
-void
+int
 filetable_placeat(struct filetable *ft, struct openfile *newfile, int fd,
 		  struct openfile **oldfile_ret)
 {
+	int result;
+
 	KASSERT(filetable_okfd(ft, fd));
 
-	*oldfile_ret = ft->ft_openfiles[fd];
-	ft->ft_openfiles[fd] = newfile;
+	if (newfile != NULL) {
+		result = filetable_grow(ft, fd + 1);
+		if (result) {
+			return result;
+		}
+	}
+
+	spinlock_acquire(&ft->ft_lock);
+	if ((unsigned)fd < ft->ft_files->fa_size) {
+		*oldfile_ret = filetable_setslot(ft, fd, newfile);
+	}
+	else {
+		/* beyond the end, so empty; and newfile is NULL */
+		*oldfile_ret = NULL;
+	}
+	spinlock_release(&ft->ft_lock);
+	return 0;
 }
@@ -0,0 +1,219 @@
+/*
+ * Futexes: sleep and wake on a user address.
+ *
+ * User code keeps its lock or semaphore state in an ordinary int and
+ * only calls in here when it has to block (FUTEX_WAIT) or when it
+ * knows somebody is blocked (FUTEX_WAKE). Waiters are kept in a hash
+ * table keyed on (address space, user address); each bucket has its
+ * own lock and cv, so unrelated futexes rarely contend.
+ *
+ * FUTEX_WAIT reads the user word with the bucket lock held, so a
+ * FUTEX_WAKE that follows a change to the word cannot slip in between
+ * the check and the sleep.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/futex.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <synch.h>
+#include <current.h>
+#include <proc.h>
+#include <syscall.h>
+
+#define FUTEX_NBUCKETS	64
+
+struct futex_waiter {
+	struct addrspace *fw_as;
+	vaddr_t fw_addr;
+	bool fw_woken;
+	struct futex_waiter *fw_next;
+};
+
+struct futex_bucket {
+	struct lock *fb_lock;
+	struct cv *fb_cv;
+	struct futex_waiter *fb_waiters;	/* in arrival order */
+};
+
+static struct futex_bucket futex_table[FUTEX_NBUCKETS];
+
+/*
+ * Setup function.
+ */
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		futex_table[i].fb_lock = lock_create("futex");
+		futex_table[i].fb_cv = cv_create("futex");
+		if (futex_table[i].fb_lock == NULL ||
+		    futex_table[i].fb_cv == NULL) {
+			panic("Cannot create futex table\n");
+		}
+		futex_table[i].fb_waiters = NULL;
+	}
+}
+
+static
+struct futex_bucket *
+futex_hash(struct addrspace *as, vaddr_t addr)
+{
+	uintptr_t h;
+
+	h = (uintptr_t)as ^ (addr >> 2);
+	h ^= h >> 11;
+	return &futex_table[h % FUTEX_NBUCKETS];
+}
+
+/*
+ * Sleep until woken, as long as *ADDR still holds VAL.
+ */
+static
+int
+futex_wait(struct addrspace *as, userptr_t addr, int val)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter self, **wp;
+	int cur, result;
+
+	fb = futex_hash(as, (vaddr_t)addr);
+	lock_acquire(fb->fb_lock);
+
+	result = copyin((const_userptr_t)addr, &cur, sizeof(cur));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (cur != val) {
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+
+	self.fw_as = as;
+	self.fw_addr = (vaddr_t)addr;
+	self.fw_woken = false;
+	self.fw_next = NULL;
+	for (wp = &fb->fb_waiters; *wp != NULL; wp = &(*wp)->fw_next) {
+		/* nothing */
+	}
+	*wp = &self;
+
+	/* Give up if the process exits; see futex_wakeproc. */
+	while (!self.fw_woken && !curproc->p_exiting) {
+		cv_wait(fb->fb_cv, fb->fb_lock);
+	}
+
+	if (!self.fw_woken) {
+		for (wp = &fb->fb_waiters; *wp != &self;
+		     wp = &(*wp)->fw_next) {
+			KASSERT(*wp != NULL);
+		}
+		*wp = self.fw_next;
+		result = EINTR;
+	}
+	else {
+		/* futex_wake already unlinked us. */
+		result = 0;
+	}
+	lock_release(fb->fb_lock);
+	return result;
+}
+
+/*
+ * Wake up to MAX sleepers on ADDR, oldest first. Returns the number
+ * woken.
+ */
+static
+int
+futex_wake(struct addrspace *as, userptr_t addr, int max)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter *w, **wp;
+	int n;
+
+	fb = futex_hash(as, (vaddr_t)addr);
+	lock_acquire(fb->fb_lock);
+
+	n = 0;
+	wp = &fb->fb_waiters;
+	while (*wp != NULL && n < max) {
+		w = *wp;
+		if (w->fw_as == as && w->fw_addr == (vaddr_t)addr) {
+			*wp = w->fw_next;
+			w->fw_woken = true;
+			n++;
+		}
+		else {
+			wp = &w->fw_next;
+		}
+	}
+	if (n > 0) {
+		cv_broadcast(fb->fb_cv, fb->fb_lock);
+	}
+
+	lock_release(fb->fb_lock);
+	return n;
+}
+
+/*
+ * Kick every futex sleeper in address space AS so it notices that
+ * its process is exiting. Called from proc_exit after p_exiting is
+ * set.
+ */
+void
+futex_wakeproc(struct addrspace *as)
+{
+	struct futex_waiter *w;
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		lock_acquire(futex_table[i].fb_lock);
+		for (w = futex_table[i].fb_waiters; w != NULL;
+		     w = w->fw_next) {
+			if (w->fw_as == as) {
+				cv_broadcast(futex_table[i].fb_cv,
+					     futex_table[i].fb_lock);
+				break;
+			}
+		}
+		lock_release(futex_table[i].fb_lock);
+	}
+}
+
+/*
+ * futex system call.
+ */
+int
+sys_futex(userptr_t addr, int op, int val, int *retval)
+{
+	struct addrspace *as;
+	int result;
+
+	if ((vaddr_t)addr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+
+	as = proc_getas();
+	KASSERT(as != NULL);
+
+	switch (op) {
+	    case FUTEX_WAIT:
+		result = futex_wait(as, addr, val);
+		*retval = 0;
+		break;
+	    case FUTEX_WAKE:
+		if (val <= 0) {
+			return EINVAL;
+		}
+		*retval = futex_wake(as, addr, val);
+		result = 0;
+		break;
+	    default:
+		return EINVAL;
+	}
+	return result;
+}
@@ -37,6 +37,7 @@
 #include <lib.h>
 #include <synch.h>
 #include <vfs.h>
+#include <vnode.h>
 #include <openfile.h>
 
 /*
@@ -64,16 +65,25 @@ openfile_create(struct vnode *vn, int accmode)
 		return NULL;
 	}
 
-	spinlock_init(&file->of_reflock);
-
 	file->of_vnode = vn;
 	file->of_accmode = accmode;
 	file->of_offset = 0;
-	file->of_refcount = 1;
+	spinlock_data_set(&file->of_refcount, 1);
 
 	return file;
 }
 
+/*
+ * Free the memory for an openfile, once no lock-free lookup can still
+ * be looking at it. Called via call_rcu.
+ */
+static
+void
+openfile_free(void *data)
+{
+	kfree(data);
+}
+
 /*
  * Destructor for struct openfile. Private; should only be used via
  * openfile_decref().
@@ -85,9 +95,8 @@ openfile_destroy(struct openfile *file)
 	/* balance vfs_open with vfs_close (not VOP_DECREF) */
 	vfs_close(file->of_vnode);
 
-	spinlock_cleanup(&file->of_reflock);
 	lock_destroy(file->of_offsetlock);
-	kfree(file);
+	call_rcu(&file->of_rcu, openfile_free, file);
 }
 
 /*
@@ -116,15 +125,57 @@ openfile_open(char *filename, int openflags, mode_t mode,
 	return 0;
 }
 
+/*
+ * Wrap a vnode that didn't come from vfs_open (such as a pipe end) in
+ * an openfile. Consumes the caller's reference to the vnode, even on
+ * failure.
+ */
+int
+openfile_fromvnode(struct vnode *vn, int accmode, struct openfile **ret)
+{
+	struct openfile *file;
+
+	file = openfile_create(vn, accmode);
+	if (file == NULL) {
+		VOP_DECREF(vn);
+		return ENOMEM;
+	}
+
+	*ret = file;
+	return 0;
+}
+
 /*
  * Increment the reference count on an openfile.
  */
 void
 openfile_incref(struct openfile *file)
 {
-	spinlock_acquire(&file->of_reflock);
-	file->of_refcount++;
-	spinlock_release(&file->of_reflock);
+	KASSERT(spinlock_data_get(&file->of_refcount) > 0);
+	spinlock_data_fetchinc(&file->of_refcount);
+}
+
+/*
+ * Increment the reference count on an openfile that might be in the
+ * middle of being destroyed, for lookups that don't hold a reference
+ * already. Must be called under rcu_read_lock. Fails if the count
+ * has already reached zero.
+ */
+bool
+openfile_tryincref(struct openfile *file)
+{
+	spinlock_data_t count;
+
+	KASSERT(rcu_read_held());
+
+	do {
+		count = spinlock_data_get(&file->of_refcount);
+		if (count == 0) {
+			return false;
+		}
+	} while (spinlock_data_cmpxchg(&file->of_refcount,
+				       count, count + 1) != count);
+	return true;
 }
 
 /*
@@ -134,16 +185,16 @@ openfile_incref(struct openfile *file)
 void
 openfile_decref(struct openfile *file)
 {
-	spinlock_acquire(&file->of_reflock);
+	spinlock_data_t count;
+
+	do {
+		count = spinlock_data_get(&file->of_refcount);
+		KASSERT(count > 0);
+	} while (spinlock_data_cmpxchg(&file->of_refcount,
+				       count, count - 1) != count);
 
 	/* if this is the last close of this file, free it up */
-	if (file->of_refcount == 1) {
-		spinlock_release(&file->of_reflock);
+	if (count == 1) {
 		openfile_destroy(file);
 	}
-	else {
-		KASSERT(file->of_refcount > 1);
-		file->of_refcount--;
-		spinlock_release(&file->of_reflock);
-	}
 }
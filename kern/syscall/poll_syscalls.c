@@ -0,0 +1,285 @@
+/*
+ * poll() and select().
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/poll.h>
+#include <kern/select.h>
+#include <kern/time.h>
+#include <limits.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <vnode.h>
+#include <poll.h>
+#include <openfile.h>
+#include <filetable.h>
+#include <syscall.h>
+
+/* Longest timeout, in milliseconds, that fits in an int. */
+#define POLL_MAXMSECS	0x7fffffff
+
+/*
+ * Common code: poll the NFDS files in FDS (in kernel memory), for up
+ * to MSECS milliseconds (forever if negative). Fills in the revents
+ * fields and returns the number of entries with any set.
+ *
+ * The first pass hooks a waiter onto every file; after that we only
+ * rescan when one of them pokes the waiter, or give up when the
+ * timeout does or the process starts exiting (EINTR).
+ */
+static
+int
+poll_kernel(struct pollfd *fds, unsigned nfds, int msecs, int *retval)
+{
+	struct filetable *ft = curproc->p_filetable;
+	struct openfile **files;
+	struct pollwaiter *pw;
+	unsigned i, nready;
+	int revents, result;
+	bool first;
+
+	files = NULL;
+	if (nfds > 0) {
+		files = kmalloc(nfds * sizeof(files[0]));
+		if (files == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	pw = NULL;
+	if (msecs != 0) {
+		pw = pollwaiter_create(nfds, msecs);
+		if (pw == NULL) {
+			kfree(files);
+			return ENOMEM;
+		}
+	}
+
+	for (i=0; i<nfds; i++) {
+		fds[i].revents = 0;
+		files[i] = NULL;
+		if (fds[i].fd < 0) {
+			continue;
+		}
+		if (filetable_get(ft, fds[i].fd, &files[i])) {
+			files[i] = NULL;
+			fds[i].revents = POLLNVAL;
+		}
+	}
+
+	result = 0;
+	first = true;
+	while (1) {
+		nready = 0;
+		for (i=0; i<nfds; i++) {
+			if (files[i] == NULL) {
+				if (fds[i].revents != 0) {
+					nready++;
+				}
+				continue;
+			}
+			revents = VOP_POLL(files[i]->of_vnode, fds[i].events,
+					   first ? pw : NULL);
+			fds[i].revents = revents &
+				(fds[i].events | POLLERR | POLLHUP);
+			if (fds[i].revents != 0) {
+				nready++;
+			}
+		}
+		first = false;
+
+		if (nready > 0 || pw == NULL) {
+			break;
+		}
+		result = pollwaiter_sleep(pw);
+		if (result == ETIMEDOUT) {
+			result = 0;
+			break;
+		}
+		if (result) {
+			break;
+		}
+		pollwaiter_clear(pw);
+	}
+
+	if (pw != NULL) {
+		pollwaiter_destroy(pw);
+	}
+	for (i=0; i<nfds; i++) {
+		if (files[i] != NULL) {
+			filetable_put(ft, fds[i].fd, files[i]);
+		}
+	}
+	kfree(files);
+
+	if (result) {
+		return result;
+	}
+	*retval = nready;
+	return 0;
+}
+
+/*
+ * poll() - wait until one of the files is ready, for up to TIMEOUT
+ * milliseconds (INFTIM, or any negative value, for no limit).
+ */
+int
+sys_poll(userptr_t ufds, unsigned nfds, int timeout, int *retval)
+{
+	struct pollfd *fds;
+	int result;
+
+	if (nfds > OPEN_MAX) {
+		return EINVAL;
+	}
+
+	fds = NULL;
+	if (nfds > 0) {
+		fds = kmalloc(nfds * sizeof(fds[0]));
+		if (fds == NULL) {
+			return ENOMEM;
+		}
+		result = copyin(ufds, fds, nfds * sizeof(fds[0]));
+		if (result) {
+			kfree(fds);
+			return result;
+		}
+	}
+
+	result = poll_kernel(fds, nfds, timeout < 0 ? -1 : timeout, retval);
+	if (result == 0 && nfds > 0) {
+		result = copyout(fds, ufds, nfds * sizeof(fds[0]));
+	}
+	kfree(fds);
+	return result;
+}
+
+/*
+ * select() - poll() with bitmaps. Only the first NFDS bits of each set
+ * are looked at or changed, rounded up to a whole word.
+ */
+int
+sys_select(int nfds, userptr_t ureadfds, userptr_t uwritefds,
+	   userptr_t uexceptfds, userptr_t utimeout, int *retval)
+{
+	userptr_t usets[3] = { ureadfds, uwritefds, uexceptfds };
+	static const short setevents[3] = { POLLIN, POLLOUT, POLLPRI };
+	static const short setrevents[3] = {
+		POLLIN | POLLHUP | POLLERR,
+		POLLOUT | POLLERR,
+		POLLPRI,
+	};
+	fd_set sets[3];
+	struct timeval tv;
+	struct pollfd *fds;
+	size_t setlen;
+	unsigned i, j, n;
+	short events;
+	int msecs, fd, nready, result;
+
+	if (nfds < 0 || nfds > FD_SETSIZE) {
+		return EINVAL;
+	}
+	setlen = DIVROUNDUP(nfds, _NFDBITS) * sizeof(sets[0].fds_bits[0]);
+
+	for (j=0; j<3; j++) {
+		FD_ZERO(&sets[j]);
+		if (usets[j] != NULL) {
+			result = copyin(usets[j], &sets[j], setlen);
+			if (result) {
+				return result;
+			}
+		}
+	}
+
+	msecs = -1;
+	if (utimeout != NULL) {
+		result = copyin(utimeout, &tv, sizeof(tv));
+		if (result) {
+			return result;
+		}
+		if (tv.tv_sec < 0 || tv.tv_usec < 0 || tv.tv_usec >= 1000000) {
+			return EINVAL;
+		}
+		if (tv.tv_sec >= POLL_MAXMSECS / 1000) {
+			msecs = POLL_MAXMSECS;
+		}
+		else {
+			msecs = tv.tv_sec * 1000 + DIVROUNDUP(tv.tv_usec, 1000);
+		}
+	}
+
+	/* One pollfd for each fd that's in any of the sets. */
+	n = 0;
+	for (fd=0; fd<nfds; fd++) {
+		for (j=0; j<3; j++) {
+			if (FD_ISSET(fd, &sets[j])) {
+				n++;
+				break;
+			}
+		}
+	}
+	fds = NULL;
+	if (n > 0) {
+		fds = kmalloc(n * sizeof(fds[0]));
+		if (fds == NULL) {
+			return ENOMEM;
+		}
+	}
+	i = 0;
+	for (fd=0; fd<nfds; fd++) {
+		events = 0;
+		for (j=0; j<3; j++) {
+			if (FD_ISSET(fd, &sets[j])) {
+				events |= setevents[j];
+			}
+		}
+		if (events != 0) {
+			KASSERT(i < n);
+			fds[i].fd = fd;
+			fds[i].events = events;
+			i++;
+		}
+	}
+	KASSERT(i == n);
+
+	result = poll_kernel(fds, n, msecs, &nready);
+	if (result) {
+		kfree(fds);
+		return result;
+	}
+
+	/* Turn the results back into bits; unlike poll, bad fds fail. */
+	nready = 0;
+	for (j=0; j<3; j++) {
+		FD_ZERO(&sets[j]);
+	}
+	for (i=0; i<n; i++) {
+		if (fds[i].revents & POLLNVAL) {
+			kfree(fds);
+			return EBADF;
+		}
+		for (j=0; j<3; j++) {
+			if ((fds[i].events & setevents[j]) &&
+			    (fds[i].revents & setrevents[j])) {
+				FD_SET(fds[i].fd, &sets[j]);
+				nready++;
+			}
+		}
+	}
+	kfree(fds);
+
+	for (j=0; j<3; j++) {
+		if (usets[j] != NULL) {
+			result = copyout(&sets[j], usets[j], setlen);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	*retval = nready;
+	return 0;
+}
@@ -41,6 +41,7 @@
 #include <proc.h>
 #include <current.h>
 #include <copyinout.h>
+#include <addrspace.h>
 #include <pid.h>
 #include <syscall.h>
 
@@ -81,12 +82,13 @@ sys__exit(int status)
 
 static
 void
-fork_newthread(void *vtf, unsigned long junk)
+fork_newthread(void *vtf, unsigned long ustack)
 {
 	struct trapframe mytf;
 	struct trapframe *ntf = vtf;
 
-	(void)junk;
+	/* We're running on the same user stack as our parent was. */
+	curthread->t_ustack = (int)ustack;
 
 	/*
 	 * Now copy the trapframe to our stack, so we can free the one
@@ -127,7 +129,7 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	*retval = newproc->p_pid;
 
 	result = thread_fork(curthread->t_name, newproc,
-			     fork_newthread, ntf, 0);
+			     fork_newthread, ntf, curthread->t_ustack);
 	if (result) {
 		proc_unfork(newproc);
 		kfree(ntf);
@@ -137,6 +139,90 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	return 0;
 }
 
+/*
+ * sys___threadfork
+ *
+ * Create another thread in the current process. It gets its own user
+ * stack and begins by calling ENTRYPOINT(ARG); libc's threadfork()
+ * passes a wrapper that calls threadexit() when the function returns.
+ */
+
+struct threadstart {
+	vaddr_t ts_entry;
+	vaddr_t ts_arg;
+	vaddr_t ts_stack;
+};
+
+static
+void
+threadfork_newthread(void *vts, unsigned long ustack)
+{
+	struct threadstart ts;
+
+	/* Copy to our stack and free, as in fork_newthread. */
+	ts = *(struct threadstart *)vts;
+	kfree(vts);
+
+	curthread->t_ustack = (int)ustack;
+
+	/* Don't start running if the process exited meanwhile. */
+	proc_exitcheck();
+
+	enter_new_thread(ts.ts_entry, ts.ts_arg, ts.ts_stack);
+}
+
+int
+sys___threadfork(userptr_t entrypoint, userptr_t arg, int *retval)
+{
+	struct threadstart *ts;
+	unsigned slot;
+	int result;
+
+	ts = kmalloc(sizeof(*ts));
+	if (ts == NULL) {
+		return ENOMEM;
+	}
+	ts->ts_entry = (vaddr_t)entrypoint;
+	ts->ts_arg = (vaddr_t)arg;
+
+	result = proc_getustack(&slot);
+	if (result) {
+		kfree(ts);
+		return result;
+	}
+
+	result = as_define_threadstack(proc_getas(), slot, &ts->ts_stack);
+	if (result) {
+		proc_putustack(slot);
+		kfree(ts);
+		return result;
+	}
+
+	result = thread_fork(curthread->t_name, NULL,
+			     threadfork_newthread, ts, slot);
+	if (result) {
+		proc_putustack(slot);
+		kfree(ts);
+		return result;
+	}
+
+	*retval = 0;
+	return 0;
+}
+
+/*
+ * sys_threadexit
+ *
+ * Make just this thread go away; the process exits with status 0 if
+ * it was the last one.
+ */
+__DEAD
+void
+sys_threadexit(void)
+{
+	proc_exitthread();
+}
+
 /*
  * sys_waitpid
  * just pass off the work to the pid code.
@@ -157,3 +243,46 @@ sys_waitpid(pid_t pid, userptr_t retstatus, int flags, pid_t *retval)
 	}
 	return result;
 }
+
+/*
+ * sys_waitmany
+ * collect a batch of exited children. Larger requests are cut down
+ * to WAITMANY_MAX; the caller can just come back for the rest.
+ */
+#define WAITMANY_MAX	32
+
+int
+sys_waitmany(userptr_t retpids, userptr_t retstatuses, unsigned max,
+	     int flags, int *retval)
+{
+	pid_t pids[WAITMANY_MAX];
+	int statuses[WAITMANY_MAX];
+	unsigned count;
+	int result;
+
+	if (max > WAITMANY_MAX) {
+		max = WAITMANY_MAX;
+	}
+
+	result = pid_waitmany(pids, statuses, max, flags, &count);
+	if (result) {
+		return result;
+	}
+
+	if (count > 0) {
+		result = copyout(pids, retpids, count * sizeof(pid_t));
+		if (result) {
+			return result;
+		}
+		if (retstatuses != NULL) {
+			result = copyout(statuses, retstatuses,
+					 count * sizeof(int));
+			if (result) {
+				return result;
+			}
+		}
+	}
+
+	*retval = count;
+	return 0;
+}
@@ -28,16 +28,19 @@
  */
 
 /*
- * Code for running a user program from the menu, and code for execv,
- * which have a lot in common.
+ * Code for running a user program from the menu, and code for execv
+ * and spawn, which have a lot in common.
  */
 
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/spawn.h>
 #include <kern/unistd.h>
+#include <kern/wait.h>
 #include <limits.h>
 #include <lib.h>
+#include <mainbus.h>
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
@@ -47,30 +50,56 @@
 #include <vfs.h>
 #include <openfile.h>
 #include <filetable.h>
+#include <pid.h>
 #include <syscall.h>
 #include <test.h>
 
+/*
+ * Space an argv of NARGS strings totalling LEN bytes takes on the new
+ * stack. ARG_MAX bounds this, pointers included.
+ */
+#define ARGV_SPACE(nargs, len)	((len) + ((nargs) + 1) * sizeof(userptr_t))
+
 /*
  * argv buffer.
  *
  * This is an abstraction that holds an argv while it's being shuffled
- * through the kernel during exec.
+ * through the kernel during exec. execv doesn't need it when the VM
+ * can map the new stack (see argv_copydirect below), but runprogram
+ * and spawn do, because their argv isn't in the address space being
+ * replaced.
+ *
+ * The strings are packed end to end, as they will be on the new
+ * stack, in single pages allocated as needed; a string may straddle
+ * two pages. This way a big argv never needs ARG_MAX of contiguous
+ * kernel memory, and a small one costs one page.
  */
+#define ARGBUF_MAXPAGES	(ARG_MAX / PAGE_SIZE)
+
 struct argbuf {
-	char *data;
-	size_t len;
-	size_t max;
+	char *pages[ARGBUF_MAXPAGES];
+	unsigned npages;	/* pages allocated */
+	unsigned reserved;	/* pages of argbuf_free taken */
+	size_t len;		/* bytes of strings */
 	int nargs;
-	bool tooksem;
 };
 
 /*
- * Throttle to limit the number of processes in exec at once. Or,
- * rather, the number trying to use large exec buffers at once. See
- * design notes for the rationale.
+ * Bound on the memory held in argv buffers at once, in pages. This
+ * replaces a throttle that let only one process at a time use more
+ * than a page: any number of execs can now proceed as long as their
+ * argvs fit in the budget, which is a fraction of RAM (but always
+ * enough for one maximal argv).
+ *
+ * Pages are taken from the budget one at a time as the copyin goes.
+ * To avoid deadlock, nobody waits for budget while holding any: an
+ * exec that runs out partway gives back what it has and waits for a
+ * full ARGBUF_MAXPAGES at once, then starts over.
  */
-#define EXEC_BIGBUF_THROTTLE	1
-static struct semaphore *execthrottle;
+#define ARGBUF_RAMFRACTION	8
+static struct lock *argbuf_lock;
+static struct cv *argbuf_cv;
+static unsigned argbuf_free;
 
 /*
  * Set things up.
@@ -78,10 +107,56 @@ static struct semaphore *execthrottle;
 void
 exec_bootstrap(void)
 {
-	execthrottle = sem_create("exec", EXEC_BIGBUF_THROTTLE);
-	if (execthrottle == NULL) {
-		panic("Cannot create exec throttle semaphore\n");
+	argbuf_lock = lock_create("argbuf");
+	if (argbuf_lock == NULL) {
+		panic("Cannot create argbuf lock\n");
+	}
+	argbuf_cv = cv_create("argbuf");
+	if (argbuf_cv == NULL) {
+		panic("Cannot create argbuf cv\n");
+	}
+	argbuf_free = mainbus_ramsize() / PAGE_SIZE / ARGBUF_RAMFRACTION;
+	if (argbuf_free < ARGBUF_MAXPAGES) {
+		argbuf_free = ARGBUF_MAXPAGES;
+	}
+}
+
+/*
+ * Take NUM pages of argv budget. If there isn't enough, wait for it
+ * if WAIT is set and fail otherwise.
+ */
+static
+bool
+argbuf_reserve(unsigned num, bool wait)
+{
+	bool ret;
+
+	lock_acquire(argbuf_lock);
+	while (wait && argbuf_free < num) {
+		cv_wait(argbuf_cv, argbuf_lock);
+	}
+	ret = argbuf_free >= num;
+	if (ret) {
+		argbuf_free -= num;
+	}
+	lock_release(argbuf_lock);
+	return ret;
+}
+
+/*
+ * Give back NUM pages of argv budget.
+ */
+static
+void
+argbuf_unreserve(unsigned num)
+{
+	if (num == 0) {
+		return;
 	}
+	lock_acquire(argbuf_lock);
+	argbuf_free += num;
+	cv_broadcast(argbuf_cv, argbuf_lock);
+	lock_release(argbuf_lock);
 }
 
 /*
@@ -91,11 +166,10 @@ static
 void
 argbuf_init(struct argbuf *buf)
 {
-	buf->data = NULL;
+	buf->npages = 0;
+	buf->reserved = 0;
 	buf->len = 0;
-	buf->max = 0;
 	buf->nargs = 0;
-	buf->tooksem = false;
 }
 
 /*
@@ -105,31 +179,39 @@ static
 void
 argbuf_cleanup(struct argbuf *buf)
 {
-	if (buf->data != NULL) {
-		kfree(buf->data);
-		buf->data = NULL;
-	}
-	buf->len = 0;
-	buf->max = 0;
-	buf->nargs = 0;
-	if (buf->tooksem) {
-		V(execthrottle);
-		buf->tooksem = false;
+	unsigned i;
+
+	for (i=0; i<buf->npages; i++) {
+		kfree(buf->pages[i]);
 	}
+	argbuf_unreserve(buf->reserved);
+	argbuf_init(buf);
 }
 
 /*
- * Allocate the memory for an argv buffer.
+ * Add a page to an argv buffer. Returns EAGAIN if the argv budget ran
+ * out and the caller already holds some of it; see above.
  */
 static
 int
-argbuf_allocate(struct argbuf *buf, size_t size)
+argbuf_addpage(struct argbuf *buf)
 {
-	buf->data = kmalloc(size);
-	if (buf->data == NULL) {
+	char *page;
+
+	if (buf->npages == ARGBUF_MAXPAGES) {
+		return E2BIG;
+	}
+	if (buf->npages == buf->reserved) {
+		if (!argbuf_reserve(1, buf->reserved == 0)) {
+			return EAGAIN;
+		}
+		buf->reserved++;
+	}
+	page = kmalloc(PAGE_SIZE);
+	if (page == NULL) {
 		return ENOMEM;
 	}
-	buf->max = size;
+	buf->pages[buf->npages++] = page;
 	return 0;
 }
 
@@ -147,12 +229,15 @@ argbuf_fromkernel(struct argbuf *buf, const char *progname)
 	int result;
 
 	len = strlen(progname) + 1;
+	if (len > PAGE_SIZE) {
+		return E2BIG;
+	}
 
-	result = argbuf_allocate(buf, len);
+	result = argbuf_addpage(buf);
 	if (result) {
 		return result;
 	}
-	strcpy(buf->data, progname);
+	strcpy(buf->pages[0], progname);
 	buf->len = len;
 	buf->nargs = 1;
 
@@ -167,7 +252,7 @@ int
 argbuf_copyin(struct argbuf *buf, userptr_t uargv)
 {
 	userptr_t thisarg;
-	size_t thisarglen;
+	size_t thisarglen, pageoff, room;
 	int result;
 
 	/* loop through the argv, grabbing each arg string */
@@ -187,20 +272,42 @@ argbuf_copyin(struct argbuf *buf, userptr_t uargv)
 			break;
 		}
 
-		/* Use the pointer to fetch the argument string. */
-		result = copyinstr(thisarg, buf->data + buf->len,
-				   buf->max - buf->len, &thisarglen);
-		if (result == ENAMETOOLONG) {
-			return E2BIG;
-		}
-		else if (result) {
-			return result;
+		/*
+		 * Use the pointer to fetch the argument string, a page
+		 * at a time. When the string doesn't fit in what's left
+		 * of the current page, copyinstr fills it and returns
+		 * ENAMETOOLONG, and the rest goes on the next page.
+		 */
+		while (1) {
+			if (buf->len == buf->npages * PAGE_SIZE) {
+				result = argbuf_addpage(buf);
+				if (result) {
+					return result;
+				}
+			}
+			pageoff = buf->len % PAGE_SIZE;
+			room = PAGE_SIZE - pageoff;
+			result = copyinstr(thisarg,
+					   buf->pages[buf->len / PAGE_SIZE]
+					   + pageoff,
+					   room, &thisarglen);
+			if (result == 0) {
+				break;
+			}
+			if (result != ENAMETOOLONG) {
+				return result;
+			}
+			buf->len += room;
+			thisarg += room;
 		}
 
 		/* Move ahead. Note: thisarglen includes the \0. */
 		buf->len += thisarglen;
 		uargv += sizeof(userptr_t);
 		buf->nargs++;
+		if (ARGV_SPACE(buf->nargs, buf->len) > ARG_MAX) {
+			return E2BIG;
+		}
 	}
 
 	return 0;
@@ -215,53 +322,59 @@ argbuf_fromuser(struct argbuf *buf, userptr_t uargv)
 {
 	int result;
 
-	/* try with a small buffer */
-	result = argbuf_allocate(buf, PAGE_SIZE);
-	if (result) {
-		return result;
-	}
-
-	/* do the copyin */
 	result = argbuf_copyin(buf, uargv);
-	if (result == E2BIG) {
+	if (result == EAGAIN) {
 		/*
-		 * Try again with the full-size buffer. Just start
-		 * over instead of trying to keep the page we already
-		 * did; this is a bit inefficient but it's not that
-		 * important.
+		 * Out of argv budget. (copyin never fails with EAGAIN.)
+		 * Give back what we have, wait until a maximal argv
+		 * fits, and start over.
 		 */
 		argbuf_cleanup(buf);
-		argbuf_init(buf);
-
-		/* Wait on the semaphore, to throttle this allocation */
-		P(execthrottle);
-		buf->tooksem = true;
-
-		result = argbuf_allocate(buf, ARG_MAX);
-		if (result) {
-			return result;
-		}
+		argbuf_reserve(ARGBUF_MAXPAGES, true);
+		buf->reserved = ARGBUF_MAXPAGES;
 
 		result = argbuf_copyin(buf, uargv);
 	}
 	return result;
 }
 
+/*
+ * Find the end of the string at POS in an argv buffer; returns the
+ * offset past its \0.
+ */
+static
+size_t
+argbuf_strend(struct argbuf *buf, size_t pos)
+{
+	const char *page;
+
+	page = buf->pages[pos / PAGE_SIZE];
+	while (page[pos % PAGE_SIZE] != 0) {
+		pos++;
+		if (pos % PAGE_SIZE == 0) {
+			page = buf->pages[pos / PAGE_SIZE];
+		}
+	}
+	return pos + 1;
+}
+
 /*
  * Copy an argv out of kernel space to user space.
  *
  * Note: ustackp is an in/out argument.
  */
+#define ARGBUF_PTRBATCH	64	/* argv pointers per copyout */
+
 static
 int
 argbuf_copyout(struct argbuf *buf, vaddr_t *ustackp,
 	       int *argc_ret, userptr_t *uargv_ret)
 {
+	userptr_t argvchunk[ARGBUF_PTRBATCH];
 	vaddr_t ustack;
 	userptr_t ustringbase, uargvbase, uargv_i;
-	userptr_t thisarg;
-	size_t thisarglen;
-	size_t pos;
+	size_t pos, len;
+	unsigned i, n;
 	int result;
 
 	/* Begin the stack at the passed in top. */
@@ -270,7 +383,7 @@ argbuf_copyout(struct argbuf *buf, vaddr_t *ustackp,
 	/*
 	 * Allocate space.
 	 *
-	 * buf->pos is the amount of space used by the strings; put that
+	 * buf->len is the amount of space used by the strings; put that
 	 * first, then align the stack, then make space for the argv
 	 * pointers. Allow an extra slot for the ending NULL.
 	 */
@@ -282,54 +395,191 @@ argbuf_copyout(struct argbuf *buf, vaddr_t *ustackp,
 	ustack -= (buf->nargs + 1) * sizeof(userptr_t);
 	uargvbase = (userptr_t)ustack;
 
-	/* Now copy the data out. */
+	/* The strings are already laid out; push them a page at a time. */
+	for (i=0; i<buf->npages; i++) {
+		pos = i * PAGE_SIZE;
+		len = buf->len - pos < PAGE_SIZE ? buf->len - pos : PAGE_SIZE;
+		result = copyout(buf->pages[i], ustringbase + pos, len);
+		if (result) {
+			return result;
+		}
+	}
+
+	/* Now the argv array, including the NULL. */
 	pos = 0;
+	n = 0;
 	uargv_i = uargvbase;
-	while (pos < buf->len) {
-		/* The user address of the string will be ustringbase + pos. */
-		thisarg = ustringbase + pos;
+	for (i=0; i<=(unsigned)buf->nargs; i++) {
+		if (i < (unsigned)buf->nargs) {
+			/* The user address of the string is ustringbase + pos. */
+			argvchunk[n++] = ustringbase + pos;
+			pos = argbuf_strend(buf, pos);
+		}
+		else {
+			argvchunk[n++] = NULL;
+		}
+		if (n == ARGBUF_PTRBATCH || i == (unsigned)buf->nargs) {
+			result = copyout(argvchunk, uargv_i,
+					 n * sizeof(userptr_t));
+			if (result) {
+				return result;
+			}
+			uargv_i += n * sizeof(userptr_t);
+			n = 0;
+		}
+	}
+	/* Should have come out even... */
+	KASSERT(pos == buf->len);
 
-		/* Place it in the argv array. */
-		result = copyout(&thisarg, uargv_i, sizeof(thisarg));
+	*ustackp = ustack;
+	*argc_ret = buf->nargs;
+	*uargv_ret = uargvbase;
+	return 0;
+}
+
+/*
+ * Find how many strings an argv in the current address space has and
+ * how many bytes they take, reading them through a small buffer.
+ */
+#define ARGV_SCRATCH	128
+
+static
+int
+argv_measure(userptr_t uargv, int *nargs_ret, size_t *len_ret)
+{
+	char scratch[ARGV_SCRATCH];
+	userptr_t thisarg;
+	size_t len, thisarglen;
+	int nargs;
+	int result;
+
+	nargs = 0;
+	len = 0;
+	while (1) {
+		result = copyin(uargv, &thisarg, sizeof(userptr_t));
 		if (result) {
 			return result;
 		}
+		if (thisarg == NULL) {
+			break;
+		}
 
-		/* Push out the string. */
-		result = copyoutstr(buf->data + pos, thisarg,
-				    buf->len - pos, &thisarglen);
-		if (result) {
-			return result;
+		/* As in argbuf_copyin, ENAMETOOLONG means keep going. */
+		while (1) {
+			result = copyinstr(thisarg, scratch, sizeof(scratch),
+					   &thisarglen);
+			if (result == 0) {
+				break;
+			}
+			if (result != ENAMETOOLONG) {
+				return result;
+			}
+			len += sizeof(scratch);
+			thisarg += sizeof(scratch);
+			if (len > ARG_MAX) {
+				return E2BIG;
+			}
 		}
 
-		/* thisarglen includes the \0 */
-		pos += thisarglen;
-		uargv_i += sizeof(thisarg);
+		len += thisarglen;
+		uargv += sizeof(userptr_t);
+		nargs++;
+		if (ARGV_SPACE(nargs, len) > ARG_MAX) {
+			return E2BIG;
+		}
 	}
-	/* Should have come out even... */
-	KASSERT(pos == buf->len);
 
-	/* Add the NULL. */
-	thisarg = NULL;
-	result = copyout(&thisarg, uargv_i, sizeof(userptr_t));
+	*nargs_ret = nargs;
+	*len_ret = len;
+	return 0;
+}
+
+/*
+ * Copy an argv from the current address space straight onto the
+ * stack of NEWVM, which isn't active, through the kernel pointer the
+ * VM gives us for it. Each string is copied once, to where the new
+ * program will find it, in the same layout argbuf_copyout uses.
+ * Returns ENOSYS if the VM can't map the new stack.
+ *
+ * Note: ustackp is an in/out argument.
+ */
+static
+int
+argv_copydirect(struct addrspace *newvm, userptr_t uargv, vaddr_t *ustackp,
+		int *argc_ret, userptr_t *uargv_ret)
+{
+	vaddr_t ustack;
+	userptr_t ustringbase, uargvbase, thisarg;
+	userptr_t *kargv;
+	char *kstrings;
+	size_t len, pos, thisarglen;
+	int nargs, i;
+	int result;
+
+	result = argv_measure(uargv, &nargs, &len);
 	if (result) {
 		return result;
 	}
 
+	ustack = *ustackp;
+	ustack -= len;
+	ustack -= (ustack & (sizeof(void *) - 1));
+	ustringbase = (userptr_t)ustack;
+
+	ustack -= (nargs + 1) * sizeof(userptr_t);
+	uargvbase = (userptr_t)ustack;
+
+	kargv = as_map_stack(newvm, ustack, *ustackp - ustack);
+	if (kargv == NULL) {
+		return ENOSYS;
+	}
+	kstrings = (char *)kargv + (ustringbase - uargvbase);
+
+	/*
+	 * Copy the strings. The bound keeps us inside what we measured
+	 * even if the argv changed in the meantime.
+	 */
+	pos = 0;
+	for (i=0; i<nargs; i++) {
+		result = copyin(uargv + i * sizeof(userptr_t), &thisarg,
+				sizeof(userptr_t));
+		if (result) {
+			return result;
+		}
+		result = copyinstr(thisarg, kstrings + pos, len - pos,
+				   &thisarglen);
+		if (result) {
+			return result;
+		}
+		kargv[i] = ustringbase + pos;
+		pos += thisarglen;
+	}
+	kargv[nargs] = NULL;
+
 	*ustackp = ustack;
-	*argc_ret = buf->nargs;
+	*argc_ret = nargs;
 	*uargv_ret = uargvbase;
 	return 0;
 }
 
 /*
- * Common code for execv and runprogram: loading the executable.
+ * Common code for execv, runprogram, and spawn: load the executable
+ * and put the argv on its stack.
+ *
+ * The argv comes from KARGV if that's not NULL, and otherwise from
+ * UARGV in the address space being replaced. In that case it's copied
+ * before the old address space goes away, straight onto the new
+ * stack if the VM allows it and through a kernel argbuf if not; so a
+ * bad argv fails the exec with the old image intact.
  */
 static
 int
-loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
+loadexec(char *path, struct argbuf *kargv, userptr_t uargv,
+	 vaddr_t *entrypoint, vaddr_t *stackptr,
+	 int *argc_ret, userptr_t *uargv_ret)
 {
 	struct addrspace *newvm, *oldvm;
+	struct argbuf ubuf;
 	struct vnode *v;
 	char *newname;
 	int result;
@@ -385,6 +635,27 @@ loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
 		return result;
         }
 
+	argbuf_init(&ubuf);
+	if (kargv == NULL) {
+		/* Go back to the old address space to read the argv. */
+		proc_setas(oldvm);
+		as_activate();
+		result = argv_copydirect(newvm, uargv, stackptr,
+					 argc_ret, uargv_ret);
+		if (result == ENOSYS) {
+			result = argbuf_fromuser(&ubuf, uargv);
+			kargv = &ubuf;
+		}
+		if (result) {
+			argbuf_cleanup(&ubuf);
+			as_destroy(newvm);
+			kfree(newname);
+			return result;
+		}
+		proc_setas(newvm);
+		as_activate();
+	}
+
 	/*
 	 * Wipe out old address space.
 	 *
@@ -402,6 +673,16 @@ loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
 	kfree(curthread->t_name);
 	curthread->t_name = newname;
 
+	if (kargv != NULL) {
+		result = argbuf_copyout(kargv, stackptr, argc_ret, uargv_ret);
+		if (result) {
+			/* If copyout fails, *we* messed up, so panic */
+			panic("loadexec: argbuf_copyout failed: %s\n",
+			      strerror(result));
+		}
+	}
+	argbuf_cleanup(&ubuf);
+
 	return 0;
 }
 
@@ -431,7 +712,11 @@ placed_open(const char *path, int openflags, int fd)
 	}
 
 	/* place the file in the filetable in the right slot */
-	filetable_placeat(curproc->p_filetable, newfile, fd, &oldfile);
+	result = filetable_placeat(curproc->p_filetable, newfile, fd, &oldfile);
+	if (result) {
+		openfile_decref(newfile);
+		return result;
+	}
 
 	/* the table should previously have been empty */
 	KASSERT(oldfile == NULL);
@@ -519,18 +804,13 @@ runprogram(char *progname)
 	}
 
 	/* Load the executable. Note: must not fail after this succeeds. */
-	result = loadexec(progname, &entrypoint, &stackptr);
+	result = loadexec(progname, &kargv, NULL, &entrypoint, &stackptr,
+			  &argc, &uargv);
 	if (result) {
 		argbuf_cleanup(&kargv);
 		return result;
 	}
 
-	result = argbuf_copyout(&kargv, &stackptr, &argc, &uargv);
-	if (result) {
-		/* If copyout fails, *we* messed up, so panic */
-		panic("execv: copyout_args failed: %s\n", strerror(result));
-	}
-
 	/* free the space */
 	argbuf_cleanup(&kargv);
 
@@ -546,20 +826,27 @@ runprogram(char *progname)
  * execv.
  *
  * 1. Copy in the program name.
- * 2. Copy in the argv with copyin_args.
- * 3. Load the executable.
- * 4. Copy the argv out again with copyout_args.
- * 5. Warp to usermode.
+ * 2. Load the executable, and copy the argv from the old address
+ *    space onto the new stack before getting rid of the old one.
+ * 3. Warp to usermode.
  */
 int
 sys_execv(userptr_t prog, userptr_t uargv)
 {
 	char *path;
-	struct argbuf kargv;
 	vaddr_t entrypoint, stackptr;
 	int argc;
+	userptr_t newargv;
 	int result;
 
+	/*
+	 * The other threads would be left running in the old address
+	 * space after we destroy it.
+	 */
+	if (proc_nthreads(curproc) > 1) {
+		return EBUSY;
+	}
+
 	path = kmalloc(PATH_MAX);
 	if (!path) {
 		return ENOMEM;
@@ -572,21 +859,10 @@ sys_execv(userptr_t prog, userptr_t uargv)
 		return result;
 	}
 
-	/* get the argv strings. */
-
-	argbuf_init(&kargv);
-
-	result = argbuf_fromuser(&kargv, uargv);
-	if (result) {
-		argbuf_cleanup(&kargv);
-		kfree(path);
-		return result;
-	}
-
 	/* Load the executable. Note: must not fail after this succeeds. */
-	result = loadexec(path, &entrypoint, &stackptr);
+	result = loadexec(path, NULL, uargv, &entrypoint, &stackptr,
+			  &argc, &newargv);
 	if (result) {
-		argbuf_cleanup(&kargv);
 		kfree(path);
 		return result;
 	}
@@ -594,20 +870,219 @@ sys_execv(userptr_t prog, userptr_t uargv)
 	/* don't need this any more */
 	kfree(path);
 
-	/* Send the argv strings to the process. */
-	result = argbuf_copyout(&kargv, &stackptr, &argc, &uargv);
-	if (result) {
-		/* if copyout fails, *we* messed up, so panic */
-		panic("execv: copyout_args failed: %s\n", strerror(result));
+	/* The new image runs on the main stack. */
+	if (curthread->t_ustack >= 0) {
+		proc_putustack(curthread->t_ustack);
+		curthread->t_ustack = -1;
 	}
 
-	/* free the argv buffer space */
-	argbuf_cleanup(&kargv);
+	/* Warp to user mode. */
+	enter_new_process(argc, newargv, NULL /*uenv*/, stackptr, entrypoint);
+
+	/* enter_new_process does not return. */
+	panic("enter_new_process returned\n");
+	return EINVAL;
+}
+
+/*
+ * spawn.
+ *
+ * This is fork plus execv without copying the parent's address space
+ * only to throw it away. We set up the new process (file table,
+ * argv, file actions) here; its first thread loads the program and
+ * tells us how that went, so a bad path or executable fails the
+ * spawn call itself just like it would fail execv.
+ */
+
+/*
+ * State shared between sys_spawn and the new process's first thread.
+ */
+struct spawnstate {
+	char *path;
+	struct argbuf kargv;
+	struct semaphore *done;
+	int result;
+};
+
+/*
+ * Apply spawn file actions to the new process's file table.
+ */
+static
+int
+spawn_fileactions(struct filetable *ft, const struct spawn_action *actions,
+		  unsigned nactions)
+{
+	struct openfile *file, *oldfile;
+	unsigned i;
+	int result;
+
+	for (i=0; i<nactions; i++) {
+		if (ft == NULL) {
+			/* no file table at all (kernel caller) */
+			return EBADF;
+		}
+		switch (actions[i].sa_op) {
+		    case SPAWN_DUP2:
+			if (!filetable_okfd(ft, actions[i].sa_newfd)) {
+				return EBADF;
+			}
+			result = filetable_get(ft, actions[i].sa_fd, &file);
+			if (result) {
+				return result;
+			}
+			openfile_incref(file);
+			filetable_put(ft, actions[i].sa_fd, file);
+
+			result = filetable_placeat(ft, file,
+						   actions[i].sa_newfd,
+						   &oldfile);
+			if (result) {
+				openfile_decref(file);
+				return result;
+			}
+			if (oldfile != NULL) {
+				openfile_decref(oldfile);
+			}
+			break;
+		    case SPAWN_CLOSE:
+			if (!filetable_okfd(ft, actions[i].sa_fd)) {
+				return EBADF;
+			}
+			(void)filetable_placeat(ft, NULL, actions[i].sa_fd,
+						&oldfile);
+			if (oldfile == NULL) {
+				return EBADF;
+			}
+			openfile_decref(oldfile);
+			break;
+		    default:
+			return EINVAL;
+		}
+	}
+	return 0;
+}
+
+/*
+ * First thread of a spawned process: load the program and go.
+ */
+static
+void
+spawn_newthread(void *vss, unsigned long junk)
+{
+	struct spawnstate *ss = vss;
+	vaddr_t entrypoint, stackptr;
+	int argc;
+	userptr_t uargv;
+	int result;
+
+	(void)junk;
+
+	result = loadexec(ss->path, &ss->kargv, NULL, &entrypoint, &stackptr,
+			  &argc, &uargv);
+
+	/* Report back. After this ss belongs to the parent again. */
+	ss->result = result;
+	V(ss->done);
+
+	if (result) {
+		/* Nothing to run; the parent will collect us. */
+		proc_exit(_MKWAIT_EXIT(255));
+	}
 
 	/* Warp to user mode. */
 	enter_new_process(argc, uargv, NULL /*uenv*/, stackptr, entrypoint);
 
 	/* enter_new_process does not return. */
 	panic("enter_new_process returned\n");
-	return EINVAL;
+}
+
+int
+sys_spawn(userptr_t prog, userptr_t uargv, userptr_t uactions,
+	  unsigned nactions, pid_t *retval)
+{
+	struct spawn_action actions[SPAWN_ACTIONS_MAX];
+	struct spawnstate ss;
+	struct proc *newproc;
+	pid_t pid;
+	int result;
+
+	if (nactions > SPAWN_ACTIONS_MAX) {
+		return EINVAL;
+	}
+	if (nactions > 0) {
+		result = copyin(uactions, actions,
+				nactions * sizeof(actions[0]));
+		if (result) {
+			return result;
+		}
+	}
+
+	ss.path = kmalloc(PATH_MAX);
+	if (ss.path == NULL) {
+		return ENOMEM;
+	}
+
+	/* Get the filename. */
+	result = copyinstr(prog, ss.path, PATH_MAX, NULL);
+	if (result) {
+		kfree(ss.path);
+		return result;
+	}
+
+	/* get the argv strings. */
+	argbuf_init(&ss.kargv);
+	result = argbuf_fromuser(&ss.kargv, uargv);
+	if (result) {
+		argbuf_cleanup(&ss.kargv);
+		kfree(ss.path);
+		return result;
+	}
+
+	ss.done = sem_create("spawn", 0);
+	if (ss.done == NULL) {
+		argbuf_cleanup(&ss.kargv);
+		kfree(ss.path);
+		return ENOMEM;
+	}
+
+	/* Name the process now; loadexec may mangle the path. */
+	result = proc_spawn(ss.path, &newproc);
+	if (result) {
+		goto fail;
+	}
+
+	result = spawn_fileactions(newproc->p_filetable, actions, nactions);
+	if (result) {
+		proc_unfork(newproc);
+		goto fail;
+	}
+
+	pid = newproc->p_pid;
+	result = thread_fork(curthread->t_name, newproc,
+			     spawn_newthread, &ss, 0);
+	if (result) {
+		proc_unfork(newproc);
+		goto fail;
+	}
+
+	/* Wait for the new process to load the program. */
+	P(ss.done);
+	result = ss.result;
+	if (result) {
+		/* It has exited (or is about to); collect it. */
+		pid_wait(pid, NULL, 0, NULL);
+		goto fail;
+	}
+
+	sem_destroy(ss.done);
+	argbuf_cleanup(&ss.kargv);
+	kfree(ss.path);
+	*retval = pid;
+	return 0;
+
+ fail:
+	sem_destroy(ss.done);
+	argbuf_cleanup(&ss.kargv);
+	kfree(ss.path);
+	return result;
 }
@@ -0,0 +1,416 @@
+/*
+ * System call statistics and tracing. See syscallstat.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/syscall.h>
+#include <lib.h>
+#include <clock.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <proc.h>
+#include <current.h>
+#include <syscallstat.h>
+#include <platform/maxcpus.h>
+
+/* Call numbers we count separately; anything higher goes in one slot. */
+#define SYSCALLSTAT_NCALLS	256
+
+/*
+ * Histogram buckets. Bucket 0 is under a microsecond; bucket B is
+ * from 2^(B-1) up to 2^B microseconds; the last one is everything
+ * from there up (about 4 seconds).
+ */
+#define SYSCALLSTAT_NBUCKETS	24
+
+/* Entries in a process's trace; a power of two. */
+#define SYSCALLTRACE_SIZE	64
+
+struct syscallstat {
+	uint64_t ss_calls;
+	uint64_t ss_errors;
+	uint64_t ss_totalns;
+	uint64_t ss_maxns;
+	uint32_t ss_hist[SYSCALLSTAT_NBUCKETS];
+};
+
+struct syscalltrace_entry {
+	int te_callno;
+	int te_err;
+	int32_t te_retval;
+	uint32_t te_usecs;
+};
+
+struct syscalltrace {
+	struct spinlock st_lock;
+	unsigned st_count;		/* calls recorded, ever */
+	struct syscalltrace_entry st_ring[SYSCALLTRACE_SIZE];
+};
+
+/*
+ * One table of SYSCALLSTAT_NCALLS+1 entries for each cpu. These are
+ * too big to have MAXCPUS of statically, so they're allocated for
+ * the cpus that exist; until then nothing is recorded.
+ */
+static struct syscallstat *syscallstat_tables[MAXCPUS];
+
+/* Names for the report. */
+static const char *const syscallstat_names[SYSCALLSTAT_NCALLS] = {
+	[SYS_fork] = "fork",
+	[SYS_vfork] = "vfork",
+	[SYS_execv] = "execv",
+	[SYS__exit] = "_exit",
+	[SYS_waitpid] = "waitpid",
+	[SYS_getpid] = "getpid",
+	[SYS_getppid] = "getppid",
+	[SYS_sbrk] = "sbrk",
+	[SYS_mmap] = "mmap",
+	[SYS_munmap] = "munmap",
+	[SYS_mprotect] = "mprotect",
+	[SYS_umask] = "umask",
+	[SYS_issetugid] = "issetugid",
+	[SYS_getresuid] = "getresuid",
+	[SYS_setresuid] = "setresuid",
+	[SYS_getresgid] = "getresgid",
+	[SYS_setresgid] = "setresgid",
+	[SYS_getgroups] = "getgroups",
+	[SYS_setgroups] = "setgroups",
+	[SYS___getlogin] = "__getlogin",
+	[SYS___setlogin] = "__setlogin",
+	[SYS_kill] = "kill",
+	[SYS_sigaction] = "sigaction",
+	[SYS_sigpending] = "sigpending",
+	[SYS_sigprocmask] = "sigprocmask",
+	[SYS_sigsuspend] = "sigsuspend",
+	[SYS_sigreturn] = "sigreturn",
+	[SYS_open] = "open",
+	[SYS_pipe] = "pipe",
+	[SYS_dup] = "dup",
+	[SYS_dup2] = "dup2",
+	[SYS_close] = "close",
+	[SYS_read] = "read",
+	[SYS_pread] = "pread",
+	[SYS_readv] = "readv",
+	[SYS_preadv] = "preadv",
+	[SYS_getdirentry] = "getdirentry",
+	[SYS_write] = "write",
+	[SYS_pwrite] = "pwrite",
+	[SYS_writev] = "writev",
+	[SYS_pwritev] = "pwritev",
+	[SYS_lseek] = "lseek",
+	[SYS_flock] = "flock",
+	[SYS_ftruncate] = "ftruncate",
+	[SYS_fsync] = "fsync",
+	[SYS_fcntl] = "fcntl",
+	[SYS_ioctl] = "ioctl",
+	[SYS_select] = "select",
+	[SYS_poll] = "poll",
+	[SYS_link] = "link",
+	[SYS_remove] = "remove",
+	[SYS_mkdir] = "mkdir",
+	[SYS_rmdir] = "rmdir",
+	[SYS_mkfifo] = "mkfifo",
+	[SYS_rename] = "rename",
+	[SYS_access] = "access",
+	[SYS_chdir] = "chdir",
+	[SYS_fchdir] = "fchdir",
+	[SYS___getcwd] = "__getcwd",
+	[SYS_symlink] = "symlink",
+	[SYS_readlink] = "readlink",
+	[SYS_mount] = "mount",
+	[SYS_unmount] = "unmount",
+	[SYS_stat] = "stat",
+	[SYS_fstat] = "fstat",
+	[SYS_lstat] = "lstat",
+	[SYS_utimes] = "utimes",
+	[SYS_futimes] = "futimes",
+	[SYS_lutimes] = "lutimes",
+	[SYS_chmod] = "chmod",
+	[SYS_chown] = "chown",
+	[SYS_fchmod] = "fchmod",
+	[SYS_fchown] = "fchown",
+	[SYS_lchmod] = "lchmod",
+	[SYS_lchown] = "lchown",
+	[SYS_socket] = "socket",
+	[SYS_bind] = "bind",
+	[SYS_connect] = "connect",
+	[SYS_listen] = "listen",
+	[SYS_accept] = "accept",
+	[SYS_shutdown] = "shutdown",
+	[SYS_getsockname] = "getsockname",
+	[SYS_getpeername] = "getpeername",
+	[SYS_getsockopt] = "getsockopt",
+	[SYS_setsockopt] = "setsockopt",
+	[SYS___time] = "__time",
+	[SYS___settime] = "__settime",
+	[SYS_nanosleep] = "nanosleep",
+	[SYS_sync] = "sync",
+	[SYS_reboot] = "reboot",
+	[SYS___threadfork] = "__threadfork",
+	[SYS_threadexit] = "threadexit",
+	[SYS_futex] = "futex",
+	[SYS_semop] = "semop",
+	[SYS_waitmany] = "waitmany",
+	[SYS_spawn] = "spawn",
+	[SYS_copy_file_range] = "copy_file_range",
+	[SYS_uring_enter] = "uring_enter",
+};
+
+/*
+ * Get a name for call CALLNO, made in BUF if we don't have one.
+ */
+static
+const char *
+syscallstat_name(int callno, char *buf, size_t len)
+{
+	if (callno >= SYSCALLSTAT_NCALLS) {
+		return "(other)";
+	}
+	if (syscallstat_names[callno] != NULL) {
+		return syscallstat_names[callno];
+	}
+	snprintf(buf, len, "#%d", callno);
+	return buf;
+}
+
+static
+unsigned
+syscallstat_bucket(uint32_t usecs)
+{
+	unsigned b;
+
+	for (b=0; usecs > 0 && b < SYSCALLSTAT_NBUCKETS-1; b++) {
+		usecs >>= 1;
+	}
+	return b;
+}
+
+void
+syscallstat_bootstrap(void)
+{
+	struct cpu *c;
+	unsigned i;
+
+	for (i=0; (c = cpu_get(i)) != NULL; i++) {
+		KASSERT(c->c_number < MAXCPUS);
+		syscallstat_tables[c->c_number] =
+			kmalloc((SYSCALLSTAT_NCALLS + 1) *
+				sizeof(struct syscallstat));
+		if (syscallstat_tables[c->c_number] == NULL) {
+			panic("syscallstat_bootstrap: Out of memory\n");
+		}
+		bzero(syscallstat_tables[c->c_number],
+		      (SYSCALLSTAT_NCALLS + 1) * sizeof(struct syscallstat));
+	}
+}
+
+static
+void
+syscalltrace_record(struct syscalltrace *st, int callno, int err,
+		    int32_t retval, uint32_t usecs)
+{
+	struct syscalltrace_entry *te;
+
+	spinlock_acquire(&st->st_lock);
+	te = &st->st_ring[st->st_count & (SYSCALLTRACE_SIZE - 1)];
+	te->te_callno = callno;
+	te->te_err = err;
+	te->te_retval = retval;
+	te->te_usecs = usecs;
+	st->st_count++;
+	spinlock_release(&st->st_lock);
+}
+
+void
+syscallstat_record(int callno, int err, int32_t retval,
+		   const struct timespec *start)
+{
+	struct timespec now, diff;
+	struct syscallstat *table, *ss;
+	struct syscalltrace *st;
+	uint64_t ns;
+	uint32_t usecs;
+	int spl;
+
+	gettime(&now);
+	timespec_sub(&now, start, &diff);
+	ns = (uint64_t)diff.tv_sec * 1000000000 + diff.tv_nsec;
+	usecs = diff.tv_sec >= 4000 ? 0xffffffff :
+		diff.tv_sec * 1000000 + diff.tv_nsec / 1000;
+
+	if (callno < 0 || callno >= SYSCALLSTAT_NCALLS) {
+		callno = SYSCALLSTAT_NCALLS;
+	}
+
+	/* Stay on this cpu while touching its table. */
+	spl = splhigh();
+	table = syscallstat_tables[curcpu->c_number];
+	if (table != NULL) {
+		ss = &table[callno];
+		ss->ss_calls++;
+		if (err) {
+			ss->ss_errors++;
+		}
+		ss->ss_totalns += ns;
+		if (ns > ss->ss_maxns) {
+			ss->ss_maxns = ns;
+		}
+		ss->ss_hist[syscallstat_bucket(usecs)]++;
+	}
+	splx(spl);
+
+	st = curproc->p_syscalltrace;
+	if (st != NULL) {
+		syscalltrace_record(st, callno, err, retval, usecs);
+	}
+}
+
+/*
+ * Print the histogram of SS, six buckets to a line, leaving out the
+ * empty ones.
+ */
+static
+void
+syscallstat_printhist(const struct syscallstat *ss)
+{
+	unsigned b, n;
+
+	n = 0;
+	for (b=0; b<SYSCALLSTAT_NBUCKETS; b++) {
+		if (ss->ss_hist[b] == 0) {
+			continue;
+		}
+		if (n % 6 == 0) {
+			kprintf("%s    ", n > 0 ? "\n" : "");
+		}
+		if (b == 0) {
+			kprintf(" %7s:%-6u", "<1", ss->ss_hist[b]);
+		}
+		else {
+			kprintf(" %6u+:%-6u", 1U << (b - 1), ss->ss_hist[b]);
+		}
+		n++;
+	}
+	kprintf("\n");
+}
+
+void
+syscallstat_report(void)
+{
+	static struct syscallstat sum;
+	struct syscallstat *ss;
+	char buf[16];
+	unsigned i, b;
+	int callno;
+
+	kprintf("%-16s %10s %8s %10s %10s\n", "call", "calls", "errors",
+		"avg (us)", "max (us)");
+	for (callno=0; callno<=SYSCALLSTAT_NCALLS; callno++) {
+		/* Add up the per-cpu counters, zeroing them as we go. */
+		bzero(&sum, sizeof(sum));
+		for (i=0; i<MAXCPUS; i++) {
+			if (syscallstat_tables[i] == NULL) {
+				continue;
+			}
+			ss = &syscallstat_tables[i][callno];
+			sum.ss_calls += ss->ss_calls;
+			sum.ss_errors += ss->ss_errors;
+			sum.ss_totalns += ss->ss_totalns;
+			if (ss->ss_maxns > sum.ss_maxns) {
+				sum.ss_maxns = ss->ss_maxns;
+			}
+			for (b=0; b<SYSCALLSTAT_NBUCKETS; b++) {
+				sum.ss_hist[b] += ss->ss_hist[b];
+			}
+			bzero(ss, sizeof(*ss));
+		}
+		if (sum.ss_calls == 0) {
+			continue;
+		}
+
+		kprintf("%-16s %10llu %8llu %10llu %10llu\n",
+			syscallstat_name(callno, buf, sizeof(buf)),
+			(unsigned long long)sum.ss_calls,
+			(unsigned long long)sum.ss_errors,
+			(unsigned long long)(sum.ss_totalns / sum.ss_calls
+					     / 1000),
+			(unsigned long long)(sum.ss_maxns / 1000));
+		syscallstat_printhist(&sum);
+	}
+	kprintf("(histograms: calls by time, in buckets from N to 2N us)\n");
+	kprintf("Counters reset.\n");
+}
+
+////////////////////////////////////////////////////////////
+// tracing
+
+int
+syscalltrace_start(struct proc *proc)
+{
+	struct syscalltrace *st;
+
+	KASSERT(proc->p_syscalltrace == NULL);
+
+	st = kmalloc(sizeof(*st));
+	if (st == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&st->st_lock);
+	st->st_count = 0;
+	proc->p_syscalltrace = st;
+	return 0;
+}
+
+int
+syscalltrace_fork(struct proc *parent, struct proc *child)
+{
+	if (parent->p_syscalltrace == NULL) {
+		return 0;
+	}
+	return syscalltrace_start(child);
+}
+
+void
+syscalltrace_finish(struct proc *proc)
+{
+	struct syscalltrace *st = proc->p_syscalltrace;
+	struct syscalltrace_entry *te;
+	char buf[16];
+	unsigned i, first;
+
+	if (st == NULL) {
+		return;
+	}
+	proc->p_syscalltrace = NULL;
+	if (st->st_count == 0) {
+		/* nothing ran, e.g. fork failed */
+		goto done;
+	}
+
+	/* The process is on its way out, so nothing else can record. */
+	first = st->st_count > SYSCALLTRACE_SIZE ?
+		st->st_count - SYSCALLTRACE_SIZE : 0;
+	kprintf("Syscall trace of pid %d (%s): %u calls", proc->p_pid,
+		proc->p_name, st->st_count);
+	if (first > 0) {
+		kprintf(", last %u shown", SYSCALLTRACE_SIZE);
+	}
+	kprintf("\n");
+	for (i=first; i<st->st_count; i++) {
+		te = &st->st_ring[i & (SYSCALLTRACE_SIZE - 1)];
+		kprintf("  %-16s ",
+			syscallstat_name(te->te_callno, buf, sizeof(buf)));
+		if (te->te_err) {
+			kprintf("= -1 %-24s", strerror(te->te_err));
+		}
+		else {
+			kprintf("= %-27d", (int)te->te_retval);
+		}
+		kprintf(" %10u us\n", te->te_usecs);
+	}
+
+done:
+	spinlock_cleanup(&st->st_lock);
+	kfree(st);
+}
@@ -0,0 +1,215 @@
+/*
+ * uring_enter(): batched I/O through rings in user memory.
+ *
+ * The rings live in the calling program's own memory; there's no
+ * setup call and nothing kept in the kernel between calls. Each call
+ * reads the ring header, runs what's queued by calling the ordinary
+ * syscall functions, and writes back the completions and the new
+ * counters, so one trap does the work of a batch. Entries are copied
+ * in and completions copied out URING_BATCH at a time rather than one
+ * by one.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/uring.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+/*
+ * Entries moved across the user/kernel boundary per copy. The buffers
+ * are on the stack, which is small, and the calls run below them.
+ */
+#define URING_BATCH	8
+
+/* User address of field F of the header at U, given a kernel copy K. */
+#define URING_UFIELD(u, k, f) ((u) + ((char *)&(k)->f - (char *)(k)))
+
+/*
+ * Copy COUNT entries of SIZE bytes between KBUF and the queue at BASE
+ * with NENTRIES entries, starting from counter value IDX and wrapping
+ * around the end of the queue as needed.
+ */
+static
+int
+uring_copy(userptr_t base, unsigned nentries, size_t size, uint32_t idx,
+	   void *kbuf, unsigned count, bool out)
+{
+	unsigned first, n;
+	userptr_t uaddr;
+	char *kaddr = kbuf;
+	int result;
+
+	while (count > 0) {
+		first = idx & (nentries - 1);
+		n = nentries - first;
+		if (n > count) {
+			n = count;
+		}
+		uaddr = base + first * size;
+		if (out) {
+			result = copyout(kaddr, uaddr, n * size);
+		}
+		else {
+			result = copyin(uaddr, kaddr, n * size);
+		}
+		if (result) {
+			return result;
+		}
+		idx += n;
+		kaddr += n * size;
+		count -= n;
+	}
+	return 0;
+}
+
+/*
+ * Run one submission entry; returns the call's result, or -errno.
+ */
+static
+int64_t
+uring_run(const struct uring_sqe *sqe)
+{
+	int ret;
+	off_t pos;
+	int result;
+
+	ret = 0;
+	switch (sqe->sqe_op) {
+	    case URING_OP_NOP:
+		result = 0;
+		break;
+	    case URING_OP_READ:
+		result = sys_read(sqe->sqe_fd, sqe->sqe_buf, sqe->sqe_len,
+				  &ret);
+		break;
+	    case URING_OP_WRITE:
+		result = sys_write(sqe->sqe_fd, sqe->sqe_buf, sqe->sqe_len,
+				   &ret);
+		break;
+	    case URING_OP_PREAD:
+		result = sys_pread(sqe->sqe_fd, sqe->sqe_buf, sqe->sqe_len,
+				   sqe->sqe_off, &ret);
+		break;
+	    case URING_OP_PWRITE:
+		result = sys_pwrite(sqe->sqe_fd, sqe->sqe_buf, sqe->sqe_len,
+				    sqe->sqe_off, &ret);
+		break;
+	    case URING_OP_LSEEK:
+		result = sys_lseek(sqe->sqe_fd, sqe->sqe_off, sqe->sqe_flags,
+				   &pos);
+		if (result == 0) {
+			return pos;
+		}
+		break;
+	    case URING_OP_OPEN:
+		result = sys_open(sqe->sqe_buf, sqe->sqe_flags, sqe->sqe_mode,
+				  &ret);
+		break;
+	    case URING_OP_CLOSE:
+		result = sys_close(sqe->sqe_fd);
+		break;
+	    default:
+		result = EINVAL;
+		break;
+	}
+	return result ? -(int64_t)result : ret;
+}
+
+/*
+ * uring_enter() - run up to TO_SUBMIT queued entries of the ring at
+ * URING. Returns the number run; that's less than asked for if fewer
+ * were queued or the completion queue filled up.
+ *
+ * If something goes wrong partway, the counters still cover the
+ * entries that were run, and those are reported instead of the error.
+ */
+int
+sys_uring_enter(userptr_t uring, unsigned to_submit, int *retval)
+{
+	struct uring hdr;
+	struct uring_sqe sqes[URING_BATCH];
+	struct uring_cqe cqes[URING_BATCH];
+	userptr_t usq, ucq;
+	unsigned nsq, ncq, queued, room, todo, n, i, done;
+	int result, result2;
+
+	result = copyin(uring, &hdr, sizeof(hdr));
+	if (result) {
+		return result;
+	}
+	nsq = hdr.u_sqmask + 1;
+	ncq = hdr.u_cqmask + 1;
+	if (nsq == 0 || nsq > URING_MAXENTRIES || (nsq & hdr.u_sqmask) ||
+	    ncq == 0 || ncq > URING_MAXENTRIES || (ncq & hdr.u_cqmask)) {
+		return EINVAL;
+	}
+	queued = hdr.u_sqtail - hdr.u_sqhead;
+	room = ncq - (hdr.u_cqtail - hdr.u_cqhead);
+	if (queued > nsq || room > ncq) {
+		/* the counters are garbage */
+		return EINVAL;
+	}
+
+	todo = to_submit;
+	if (todo > queued) {
+		todo = queued;
+	}
+	if (todo > room) {
+		if (room == 0) {
+			return EBUSY;
+		}
+		todo = room;
+	}
+
+	usq = uring + sizeof(struct uring);
+	ucq = usq + nsq * sizeof(struct uring_sqe);
+
+	done = 0;
+	result = 0;
+	while (done < todo) {
+		n = todo - done;
+		if (n > URING_BATCH) {
+			n = URING_BATCH;
+		}
+		result = uring_copy(usq, nsq, sizeof(sqes[0]), hdr.u_sqhead,
+				    sqes, n, false);
+		if (result) {
+			break;
+		}
+		for (i=0; i<n; i++) {
+			cqes[i].cqe_data = sqes[i].sqe_data;
+			cqes[i].cqe_res = uring_run(&sqes[i]);
+		}
+		result = uring_copy(ucq, ncq, sizeof(cqes[0]), hdr.u_cqtail,
+				    cqes, n, true);
+		/* These ran, even if their completions didn't make it. */
+		hdr.u_sqhead += n;
+		hdr.u_cqtail += n;
+		done += n;
+		if (result) {
+			break;
+		}
+	}
+
+	/*
+	 * Write back only the counters the kernel owns; the program may
+	 * be changing the others.
+	 */
+	result2 = copyout(&hdr.u_sqhead, URING_UFIELD(uring, &hdr, u_sqhead),
+			  sizeof(hdr.u_sqhead));
+	if (result2 == 0) {
+		result2 = copyout(&hdr.u_cqtail,
+				  URING_UFIELD(uring, &hdr, u_cqtail),
+				  sizeof(hdr.u_cqtail));
+	}
+	if (result2) {
+		return result2;
+	}
+	if (result && done == 0) {
+		return result;
+	}
+	*retval = done;
+	return 0;
+}
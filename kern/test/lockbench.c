@@ -0,0 +1,323 @@
+/*
+ * Lock contention benchmarks.
+ *
+ * These hammer on some of the kernel's hot sleep locks from many
+ * threads at once and report how long it took, so changes to the
+ * locking primitives can be compared on real workloads.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <vfs.h>
+#include <pid.h>
+#include <test.h>
+
+#define NBENCHTHREADS	16
+#define NBENCHLOOPS	500
+#define NBENCHWORK	20
+
+static struct semaphore *benchdonesem;
+static volatile unsigned long benchcounter;
+static volatile unsigned long benchfailures;
+
+static
+void
+initbench(void)
+{
+	if (benchdonesem == NULL) {
+		benchdonesem = sem_create("lockbench", 0);
+		if (benchdonesem == NULL) {
+			panic("lockbench: sem_create failed\n");
+		}
+	}
+	benchcounter = 0;
+	benchfailures = 0;
+}
+
+/*
+ * Fork NBENCHTHREADS copies of FUNC, wait for them all, and print
+ * the elapsed time and the average time per critical section.
+ */
+static
+void
+runbench(const char *name, void (*func)(void *, unsigned long))
+{
+	struct timespec before, after, duration;
+	uint64_t nsecs, ops;
+	int i, result;
+
+	initbench();
+	kprintf("Starting %s benchmark: %d threads, %d loops each...\n",
+		name, NBENCHTHREADS, NBENCHLOOPS);
+
+	gettime(&before);
+	for (i=0; i<NBENCHTHREADS; i++) {
+		result = thread_fork(name, NULL, func, NULL, i);
+		if (result) {
+			panic("lockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NBENCHTHREADS; i++) {
+		P(benchdonesem);
+	}
+	gettime(&after);
+
+	timespec_sub(&after, &before, &duration);
+	nsecs = (uint64_t)duration.tv_sec * 1000000000 + duration.tv_nsec;
+	ops = (uint64_t)NBENCHTHREADS * NBENCHLOOPS;
+
+	if (benchfailures > 0) {
+		kprintf("%s: %lu operations failed\n", name, benchfailures);
+	}
+	kprintf("%s: %llu ops in %llu.%09lu seconds (%llu ns/op)\n",
+		name, (unsigned long long)ops,
+		(unsigned long long)duration.tv_sec,
+		(unsigned long)duration.tv_nsec,
+		(unsigned long long)(nsecs / ops));
+}
+
+/*
+ * Short critical sections under vfs_biglock.
+ */
+static
+void
+biglockthread(void *junk, unsigned long num)
+{
+	int i, j;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<NBENCHLOOPS; i++) {
+		vfs_biglock_acquire();
+		for (j=0; j<NBENCHWORK; j++) {
+			benchcounter++;
+		}
+		vfs_biglock_release();
+	}
+	V(benchdonesem);
+}
+
+/*
+ * Allocate and free pids. All the threads here are children of the
+ * kernel process, so they share its pidinfo lock as well as the pid
+ * table lock.
+ */
+static
+void
+pidallocthread(void *junk, unsigned long num)
+{
+	pid_t pid;
+	int i, result;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<NBENCHLOOPS; i++) {
+		result = pid_alloc(&pid);
+		if (result) {
+			benchfailures++;
+			continue;
+		}
+		pid_unalloc(pid);
+	}
+	V(benchdonesem);
+}
+
+int
+lockbench1(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	runbench("vfs_biglock", biglockthread);
+	if (benchcounter != (unsigned long)NBENCHTHREADS *
+	    NBENCHLOOPS * NBENCHWORK) {
+		kprintf("vfs_biglock: counter mismatch (%lu)\n",
+			benchcounter);
+		kprintf("Test failed\n");
+		return 0;
+	}
+	kprintf("Lock benchmark 1 done.\n");
+	return 0;
+}
+
+int
+lockbench2(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	runbench("pidalloc", pidallocthread);
+	kprintf("Lock benchmark 2 done.\n");
+	return 0;
+}
+
+/*
+ * Spinlock benchmark: NTHREADS threads (default 8) take a spinlock in
+ * a tight loop for SPINBENCH_SECS seconds, first using a plain
+ * test-and-test-and-set lock and then the kernel's ticket spinlock.
+ * For each we print the average time per acquisition and the fewest
+ * and most acquisitions any one thread got, which shows how fair the
+ * lock is. Run it with sys161.conf set for 2 to 32 cpus and with
+ * that many threads to compare scaling.
+ */
+
+#define SPINBENCH_MAXTHREADS	32
+#define SPINBENCH_SECS		2
+
+static struct spinlock spinbench_lock = SPINLOCK_INITIALIZER;
+static volatile spinlock_data_t spinbench_ttas = SPINLOCK_DATA_INITIALIZER;
+static volatile bool spinbench_useticket;
+static volatile bool spinbench_go;
+static volatile bool spinbench_stop;
+static volatile unsigned long spinbench_counts[SPINBENCH_MAXTHREADS];
+
+static
+void
+ttas_acquire(void)
+{
+	while (1) {
+		if (spinlock_data_get(&spinbench_ttas) != 0) {
+			continue;
+		}
+		if (spinlock_data_testandset(&spinbench_ttas) != 0) {
+			continue;
+		}
+		break;
+	}
+	membar_store_any();
+}
+
+static
+void
+ttas_release(void)
+{
+	membar_any_store();
+	spinlock_data_set(&spinbench_ttas, 0);
+}
+
+static
+void
+spinbenchthread(void *junk, unsigned long num)
+{
+	bool useticket;
+	int spl, j;
+
+	(void)junk;
+
+	while (!spinbench_go) {
+		thread_yield();
+	}
+	useticket = spinbench_useticket;
+	while (!spinbench_stop) {
+		if (useticket) {
+			spinlock_acquire(&spinbench_lock);
+		}
+		else {
+			spl = splhigh();
+			ttas_acquire();
+		}
+		for (j=0; j<NBENCHWORK; j++) {
+			benchcounter++;
+		}
+		spinbench_counts[num]++;
+		if (useticket) {
+			spinlock_release(&spinbench_lock);
+		}
+		else {
+			ttas_release();
+			splx(spl);
+		}
+	}
+	V(benchdonesem);
+}
+
+static
+void
+runspinbench(const char *name, bool useticket, unsigned nthreads)
+{
+	struct timespec before, after, duration;
+	unsigned long min, max;
+	uint64_t nsecs, ops;
+	unsigned i;
+	int result;
+
+	initbench();
+	spinbench_useticket = useticket;
+	spinbench_go = false;
+	spinbench_stop = false;
+	for (i=0; i<nthreads; i++) {
+		spinbench_counts[i] = 0;
+	}
+
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork(name, NULL, spinbenchthread, NULL, i);
+		if (result) {
+			panic("lockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	gettime(&before);
+	spinbench_go = true;
+	clocksleep(SPINBENCH_SECS);
+	spinbench_stop = true;
+	gettime(&after);
+	for (i=0; i<nthreads; i++) {
+		P(benchdonesem);
+	}
+
+	ops = 0;
+	min = max = spinbench_counts[0];
+	for (i=0; i<nthreads; i++) {
+		ops += spinbench_counts[i];
+		if (spinbench_counts[i] < min) {
+			min = spinbench_counts[i];
+		}
+		if (spinbench_counts[i] > max) {
+			max = spinbench_counts[i];
+		}
+	}
+	if (ops == 0) {
+		kprintf("%s: no acquisitions\n", name);
+		return;
+	}
+
+	timespec_sub(&after, &before, &duration);
+	nsecs = (uint64_t)duration.tv_sec * 1000000000 + duration.tv_nsec;
+	kprintf("%s: %llu acquisitions (%llu ns each), "
+		"per thread min %lu max %lu\n",
+		name, (unsigned long long)ops,
+		(unsigned long long)(nsecs / ops), min, max);
+}
+
+int
+lockbench3(int nargs, char **args)
+{
+	unsigned nthreads;
+
+	nthreads = 8;
+	if (nargs > 1) {
+		nthreads = atoi(args[1]);
+	}
+	if (nthreads < 1 || nthreads > SPINBENCH_MAXTHREADS) {
+		kprintf("Usage: lb3 [nthreads], 1 to %d\n",
+			SPINBENCH_MAXTHREADS);
+		return EINVAL;
+	}
+
+	kprintf("Starting spinlock benchmark: %u threads, %d seconds each...\n",
+		nthreads, SPINBENCH_SECS);
+	runspinbench("ttas", false, nthreads);
+	runspinbench("ticket", true, nthreads);
+	kprintf("Lock benchmark 3 done.\n");
+	return 0;
+}
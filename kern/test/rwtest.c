@@ -0,0 +1,176 @@
+/*
+ * Reader-writer lock test code.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define NRWTHREADS	32
+#define NRWLOOPS	200
+#define NRWVALUES	8
+
+static struct rwlock *testrw;
+static struct semaphore *rwdonesem;
+
+/*
+ * Counts of threads currently inside the lock, kept under their own
+ * spinlock so the checks don't depend on the lock being tested.
+ */
+static struct spinlock rwcount_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned rwreaders;
+static volatile unsigned rwwriters;
+static volatile unsigned rwmaxreaders;
+
+/* Data protected by testrw: all entries should always be equal. */
+static volatile unsigned long rwvalues[NRWVALUES];
+
+static volatile bool rwfailed;
+
+static
+void
+rwinit(void)
+{
+	int i;
+
+	if (testrw == NULL) {
+		testrw = rwlock_create("testrw");
+		if (testrw == NULL) {
+			panic("rwtest: rwlock_create failed\n");
+		}
+	}
+	if (rwdonesem == NULL) {
+		rwdonesem = sem_create("rwdonesem", 0);
+		if (rwdonesem == NULL) {
+			panic("rwtest: sem_create failed\n");
+		}
+	}
+	for (i=0; i<NRWVALUES; i++) {
+		rwvalues[i] = 0;
+	}
+	rwreaders = rwwriters = rwmaxreaders = 0;
+	rwfailed = false;
+}
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	rwfailed = true;
+}
+
+static
+void
+rwreadthread(void *junk, unsigned long num)
+{
+	unsigned long first;
+	int i, j;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		rwlock_acquire_read(testrw);
+
+		spinlock_acquire(&rwcount_lock);
+		rwreaders++;
+		if (rwreaders > rwmaxreaders) {
+			rwmaxreaders = rwreaders;
+		}
+		if (rwwriters != 0) {
+			rwfail(num, "Reader running alongside a writer");
+		}
+		spinlock_release(&rwcount_lock);
+
+		first = rwvalues[0];
+		for (j=1; j<NRWVALUES; j++) {
+			if (rwvalues[j] != first) {
+				rwfail(num, "Reader saw a partial update");
+				break;
+			}
+			thread_yield();
+		}
+
+		spinlock_acquire(&rwcount_lock);
+		rwreaders--;
+		spinlock_release(&rwcount_lock);
+
+		rwlock_release_read(testrw);
+	}
+	V(rwdonesem);
+}
+
+static
+void
+rwwritethread(void *junk, unsigned long num)
+{
+	int i, j;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		rwlock_acquire_write(testrw);
+		KASSERT(rwlock_do_i_hold_write(testrw));
+
+		spinlock_acquire(&rwcount_lock);
+		rwwriters++;
+		if (rwwriters != 1 || rwreaders != 0) {
+			rwfail(num, "Writer not alone in the lock");
+		}
+		spinlock_release(&rwcount_lock);
+
+		for (j=0; j<NRWVALUES; j++) {
+			rwvalues[j] = num * NRWLOOPS + i;
+			thread_yield();
+		}
+
+		spinlock_acquire(&rwcount_lock);
+		rwwriters--;
+		spinlock_release(&rwcount_lock);
+
+		rwlock_release_write(testrw);
+	}
+	V(rwdonesem);
+}
+
+/*
+ * Stress test: one writer for every three readers, all hammering on
+ * the same lock and yielding inside the critical sections to shake
+ * out interleavings.
+ */
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	rwinit();
+	kprintf("Starting rwlock test...\n");
+
+	for (i=0; i<NRWTHREADS; i++) {
+		result = thread_fork("rwtest", NULL,
+				     (i % 4 == 0) ? rwwritethread : rwreadthread,
+				     NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NRWTHREADS; i++) {
+		P(rwdonesem);
+	}
+
+	kprintf("Up to %u readers held the lock at once\n", rwmaxreaders);
+	if (rwfailed) {
+		kprintf("Test failed\n");
+	}
+	else {
+		kprintf("Rwlock test done.\n");
+	}
+
+	return 0;
+}
@@ -450,3 +450,124 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+/*
+ * Priority inheritance test.
+ *
+ * A low-priority thread takes a lock that a high-priority thread then
+ * waits for, while a pack of medium-priority threads keep the cpu
+ * busy. Without priority inheritance the low thread doesn't get to
+ * run (and release the lock) until the medium threads are done; with
+ * it, the high thread should get the lock first.
+ */
+
+#define NPIMEDIUM	4
+#define NPIMEDLOOPS	2000
+#define NPILOWWORK	10
+
+static struct lock *pilock;
+static struct semaphore *pisem;
+static struct spinlock pimed_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned pimedfinished;
+static volatile bool pistop;
+
+static
+void
+pilowthread(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+	(void)num;
+
+	thread_setpriority(PRI_MIN);
+	lock_acquire(pilock);
+	V(pisem);
+	for (i=0; i<NPILOWWORK; i++) {
+		thread_yield();
+	}
+	lock_release(pilock);
+	V(pisem);
+}
+
+static
+void
+pimediumthread(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<NPIMEDLOOPS && !pistop; i++) {
+		thread_yield();
+	}
+	spinlock_acquire(&pimed_lock);
+	pimedfinished++;
+	spinlock_release(&pimed_lock);
+	V(pisem);
+}
+
+int
+pitest(int nargs, char **args)
+{
+	unsigned medfinished;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	if (pilock == NULL) {
+		pilock = lock_create("pilock");
+		if (pilock == NULL) {
+			panic("pitest: lock_create failed\n");
+		}
+	}
+	if (pisem == NULL) {
+		pisem = sem_create("pisem", 0);
+		if (pisem == NULL) {
+			panic("pitest: sem_create failed\n");
+		}
+	}
+	pimedfinished = 0;
+	pistop = false;
+
+	kprintf("Starting priority inheritance test...\n");
+
+	result = thread_fork("pitest-low", NULL, pilowthread, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	/* Wait for the low thread to get the lock. */
+	P(pisem);
+
+	for (i=0; i<NPIMEDIUM; i++) {
+		result = thread_fork("pitest-medium", NULL, pimediumthread,
+				     NULL, i);
+		if (result) {
+			panic("pitest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	thread_setpriority(PRI_MAX);
+	lock_acquire(pilock);
+	medfinished = pimedfinished;
+	pistop = true;
+	lock_release(pilock);
+	thread_setpriority(PRI_DEFAULT);
+
+	for (i=0; i<NPIMEDIUM+1; i++) {
+		P(pisem);
+	}
+
+	if (medfinished != 0) {
+		kprintf("%u medium threads ran before the lock came free\n",
+			medfinished);
+		kprintf("Test failed\n");
+	}
+	else {
+		kprintf("Priority inheritance test done.\n");
+	}
+	return 0;
+}
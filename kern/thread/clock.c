@@ -34,6 +34,8 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <workqueue.h>
+#include <rcu.h>
 
 /*
  * Time handling.
@@ -93,17 +95,31 @@ void
 hardclock(void)
 {
 	/*
-	 * Collect statistics here as desired.
+	 * Collect statistics here as desired. The run queue length is
+	 * read without its lock; it's only a sample.
 	 */
 
 	curcpu->c_hardclocks++;
+	if (curcpu->c_isidle) {
+		curcpu->c_stat.cs_idleticks++;
+	}
+	curcpu->c_stat.cs_rqtotal += curcpu->c_runqueue.tl_count;
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	workqueue_hardclock();
+
+	/*
+	 * Don't preempt a thread inside an RCU read section; otherwise
+	 * this tick is a quiescent state.
+	 */
+	if (curthread->t_rcu_nest == 0) {
+		rcu_quiescent();
+		thread_yield();
+	}
 }
 
 /*
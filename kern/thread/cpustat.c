@@ -0,0 +1,95 @@
+/*
+ * Per-cpu statistics report. The counters themselves are kept in
+ * struct cpu and updated where the events happen; see cpu.h.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <platform/maxcpus.h>
+
+/* What each cpu's counters were at the last report. */
+struct cpustat_snap {
+	unsigned cn_hardclocks;
+	struct cpustat cn_stat;
+};
+
+/* Only the menu thread uses this. */
+static struct cpustat_snap cpustat_last[MAXCPUS];
+
+static const char *const cpustat_ipinames[CPUSTAT_NIPI] = {
+	"panic", "offline", "unidle", "tlbshootdown",
+};
+
+/*
+ * Print one cpu's changes since SNAP, then update SNAP.
+ */
+static
+void
+cpustat_report_cpu(struct cpu *c, struct cpustat_snap *snap)
+{
+	struct cpustat now, *then;
+	unsigned ticks, rq, i;
+	bool any;
+
+	/* Copy first so the numbers printed are consistent with SNAP. */
+	ticks = c->c_hardclocks - snap->cn_hardclocks;
+	now = c->c_stat;
+	then = &snap->cn_stat;
+
+	kprintf("cpu%u: %u ticks", c->c_number, ticks);
+	if (ticks > 0) {
+		rq = (now.cs_rqtotal - then->cs_rqtotal) * 100 / ticks;
+		kprintf(", %u%% idle, run queue %u.%02u",
+			(now.cs_idleticks - then->cs_idleticks) * 100 / ticks,
+			rq / 100, rq % 100);
+	}
+	kprintf("\n");
+
+	kprintf("    switches: %u voluntary, %u preempted\n",
+		now.cs_vswitches - then->cs_vswitches,
+		now.cs_ivswitches - then->cs_ivswitches);
+	kprintf("    migrations: %u out, %u in\n",
+		now.cs_migrations_out - then->cs_migrations_out,
+		now.cs_migrations_in - then->cs_migrations_in);
+
+	kprintf("    ipis sent:");
+	for (i=0; i<CPUSTAT_NIPI; i++) {
+		kprintf(" %s %u", cpustat_ipinames[i],
+			now.cs_ipisent[i] - then->cs_ipisent[i]);
+	}
+	kprintf("\n    ipis received:");
+	for (i=0; i<CPUSTAT_NIPI; i++) {
+		kprintf(" %s %u", cpustat_ipinames[i],
+			now.cs_ipirecv[i] - then->cs_ipirecv[i]);
+	}
+	kprintf("\n");
+
+	kprintf("    interrupts:");
+	any = false;
+	for (i=0; i<CPUSTAT_NIRQ; i++) {
+		if (now.cs_irqs[i] != then->cs_irqs[i]) {
+			kprintf(" irq%u %u", i,
+				now.cs_irqs[i] - then->cs_irqs[i]);
+			any = true;
+		}
+	}
+	kprintf("%s\n", any ? "" : " none");
+
+	snap->cn_hardclocks += ticks;
+	snap->cn_stat = now;
+}
+
+/*
+ * Print every cpu's statistics as deltas. Timer interrupts aren't
+ * listed under interrupts; they're the tick count.
+ */
+void
+cpustat_report(void)
+{
+	struct cpu *c;
+	unsigned i;
+
+	for (i=0; i<MAXCPUS && (c = cpu_get(i)) != NULL; i++) {
+		cpustat_report_cpu(c, &cpustat_last[i]);
+	}
+}
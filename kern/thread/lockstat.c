@@ -0,0 +1,324 @@
+/*
+ * Lock contention statistics. See lockstat.h.
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
+#include <lockstat.h>
+#include <platform/maxcpus.h>
+
+/* Entries per cpu; a power of two. */
+#define LOCKSTAT_SIZE		64
+
+/* How much of a lock name we keep. */
+#define LOCKSTAT_NAMELEN	24
+
+/* How many entries lockstat_report prints. */
+#define LOCKSTAT_TOP		20
+
+/* Entry kinds; LS_FREE must be 0 so a zeroed table is empty. */
+#define LS_FREE		0
+#define LS_SPINLOCK	1
+#define LS_LOCK		2
+#define LS_WCHAN	3
+
+struct lockstat {
+	unsigned ls_kind;
+	const void *ls_pc;			/* for LS_SPINLOCK */
+	char ls_name[LOCKSTAT_NAMELEN];		/* for LS_LOCK, LS_WCHAN */
+	uint64_t ls_acquires;
+	uint64_t ls_contended;
+	uint64_t ls_spins;
+	uint64_t ls_waitns;
+};
+
+static struct lockstat lockstat_table[MAXCPUS][LOCKSTAT_SIZE];
+static unsigned lockstat_dropped[MAXCPUS];
+
+/* Set once the clock is attached; set before the other cpus start. */
+static bool lockstat_ready;
+
+/* Scratch space for lockstat_report; only the menu thread uses it. */
+static struct lockstat lockstat_sum[LOCKSTAT_SIZE];
+
+static
+unsigned
+lockstat_hash(unsigned kind, const void *pc, const char *name)
+{
+	unsigned h;
+	int i;
+
+	if (kind == LS_SPINLOCK) {
+		return (uintptr_t)pc >> 2;
+	}
+	h = kind;
+	for (i=0; i<LOCKSTAT_NAMELEN-1 && name[i] != 0; i++) {
+		h = h*33 + (unsigned char)name[i];
+	}
+	return h;
+}
+
+/*
+ * Check if entry LS is the one for KIND/PC/NAME. Names are compared
+ * only as far as we store them.
+ */
+static
+bool
+lockstat_match(const struct lockstat *ls,
+	       unsigned kind, const void *pc, const char *name)
+{
+	int i;
+
+	if (ls->ls_kind != kind) {
+		return false;
+	}
+	if (kind == LS_SPINLOCK) {
+		return ls->ls_pc == pc;
+	}
+	for (i=0; i<LOCKSTAT_NAMELEN-1; i++) {
+		if (ls->ls_name[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			break;
+		}
+	}
+	return true;
+}
+
+static
+void
+lockstat_setkey(struct lockstat *ls,
+		unsigned kind, const void *pc, const char *name)
+{
+	int i;
+
+	ls->ls_kind = kind;
+	ls->ls_pc = pc;
+	for (i=0; i<LOCKSTAT_NAMELEN-1 && name != NULL && name[i] != 0; i++) {
+		ls->ls_name[i] = name[i];
+	}
+	ls->ls_name[i] = 0;
+}
+
+/*
+ * Find (or make) the entry for KIND/PC/NAME in TABLE. Returns NULL if
+ * the table is full.
+ */
+static
+struct lockstat *
+lockstat_find(struct lockstat *table,
+	      unsigned kind, const void *pc, const char *name)
+{
+	struct lockstat *ls;
+	unsigned h, i;
+
+	h = lockstat_hash(kind, pc, name);
+	for (i=0; i<LOCKSTAT_SIZE; i++) {
+		ls = &table[(h + i) & (LOCKSTAT_SIZE - 1)];
+		if (ls->ls_kind == LS_FREE) {
+			lockstat_setkey(ls, kind, pc, name);
+			return ls;
+		}
+		if (lockstat_match(ls, kind, pc, name)) {
+			return ls;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Get this cpu's entry for KIND/PC/NAME.
+ */
+static
+struct lockstat *
+lockstat_get(unsigned kind, const void *pc, const char *name)
+{
+	struct lockstat *ls;
+	unsigned num;
+
+	if (!lockstat_ready || !CURCPU_EXISTS()) {
+		return NULL;
+	}
+	num = curcpu->c_number;
+	ls = lockstat_find(lockstat_table[num], kind, pc, name);
+	if (ls == NULL) {
+		lockstat_dropped[num]++;
+	}
+	return ls;
+}
+
+void
+lockstat_start(void)
+{
+	lockstat_ready = true;
+}
+
+void
+lockstat_gettime(struct timespec *ts)
+{
+	if (lockstat_ready) {
+		gettime(ts);
+	}
+	else {
+		ts->tv_sec = 0;
+		ts->tv_nsec = 0;
+	}
+}
+
+/*
+ * Nanoseconds from START to now; 0 if START was taken before the
+ * clock was there.
+ */
+static
+uint64_t
+lockstat_nsecsince(const struct timespec *start)
+{
+	struct timespec now, diff;
+
+	if (start->tv_sec == 0 && start->tv_nsec == 0) {
+		return 0;
+	}
+	gettime(&now);
+	timespec_sub(&now, start, &diff);
+	return (uint64_t)diff.tv_sec * 1000000000 + diff.tv_nsec;
+}
+
+void
+lockstat_spinlock(const void *pc, unsigned spins)
+{
+	struct lockstat *ls;
+
+	ls = lockstat_get(LS_SPINLOCK, pc, NULL);
+	if (ls == NULL) {
+		return;
+	}
+	ls->ls_acquires++;
+	if (spins > 0) {
+		ls->ls_contended++;
+		ls->ls_spins += spins;
+	}
+}
+
+void
+lockstat_lock(const char *name, bool contended, unsigned spins,
+	      const struct timespec *waitstart)
+{
+	struct lockstat *ls;
+
+	ls = lockstat_get(LS_LOCK, NULL, name);
+	if (ls == NULL) {
+		return;
+	}
+	ls->ls_acquires++;
+	if (contended) {
+		ls->ls_contended++;
+		ls->ls_spins += spins;
+		ls->ls_waitns += lockstat_nsecsince(waitstart);
+	}
+}
+
+void
+lockstat_wchan(const char *name, const struct timespec *sleepstart)
+{
+	struct lockstat *ls;
+
+	ls = lockstat_get(LS_WCHAN, NULL, name);
+	if (ls == NULL) {
+		return;
+	}
+	ls->ls_acquires++;
+	ls->ls_waitns += lockstat_nsecsince(sleepstart);
+}
+
+/*
+ * Is A a worse offender than B? Order by time spent waiting, then by
+ * number of contended acquisitions.
+ */
+static
+bool
+lockstat_worse(const struct lockstat *a, const struct lockstat *b)
+{
+	if (a->ls_waitns != b->ls_waitns) {
+		return a->ls_waitns > b->ls_waitns;
+	}
+	return a->ls_contended > b->ls_contended;
+}
+
+void
+lockstat_report(void)
+{
+	static const char *const kindnames[] = {
+		"", "spin", "lock", "wchan",
+	};
+	struct lockstat *ls, *sum, tmp;
+	unsigned i, j, n, dropped;
+
+	/* Add up the per-cpu tables, and zero them as we go. */
+	bzero(lockstat_sum, sizeof(lockstat_sum));
+	dropped = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		for (j=0; j<LOCKSTAT_SIZE; j++) {
+			ls = &lockstat_table[i][j];
+			if (ls->ls_kind == LS_FREE) {
+				continue;
+			}
+			sum = lockstat_find(lockstat_sum, ls->ls_kind,
+					    ls->ls_pc, ls->ls_name);
+			if (sum == NULL) {
+				dropped++;
+				continue;
+			}
+			sum->ls_acquires += ls->ls_acquires;
+			sum->ls_contended += ls->ls_contended;
+			sum->ls_spins += ls->ls_spins;
+			sum->ls_waitns += ls->ls_waitns;
+		}
+		bzero(lockstat_table[i], sizeof(lockstat_table[i]));
+		dropped += lockstat_dropped[i];
+		lockstat_dropped[i] = 0;
+	}
+
+	/* Pack the used entries at the front, worst first. */
+	n = 0;
+	for (i=0; i<LOCKSTAT_SIZE; i++) {
+		if (lockstat_sum[i].ls_kind != LS_FREE) {
+			lockstat_sum[n++] = lockstat_sum[i];
+		}
+	}
+	for (i=1; i<n; i++) {
+		tmp = lockstat_sum[i];
+		for (j=i; j>0 && lockstat_worse(&tmp, &lockstat_sum[j-1]); j--) {
+			lockstat_sum[j] = lockstat_sum[j-1];
+		}
+		lockstat_sum[j] = tmp;
+	}
+
+	kprintf("%-5s %-24s %10s %10s %12s %12s\n", "kind", "name",
+		"acquires", "contended", "spins", "wait (us)");
+	for (i=0; i<n && i<LOCKSTAT_TOP; i++) {
+		ls = &lockstat_sum[i];
+		if (ls->ls_kind == LS_SPINLOCK) {
+			kprintf("%-5s from %-19p ", kindnames[ls->ls_kind],
+				ls->ls_pc);
+		}
+		else {
+			kprintf("%-5s %-24s ", kindnames[ls->ls_kind],
+				ls->ls_name);
+		}
+		kprintf("%10llu %10llu %12llu %12llu\n",
+			(unsigned long long)ls->ls_acquires,
+			(unsigned long long)ls->ls_contended,
+			(unsigned long long)ls->ls_spins,
+			(unsigned long long)(ls->ls_waitns / 1000));
+	}
+	if (n > LOCKSTAT_TOP) {
+		kprintf("(%u more not shown)\n", n - LOCKSTAT_TOP);
+	}
+	if (dropped > 0) {
+		kprintf("(%u records lost to full tables)\n", dropped);
+	}
+	kprintf("Counters reset.\n");
+}
@@ -0,0 +1,252 @@
+/*
+ * Read-copy-update. See rcu.h.
+ */
+#define RCU_INLINE
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <workqueue.h>
+#include <rcu.h>
+
+/*
+ * Grace periods are numbered. rcu_gp is the latest one started and
+ * rcu_completed the latest one finished; they're equal when none is
+ * in progress. A cpu that has reported a quiescent state for grace
+ * period N has c_rcu_gp == N. Cpus join the first time they report
+ * (so ones not yet started don't hold things up), except the boot
+ * cpu, which is in from the start.
+ *
+ * Callbacks wait on rcu_pending, tagged with the grace period they
+ * need; when it finishes they move to rcu_ready and are run by a
+ * work item.
+ */
+static struct spinlock rcu_lock = SPINLOCK_INITIALIZER;
+static struct wchan *rcu_wchan;			/* synchronize_rcu waits */
+static volatile unsigned rcu_gp;		/* Latest started */
+static volatile unsigned rcu_completed;		/* Latest finished */
+static bool rcu_needgp;				/* Want another after this */
+static unsigned rcu_ncpus;			/* Cpus taking part */
+static unsigned rcu_remaining;			/* Cpus yet to report */
+static struct rcu_head *rcu_pending;		/* Waiting callbacks */
+static struct rcu_head **rcu_pendingtail = &rcu_pending;
+static struct rcu_head *volatile rcu_ready;	/* Callbacks to run */
+static volatile bool rcu_workqueued;		/* rcu_work is queued */
+static struct work rcu_work;
+
+static void rcu_runcallbacks(void *);
+
+/*
+ * Setup function.
+ */
+void
+rcu_bootstrap(void)
+{
+	rcu_wchan = wchan_create("rcu");
+	if (rcu_wchan == NULL) {
+		panic("rcu_bootstrap: Out of memory\n");
+	}
+	work_init(&rcu_work, rcu_runcallbacks, NULL);
+
+	spinlock_acquire(&rcu_lock);
+	curcpu->c_rcu_online = true;
+	curcpu->c_rcu_gp = rcu_gp;
+	rcu_ncpus = 1;
+	spinlock_release(&rcu_lock);
+}
+
+/*
+ * Start a new grace period.
+ */
+static
+void
+rcu_startgp(void)
+{
+	KASSERT(spinlock_do_i_hold(&rcu_lock));
+	KASSERT(rcu_completed == rcu_gp);
+
+	rcu_gp++;
+	rcu_remaining = rcu_ncpus;
+	rcu_needgp = false;
+}
+
+/*
+ * The current grace period is over: release waiters and callbacks,
+ * and start the next one if anybody wants it.
+ */
+static
+void
+rcu_endgp(void)
+{
+	struct rcu_head *rh, **tail;
+
+	KASSERT(spinlock_do_i_hold(&rcu_lock));
+
+	rcu_completed = rcu_gp;
+
+	/* Move finished callbacks to the end of the ready list. */
+	for (tail = (struct rcu_head **)&rcu_ready; *tail != NULL;
+	     tail = &(*tail)->rh_next) {
+		/* nothing */
+	}
+	while ((rh = rcu_pending) != NULL &&
+	       (int)(rcu_completed - rh->rh_gp) >= 0) {
+		rcu_pending = rh->rh_next;
+		rh->rh_next = NULL;
+		*tail = rh;
+		tail = &rh->rh_next;
+	}
+	if (rcu_pending == NULL) {
+		rcu_pendingtail = &rcu_pending;
+	}
+
+	wchan_wakeall(rcu_wchan, &rcu_lock);
+
+	if (rcu_needgp || rcu_pending != NULL) {
+		rcu_startgp();
+	}
+}
+
+/*
+ * Hand the ready callbacks to a worker thread, if there are any and
+ * nobody has yet. Called without rcu_lock.
+ */
+static
+void
+rcu_kick(void)
+{
+	bool kick;
+
+	spinlock_acquire(&rcu_lock);
+	kick = rcu_ready != NULL && !rcu_workqueued;
+	if (kick) {
+		rcu_workqueued = true;
+	}
+	spinlock_release(&rcu_lock);
+
+	if (kick && !workqueue_enqueue(&rcu_work)) {
+		/* No workers yet; try again on a later tick. */
+		spinlock_acquire(&rcu_lock);
+		rcu_workqueued = false;
+		spinlock_release(&rcu_lock);
+	}
+}
+
+/*
+ * Work function: run the ready callbacks.
+ */
+static
+void
+rcu_runcallbacks(void *junk)
+{
+	struct rcu_head *rh, *next;
+
+	(void)junk;
+
+	spinlock_acquire(&rcu_lock);
+	rh = rcu_ready;
+	rcu_ready = NULL;
+	rcu_workqueued = false;
+	spinlock_release(&rcu_lock);
+
+	while (rh != NULL) {
+		next = rh->rh_next;
+		rh->rh_func(rh->rh_data);
+		rh = next;
+	}
+}
+
+/*
+ * Report a quiescent state for this cpu. Called with interrupts off,
+ * from thread_switch (after the switch) and from hardclock when the
+ * interrupted thread isn't in a read section.
+ */
+void
+rcu_quiescent(void)
+{
+	struct cpu *c = curcpu;
+
+	KASSERT(curthread->t_rcu_nest == 0);
+
+	/* Unlocked peek: usually there's nothing to do. */
+	if (c->c_rcu_online && c->c_rcu_gp == rcu_gp) {
+		if (rcu_ready != NULL && !rcu_workqueued) {
+			rcu_kick();
+		}
+		return;
+	}
+
+	spinlock_acquire(&rcu_lock);
+	if (!c->c_rcu_online) {
+		/* Joining; not counted in any grace period under way. */
+		c->c_rcu_online = true;
+		c->c_rcu_gp = rcu_gp;
+		rcu_ncpus++;
+	}
+	else if (c->c_rcu_gp != rcu_gp) {
+		c->c_rcu_gp = rcu_gp;
+		KASSERT(rcu_remaining > 0);
+		rcu_remaining--;
+		if (rcu_remaining == 0) {
+			rcu_endgp();
+		}
+	}
+	spinlock_release(&rcu_lock);
+
+	rcu_kick();
+}
+
+/*
+ * Wait for a full grace period. If one is already in progress it may
+ * have started before our caller's update, so wait for the next.
+ */
+void
+synchronize_rcu(void)
+{
+	unsigned target;
+
+	KASSERT(curthread->t_rcu_nest == 0);
+	KASSERT(!curthread->t_in_interrupt);
+
+	spinlock_acquire(&rcu_lock);
+	if (rcu_completed == rcu_gp) {
+		rcu_startgp();
+		target = rcu_gp;
+	}
+	else {
+		rcu_needgp = true;
+		target = rcu_gp + 1;
+	}
+	while ((int)(rcu_completed - target) < 0) {
+		wchan_sleep(rcu_wchan, &rcu_lock);
+	}
+	spinlock_release(&rcu_lock);
+}
+
+/*
+ * Arrange for FUNC(DATA) to be called after a grace period.
+ */
+void
+call_rcu(struct rcu_head *rh, void (*func)(void *), void *data)
+{
+	rh->rh_func = func;
+	rh->rh_data = data;
+	rh->rh_next = NULL;
+
+	spinlock_acquire(&rcu_lock);
+	if (rcu_completed == rcu_gp) {
+		rcu_startgp();
+		rh->rh_gp = rcu_gp;
+	}
+	else {
+		rcu_needgp = true;
+		rh->rh_gp = rcu_gp + 1;
+	}
+	*rcu_pendingtail = rh;
+	rcu_pendingtail = &rh->rh_next;
+	spinlock_release(&rcu_lock);
+}
@@ -38,6 +38,7 @@
 #include <spinlock.h>
 #include <membar.h>
 #include <current.h>	/* for curcpu */
+#include <lockstat.h>
 
 /*
  * Spinlocks.
@@ -50,7 +51,8 @@
 void
 spinlock_init(struct spinlock *splk)
 {
-	spinlock_data_set(&splk->splk_lock, 0);
+	spinlock_data_set(&splk->splk_next, 0);
+	spinlock_data_set(&splk->splk_serving, 0);
 	splk->splk_holder = NULL;
 }
 
@@ -61,7 +63,8 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
-	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	KASSERT(spinlock_data_get(&splk->splk_next) ==
+		spinlock_data_get(&splk->splk_serving));
 }
 
 /*
@@ -69,12 +72,16 @@ spinlock_cleanup(struct spinlock *splk)
  *
  * First disable interrupts (otherwise, if we get a timer interrupt we
  * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * atomic operation to take a ticket and wait for our turn.
  */
 void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket;
+#if OPT_LOCKSTAT
+	unsigned spins = 0;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -90,28 +97,57 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
-		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
-			continue;
-		}
-		break;
+	/*
+	 * The only atomic operation is taking the ticket; after that
+	 * we just read splk_serving, which only the holder writes,
+	 * so waiters don't fight over the bus while the lock is held.
+	 */
+	ticket = spinlock_data_fetchinc(&splk->splk_next);
+	while (spinlock_data_get(&splk->splk_serving) != ticket) {
+		/* spin */
+#if OPT_LOCKSTAT
+		spins++;
+#endif
+	}
+
+	membar_store_any();
+	splk->splk_holder = mycpu;
+
+#if OPT_LOCKSTAT
+	lockstat_spinlock(__builtin_return_address(0), spins);
+#endif
+}
+
+/*
+ * Get the lock if nobody holds it or is waiting for it. The lock is
+ * free exactly when the next ticket is the one being served, so take
+ * that ticket only if it still is.
+ */
+bool
+spinlock_tryacquire(struct spinlock *splk)
+{
+	struct cpu *mycpu;
+	spinlock_data_t ticket;
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	KASSERT(CURCPU_EXISTS());
+	mycpu = curcpu->c_self;
+	if (splk->splk_holder == mycpu) {
+		panic("Deadlock on spinlock %p\n", splk);
+	}
+
+	ticket = spinlock_data_get(&splk->splk_serving);
+	if (spinlock_data_cmpxchg(&splk->splk_next, ticket, ticket + 1)
+	    != ticket) {
+		spllower(IPL_HIGH, IPL_NONE);
+		return false;
 	}
 
+	mycpu->c_spinlocks++;
 	membar_store_any();
 	splk->splk_holder = mycpu;
+	return true;
 }
 
 /*
@@ -129,7 +165,9 @@ spinlock_release(struct spinlock *splk)
 
 	splk->splk_holder = NULL;
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	/* Only the holder writes splk_serving, so no atomic op needed. */
+	spinlock_data_set(&splk->splk_serving,
+			  spinlock_data_get(&splk->splk_serving) + 1);
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
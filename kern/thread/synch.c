@@ -34,11 +34,14 @@
 
 #include <types.h>
 #include <lib.h>
+#include <cpu.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <clock.h>
+#include <lockstat.h>
 
 ////////////////////////////////////////////////////////////
 //
@@ -120,6 +123,28 @@ P(struct semaphore *sem)
 	spinlock_release(&sem->sem_lock);
 }
 
+int
+P_intr(struct semaphore *sem)
+{
+	int result;
+
+        KASSERT(sem != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&sem->sem_lock);
+        while (sem->sem_count == 0) {
+		result = wchan_sleep_intr(sem->sem_wchan, &sem->sem_lock);
+		if (result) {
+			spinlock_release(&sem->sem_lock);
+			return result;
+		}
+        }
+        KASSERT(sem->sem_count > 0);
+        sem->sem_count--;
+	spinlock_release(&sem->sem_lock);
+	return 0;
+}
+
 void
 V(struct semaphore *sem)
 {
@@ -138,6 +163,15 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * Number of times lock_acquire polls a lock whose holder is running
+ * on another cpu before checking again whether it should sleep.
+ */
+#define LOCK_SPIN_MAX	1000
+
+/* How far along a chain of blocked lock holders to lend priority. */
+#define LOCK_PI_MAXDEPTH	8
+
 /*
  * Create a lock.
  */
@@ -168,6 +202,7 @@ lock_create(const char *name)
         spinlock_init(&(lock->lk_splk));
         
         lock->lk_holder = NULL;
+        lock->lk_nextheld = NULL;
 
         return lock;
 }
@@ -190,23 +225,137 @@ lock_destroy(struct lock *lock)
         kfree(lock);
 }
 
+/*
+ * Check if the holder of a lock is currently running on some other
+ * cpu. The caller must hold the lock's spinlock, which keeps the
+ * holder from releasing the lock (and so from going away) while we
+ * look at it. The answer can be stale as soon as we return; it is
+ * only used to decide whether spinning is worthwhile.
+ */
+static
+bool
+lock_holder_oncpu(struct lock *lock)
+{
+        struct thread *holder;
+
+        KASSERT(spinlock_do_i_hold(&(lock->lk_splk)));
+
+        holder = lock->lk_holder;
+        return (holder->t_state == S_RUN &&
+                holder->t_cpu != curcpu->c_self);
+}
+
+/*
+ * Lend the current thread's priority to the holder of LOCK, and if
+ * that thread is itself blocked on a lock, to that lock's holder, and
+ * so on. Called with LOCK's spinlock held, which keeps its holder
+ * from going away.
+ *
+ * We move along the chain hand over hand, holding the spinlock of
+ * the lock whose holder we're looking at; that thread's t_waitlock
+ * is only believed once the next lock's spinlock is held too. Since
+ * each holder really is stuck while we look at it, a cycle here is a
+ * real deadlock among the sleep locks.
+ */
+static
+void
+lock_lend_priority(struct lock *lock)
+{
+        struct lock *lk, *next;
+        struct thread *holder;
+        int pri, depth;
+
+        KASSERT(spinlock_do_i_hold(&(lock->lk_splk)));
+
+        pri = curthread->t_pri;
+        lk = lock;
+        for (depth = 0; depth < LOCK_PI_MAXDEPTH; depth++) {
+                holder = lk->lk_holder;
+                if (holder == NULL || !thread_lend_priority(holder, pri)) {
+                        break;
+                }
+                next = holder->t_waitlock;
+                if (next == NULL || next == lock || next == lk) {
+                        break;
+                }
+                spinlock_acquire(&(next->lk_splk));
+                if (lk != lock) {
+                        spinlock_release(&(lk->lk_splk));
+                }
+                lk = next;
+                if (holder->t_waitlock != lk) {
+                        break;
+                }
+        }
+        if (lk != lock) {
+                spinlock_release(&(lk->lk_splk));
+        }
+}
+
 /*
  * Acquire the lock.
+ *
+ * This is an adaptive lock: if the holder is running on another cpu
+ * it is probably about to release the lock, so we poll lk_holder for
+ * a while without the spinlock held rather than paying for a context
+ * switch. If the holder is asleep, or is waiting to run on our own
+ * cpu, spinning can't help and we go to sleep on the wait channel.
  */
 void
 lock_acquire(struct lock *lock)
 {
+        struct thread *holder;
+        unsigned spins;
+#if OPT_LOCKSTAT
+        struct timespec waitstart;
+        unsigned totalspins = 0;
+        bool contended = false;
+#endif
+
         // Write this
         KASSERT(lock != NULL);
         spinlock_acquire(&(lock->lk_splk));
 
         while (lock->lk_holder != NULL) {
-                // Put the thread to sleep if the lock is in use.
+#if OPT_LOCKSTAT
+                if (!contended) {
+                        contended = true;
+                        lockstat_gettime(&waitstart);
+                }
+#endif
+                if (lock_holder_oncpu(lock)) {
+                        holder = lock->lk_holder;
+                        spinlock_release(&(lock->lk_splk));
+
+                        /* Only look at the pointer; don't touch *holder. */
+                        for (spins = 0; spins < LOCK_SPIN_MAX; spins++) {
+                                if (lock->lk_holder != holder) {
+                                        break;
+                                }
+                        }
+#if OPT_LOCKSTAT
+                        totalspins += spins;
+#endif
+
+                        spinlock_acquire(&(lock->lk_splk));
+                        continue;
+                }
+                // Put the thread to sleep if the lock is in use,
+                // first making sure the holder runs at least as
+                // urgently as we would.
+                curthread->t_waitlock = lock;
+                lock_lend_priority(lock);
                 wchan_sleep(lock->lk_wc, &(lock->lk_splk));          
         }
         KASSERT(lock->lk_holder == NULL);
         // Acquire the lock by setting lk_holder to be the current thread.
+        curthread->t_waitlock = NULL;
         lock->lk_holder = curthread;
+        lock->lk_nextheld = curthread->t_heldlocks;
+        curthread->t_heldlocks = lock;
+#if OPT_LOCKSTAT
+        lockstat_lock(lock->lk_name, contended, totalspins, &waitstart);
+#endif
         spinlock_release(&(lock->lk_splk));
 }
 
@@ -216,6 +365,8 @@ lock_acquire(struct lock *lock)
 void
 lock_release(struct lock *lock)
 {
+        struct lock **lkp;
+
         // Write this
         // Raise an assertion if you cur thread is not the lock holder.
         KASSERT(lock != NULL);
@@ -225,10 +376,21 @@ lock_release(struct lock *lock)
         
         // set the lock holder to NULL so the lock is free.
         lock->lk_holder = NULL;
+        for (lkp = &curthread->t_heldlocks; *lkp != lock;
+             lkp = &(*lkp)->lk_nextheld) {
+                KASSERT(*lkp != NULL);
+        }
+        *lkp = lock->lk_nextheld;
+        lock->lk_nextheld = NULL;
         // wake a thread that is waiting for this resource.
         wchan_wakeone(lock->lk_wc, &(lock->lk_splk));
 
         spinlock_release(&(lock->lk_splk));
+
+        // Give back any priority the waiters lent us.
+        if (curthread->t_pri != curthread->t_basepri) {
+                thread_recompute_priority();
+        }
 }
 
 /*
@@ -306,6 +468,25 @@ cv_wait(struct cv *cv, struct lock *lock)
         lock_acquire(lock);
 }
 
+int
+cv_wait_intr(struct cv *cv, struct lock *lock)
+{
+	int result;
+
+        KASSERT(cv != NULL);
+        KASSERT(lock != NULL);
+        KASSERT(lock->lk_holder == curthread);
+
+        spinlock_acquire(&(cv->cv_splk));
+        lock_release(lock);
+
+	result = wchan_sleep_intr(cv->cv_wc, &(cv->cv_splk));
+
+        spinlock_release(&(cv->cv_splk));
+        lock_acquire(lock);
+	return result;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
@@ -337,3 +518,153 @@ cv_broadcast(struct cv *cv, struct lock *lock)
         
         spinlock_release(&(cv->cv_splk));
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rw;
+
+        rw = kmalloc(sizeof(struct rwlock));
+        if (rw == NULL) {
+                return NULL;
+        }
+
+        rw->rwlock_name = kstrdup(name);
+        if (rw->rwlock_name == NULL) {
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_readwc = wchan_create(rw->rwlock_name);
+        if (rw->rw_readwc == NULL) {
+                kfree(rw->rwlock_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_writewc = wchan_create(rw->rwlock_name);
+        if (rw->rw_writewc == NULL) {
+                wchan_destroy(rw->rw_readwc);
+                kfree(rw->rwlock_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        spinlock_init(&rw->rw_splk);
+        rw->rw_readers = 0;
+        rw->rw_waitingwriters = 0;
+        rw->rw_writer = NULL;
+
+        return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        // Nobody may hold or be waiting for the lock.
+        KASSERT(rw->rw_readers == 0);
+        KASSERT(rw->rw_waitingwriters == 0);
+        KASSERT(rw->rw_writer == NULL);
+
+        spinlock_cleanup(&rw->rw_splk);
+        wchan_destroy(rw->rw_writewc);
+        wchan_destroy(rw->rw_readwc);
+        kfree(rw->rwlock_name);
+        kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&rw->rw_splk);
+
+        /*
+         * Stay out while a writer holds the lock, and also while one
+         * is waiting for it, so a stream of readers can't starve
+         * the writers.
+         */
+        while (rw->rw_writer != NULL || rw->rw_waitingwriters > 0) {
+                wchan_sleep(rw->rw_readwc, &rw->rw_splk);
+        }
+        rw->rw_readers++;
+
+        spinlock_release(&rw->rw_splk);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        spinlock_acquire(&rw->rw_splk);
+
+        KASSERT(rw->rw_readers > 0);
+        KASSERT(rw->rw_writer == NULL);
+        rw->rw_readers--;
+
+        // The last reader out lets a waiting writer in.
+        if (rw->rw_readers == 0 && rw->rw_waitingwriters > 0) {
+                wchan_wakeone(rw->rw_writewc, &rw->rw_splk);
+        }
+
+        spinlock_release(&rw->rw_splk);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+        KASSERT(rw->rw_writer != curthread);
+
+        spinlock_acquire(&rw->rw_splk);
+
+        rw->rw_waitingwriters++;
+        while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+                wchan_sleep(rw->rw_writewc, &rw->rw_splk);
+        }
+        rw->rw_waitingwriters--;
+        rw->rw_writer = curthread;
+
+        spinlock_release(&rw->rw_splk);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rwlock_do_i_hold_write(rw));
+
+        spinlock_acquire(&rw->rw_splk);
+
+        rw->rw_writer = NULL;
+
+        /*
+         * Hand off to the next writer if there is one; otherwise let
+         * all the waiting readers in together.
+         */
+        if (rw->rw_waitingwriters > 0) {
+                wchan_wakeone(rw->rw_writewc, &rw->rw_splk);
+        }
+        else {
+                wchan_wakeall(rw->rw_readwc, &rw->rw_splk);
+        }
+
+        spinlock_release(&rw->rw_splk);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        return (rw->rw_writer == curthread);
+}
@@ -53,6 +53,10 @@
 #include <mainbus.h>
 #include <vnode.h>
 #include <pid.h>
+#include <clock.h>
+#include <lockstat.h>
+#include <rcu.h>
+#include <workqueue.h>
 
 #include "opt-synchprobs.h"
 
@@ -81,6 +85,11 @@ static struct wchanarray allwchans;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Protects t_pri and t_prigen of all threads. */
+static struct spinlock thread_prilock = SPINLOCK_INITIALIZER;
+
+static void thread_reap(void *);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -152,11 +161,28 @@ thread_create(const char *name)
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_pinned = false;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
+	thread->t_rcu_nest = 0;
+
+	/* Priority fields */
+	thread->t_basepri = PRI_DEFAULT;
+	thread->t_pri = PRI_DEFAULT;
+	thread->t_prigen = 0;
+	thread->t_waitlock = NULL;
+	thread->t_heldlocks = NULL;
+
+	/* Interruptible sleep fields */
+	spinlock_init(&thread->t_intrlock);
+	thread->t_intrwc = NULL;
+	thread->t_intrlk = NULL;
+
+	/* Public fields */
+	thread->t_ustack = -1;
 
 	/* If you add to struct thread, be sure to initialize here */
 
@@ -190,6 +216,12 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	work_init(&c->c_reapwork, thread_reap, NULL);
+	c->c_rcu_online = false;
+	c->c_rcu_gp = 0;
+	bzero(&c->c_stat, sizeof(c->c_stat));
+
+	c->c_workqueue = NULL;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
@@ -237,6 +269,18 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Look up a cpu by number.
+ */
+struct cpu *
+cpu_get(unsigned software_number)
+{
+	if (software_number >= cpuarray_num(&allcpus)) {
+		return NULL;
+	}
+	return cpuarray_get(&allcpus, software_number);
+}
+
 /*
  * Destroy a thread.
  *
@@ -264,6 +308,8 @@ thread_destroy(struct thread *thread)
 	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
+	KASSERT(thread->t_intrlk == NULL);
+	spinlock_cleanup(&thread->t_intrlock);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
@@ -277,6 +323,10 @@ thread_destroy(struct thread *thread)
  * need to have thread_destroy called on them.)
  *
  * The list of zombies is per-cpu.
+ *
+ * This is called in the middle of every context switch, so once the
+ * workqueues are running we hand the zombies to this cpu's worker
+ * threads (see thread_reap) instead of freeing them here.
  */
 static
 void
@@ -284,6 +334,13 @@ exorcise(void)
 {
 	struct thread *z;
 
+	if (threadlist_isempty(&curcpu->c_zombies)) {
+		return;
+	}
+	if (workqueue_enqueue(&curcpu->c_reapwork)) {
+		return;
+	}
+
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
@@ -291,6 +348,37 @@ exorcise(void)
 	}
 }
 
+/*
+ * Workqueue function for exorcise. Runs in one of the current cpu's
+ * worker threads, which don't migrate, so curcpu's zombie list is
+ * the one that asked for this. Everything that has piled up since is
+ * freed in one go.
+ */
+static
+void
+thread_reap(void *junk)
+{
+	struct threadlist zombies;
+	struct thread *z;
+	int spl;
+
+	(void)junk;
+
+	threadlist_init(&zombies);
+	spl = splhigh();
+	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
+		threadlist_addtail(&zombies, z);
+	}
+	splx(spl);
+
+	while ((z = threadlist_remhead(&zombies)) != NULL) {
+		KASSERT(z != curthread);
+		KASSERT(z->t_state == S_ZOMBIE);
+		thread_destroy(z);
+	}
+	threadlist_cleanup(&zombies);
+}
+
 /*
  * On panic, stop the thread system (as much as is reasonably
  * possible) to make sure we don't end up letting any other threads
@@ -445,6 +533,28 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Put a thread on a run queue, behind any threads of the same or
+ * higher priority. The run queue must be locked.
+ *
+ * In the common case where everything has the same priority this
+ * stops at the first comparison and is the same as addtail.
+ */
+static
+void
+thread_runqueue_insert(struct threadlist *rq, struct thread *target)
+{
+	struct thread *t;
+
+	THREADLIST_FORALL_REV(t, *rq) {
+		if (t->t_pri >= target->t_pri) {
+			threadlist_insertafter(rq, t, target);
+			return;
+		}
+	}
+	threadlist_addhead(rq, target);
+}
+
 /*
  * Make a thread runnable.
  *
@@ -469,7 +579,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	thread_runqueue_insert(&targetcpu->c_runqueue, target);
 
 	if (targetcpu->c_isidle) {
 		/*
@@ -491,14 +601,16 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
  * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
  *
  * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * process is inherited from the caller. If CPU is null, it will start
+ * on the same CPU as the caller, unless the scheduler intervenes
+ * first; otherwise it is pinned to CPU.
  */
+static
 int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+thread_fork_common(const char *name,
+		   struct proc *proc, struct cpu *cpu,
+		   void (*entrypoint)(void *data1, unsigned long data2),
+		   void *data1, unsigned long data2)
 {
 	struct thread *newthread;
 	int result;
@@ -521,7 +633,17 @@ thread_fork(const char *name,
 	 */
 
 	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
+	if (cpu == NULL) {
+		newthread->t_cpu = curthread->t_cpu;
+	}
+	else {
+		newthread->t_cpu = cpu;
+		newthread->t_pinned = true;
+	}
+
+	/* Inherit the parent's own (not borrowed) priority */
+	newthread->t_basepri = curthread->t_basepri;
+	newthread->t_pri = curthread->t_basepri;
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -544,12 +666,29 @@ thread_fork(const char *name,
 	/* Set up the switchframe so entrypoint() gets called */
 	switchframe_init(newthread, entrypoint, data1, data2);
 
-	/* Lock the current cpu's run queue and make the new thread runnable */
+	/* Lock the target cpu's run queue and make the new thread runnable */
 	thread_make_runnable(newthread, false);
 
 	return 0;
 }
 
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	return thread_fork_common(name, proc, NULL, entrypoint, data1, data2);
+}
+
+int
+thread_fork_oncpu(const char *name, struct cpu *c,
+		  void (*entrypoint)(void *data1, unsigned long data2),
+		  void *data1, unsigned long data2)
+{
+	return thread_fork_common(name, kproc, c, entrypoint, data1, data2);
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -570,6 +709,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	DEBUGASSERT(curcpu->c_curthread == curthread);
 	DEBUGASSERT(curthread->t_cpu == curcpu->c_self);
 
+	/* RCU read sections may not sleep or yield. */
+	KASSERT(curthread->t_rcu_nest == 0);
+
 	/* Explicitly disable interrupts on this processor */
 	spl = splhigh();
 
@@ -624,6 +766,14 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	}
 	cur->t_state = newstate;
 
+	/* A yield from an interrupt handler is a preemption. */
+	if (newstate == S_READY && cur->t_in_interrupt) {
+		curcpu->c_stat.cs_ivswitches++;
+	}
+	else {
+		curcpu->c_stat.cs_vswitches++;
+	}
+
 	/*
 	 * Get the next thread. While there isn't one, call md_idle().
 	 * curcpu->c_isidle must be true when md_idle is
@@ -726,6 +876,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Having switched threads, this cpu is quiescent for RCU. */
+	rcu_quiescent();
+
 	/* Turn interrupts back on. */
 	splx(spl);
 }
@@ -839,10 +992,122 @@ thread_yield(void)
 void
 schedule(void)
 {
+	struct threadlist sorted;
+	struct thread *t;
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * Threads are inserted in priority order when they become
+	 * runnable, but migration appends at the tail and a waiting
+	 * thread's priority can change while it's queued. Re-sort
+	 * (stably, so equal priorities stay round-robin).
 	 */
+	threadlist_init(&sorted);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	while ((t = threadlist_remhead(&curcpu->c_runqueue)) != NULL) {
+		thread_runqueue_insert(&sorted, t);
+	}
+	while ((t = threadlist_remhead(&sorted)) != NULL) {
+		threadlist_addtail(&curcpu->c_runqueue, t);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+	threadlist_cleanup(&sorted);
+}
+
+/*
+ * If a thread is sitting on a run queue, move it to the right place
+ * for its (changed) priority.
+ */
+static
+void
+thread_requeue(struct thread *t)
+{
+	struct cpu *c;
+
+	c = t->t_cpu;
+	spinlock_acquire(&c->c_runqueue_lock);
+	if (t->t_cpu == c && t->t_state == S_READY && t != c->c_curthread) {
+		threadlist_remove(&c->c_runqueue, t);
+		thread_runqueue_insert(&c->c_runqueue, t);
+	}
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+/*
+ * Set the current thread's own priority.
+ */
+void
+thread_setpriority(int pri)
+{
+	KASSERT(pri >= PRI_MIN && pri <= PRI_MAX);
+
+	curthread->t_basepri = pri;
+	thread_recompute_priority();
+}
+
+/*
+ * Raise T's effective priority to at least PRI. Returns true if it
+ * was lower. T must not be able to go away while we're doing this;
+ * lock_acquire guarantees that by holding the spinlock of a lock T
+ * holds.
+ */
+bool
+thread_lend_priority(struct thread *t, int pri)
+{
+	bool raised = false;
+
+	spinlock_acquire(&thread_prilock);
+	if (t->t_pri < pri) {
+		t->t_pri = pri;
+		t->t_prigen++;
+		raised = true;
+	}
+	spinlock_release(&thread_prilock);
+
+	if (raised) {
+		thread_requeue(t);
+	}
+	return raised;
+}
+
+/*
+ * Recompute the current thread's effective priority: the highest of
+ * its own priority and those of the threads waiting for locks it
+ * holds.
+ *
+ * We can't hold thread_prilock while looking at the locks (their
+ * spinlocks come first in the lock order), so instead note t_prigen
+ * first and start over if someone lent us priority in the meantime.
+ */
+void
+thread_recompute_priority(void)
+{
+	struct thread *cur = curthread;
+	struct lock *lk;
+	struct thread *t;
+	unsigned gen;
+	int pri;
+	bool done = false;
+
+	while (!done) {
+		gen = cur->t_prigen;
+		pri = cur->t_basepri;
+		for (lk = cur->t_heldlocks; lk != NULL; lk = lk->lk_nextheld) {
+			spinlock_acquire(&lk->lk_splk);
+			THREADLIST_FORALL(t, lk->lk_wc->wc_threads) {
+				if (t->t_pri > pri) {
+					pri = t->t_pri;
+				}
+			}
+			spinlock_release(&lk->lk_splk);
+		}
+
+		spinlock_acquire(&thread_prilock);
+		if (cur->t_prigen == gen) {
+			cur->t_pri = pri;
+			done = true;
+		}
+		spinlock_release(&thread_prilock);
+	}
 }
 
 /*
@@ -932,9 +1197,17 @@ thread_consider_migration(void)
 				to_send--;
 				continue;
 			}
+			/* Likewise for threads that must stay here. */
+			if (t->t_pinned) {
+				threadlist_addtail(&victims, t);
+				to_send--;
+				continue;
+			}
 
 			t->t_cpu = c;
 			threadlist_addtail(&c->c_runqueue, t);
+			curcpu->c_stat.cs_migrations_out++;
+			c->c_stat.cs_migrations_in++;
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -1045,6 +1318,10 @@ wchan_destroy(struct wchan *wc)
 void
 wchan_sleep(struct wchan *wc, struct spinlock *lk)
 {
+#if OPT_LOCKSTAT
+	struct timespec sleepstart;
+#endif
+
 	/* may not sleep in an interrupt handler */
 	KASSERT(!curthread->t_in_interrupt);
 
@@ -1054,27 +1331,74 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	/* must not hold other spinlocks */
 	KASSERT(curcpu->c_spinlocks == 1);
 
+#if OPT_LOCKSTAT
+	lockstat_gettime(&sleepstart);
+#endif
 	thread_switch(S_SLEEP, wc, lk);
 	spinlock_acquire(lk);
+#if OPT_LOCKSTAT
+	lockstat_wchan(wc->wc_name, &sleepstart);
+#endif
+}
+
+int
+wchan_sleep_intr(struct wchan *wc, struct spinlock *lk)
+{
+	struct thread *cur = curthread;
+	bool exiting;
+
+	KASSERT(spinlock_do_i_hold(lk));
+
+	/*
+	 * Say where we'll be, then check for exit. proc_exit sets
+	 * p_exiting before it looks at our t_intrlk, so either it sees
+	 * us here or we see p_exiting.
+	 */
+	spinlock_acquire(&cur->t_intrlock);
+	if (cur->t_proc->p_exiting) {
+		spinlock_release(&cur->t_intrlock);
+		return EINTR;
+	}
+	cur->t_intrwc = wc;
+	cur->t_intrlk = lk;
+	spinlock_release(&cur->t_intrlock);
+
+	wchan_sleep(wc, lk);
+
+	spinlock_acquire(&cur->t_intrlock);
+	cur->t_intrwc = NULL;
+	cur->t_intrlk = NULL;
+	exiting = cur->t_proc->p_exiting;
+	spinlock_release(&cur->t_intrlock);
+
+	return exiting ? EINTR : 0;
 }
 
 /*
- * Wake up one thread sleeping on a wait channel.
+ * Wake up one thread sleeping on a wait channel. This is the
+ * highest-priority sleeper, or the one that has waited longest if
+ * there's a tie.
  */
 void
 wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 {
-	struct thread *target;
+	struct thread *target, *t;
 
 	KASSERT(spinlock_do_i_hold(lk));
 
-	/* Grab a thread from the channel */
-	target = threadlist_remhead(&wc->wc_threads);
+	/* Pick a thread from the channel */
+	target = NULL;
+	THREADLIST_FORALL(t, wc->wc_threads) {
+		if (target == NULL || t->t_pri > target->t_pri) {
+			target = t;
+		}
+	}
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
 		return;
 	}
+	threadlist_remove(&wc->wc_threads, target);
 
 	/*
 	 * Note that thread_make_runnable acquires a runqueue lock
@@ -1120,6 +1444,49 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Wake T out of an interruptible sleep, if it's in one.
+ *
+ * The sleeper takes its wchan's lock before t_intrlock, and we need
+ * them the other way around, so we only try for the wchan's lock. If
+ * we get it while T's fields point to it, T is either still on the
+ * wchan or already woken and waiting for that lock, and in both cases
+ * the lock and wchan are still there.
+ */
+bool
+thread_interrupt(struct thread *t)
+{
+	struct wchan *wc;
+	struct spinlock *lk;
+	struct thread *t2;
+
+	KASSERT(t != curthread);
+
+	spinlock_acquire(&t->t_intrlock);
+	wc = t->t_intrwc;
+	lk = t->t_intrlk;
+	if (lk == NULL) {
+		spinlock_release(&t->t_intrlock);
+		return true;
+	}
+	if (!spinlock_tryacquire(lk)) {
+		spinlock_release(&t->t_intrlock);
+		return false;
+	}
+
+	THREADLIST_FORALL(t2, wc->wc_threads) {
+		if (t2 == t) {
+			threadlist_remove(&wc->wc_threads, t);
+			thread_make_runnable(t, false);
+			break;
+		}
+	}
+
+	spinlock_release(lk);
+	spinlock_release(&t->t_intrlock);
+	return true;
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1152,6 +1519,10 @@ ipi_send(struct cpu *target, int code)
 	spinlock_acquire(&target->c_ipi_lock);
 	target->c_ipi_pending |= (uint32_t)1 << code;
 	mainbus_send_ipi(target);
+	if (code < CPUSTAT_NIPI) {
+		/* interrupts are off, so curcpu can't change under us */
+		curcpu->c_stat.cs_ipisent[code]++;
+	}
 	spinlock_release(&target->c_ipi_lock);
 }
 
@@ -1187,6 +1558,7 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
+	curcpu->c_stat.cs_ipisent[IPI_TLBSHOOTDOWN]++;
 
 	spinlock_release(&target->c_ipi_lock);
 }
@@ -1200,6 +1572,12 @@ interprocessor_interrupt(void)
 	spinlock_acquire(&curcpu->c_ipi_lock);
 	bits = curcpu->c_ipi_pending;
 
+	for (i=0; i<CPUSTAT_NIPI; i++) {
+		if (bits & (1U << i)) {
+			curcpu->c_stat.cs_ipirecv[i]++;
+		}
+	}
+
 	if (bits & (1U << IPI_PANIC)) {
 		/* panic on another cpu - just stop dead */
 		spinlock_release(&curcpu->c_ipi_lock);
@@ -0,0 +1,291 @@
+/*
+ * Workqueues. See workqueue.h.
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <workqueue.h>
+
+/* Worker threads per cpu. */
+#define WORKQUEUE_NTHREADS	2
+
+/* Most work items a worker takes off the queue at once. */
+#define WORKQUEUE_BATCH		16
+
+/*
+ * Longest delay, in ticks. Due times are compared as signed
+ * differences, so delays have to stay under 2^31 ticks.
+ */
+#define WORKQUEUE_MAXTICKS	0x7fffffff
+
+struct workqueue {
+	struct spinlock wq_lock;
+	struct wchan *wq_wchan;		/* Where idle workers sleep */
+	struct work *wq_head;		/* Ready to run */
+	struct work *wq_tail;
+	struct work *wq_delayed;	/* Waiting, sorted by w_due */
+};
+
+void
+work_init(struct work *w, void (*func)(void *), void *data)
+{
+	w->w_func = func;
+	w->w_data = data;
+	w->w_next = NULL;
+	w->w_due = 0;
+	w->w_queued = false;
+	w->w_wq = NULL;
+}
+
+/*
+ * Put W on the ready list and wake a worker. Queue lock must be held.
+ */
+static
+void
+workqueue_ready(struct workqueue *wq, struct work *w)
+{
+	KASSERT(spinlock_do_i_hold(&wq->wq_lock));
+
+	w->w_next = NULL;
+	if (wq->wq_tail == NULL) {
+		wq->wq_head = w;
+	}
+	else {
+		wq->wq_tail->w_next = w;
+	}
+	wq->wq_tail = w;
+	wchan_wakeone(wq->wq_wchan, &wq->wq_lock);
+}
+
+/*
+ * Common code for workqueue_enqueue and workqueue_enqueue_delayed.
+ * TICKS is the number of hardclocks to wait, or 0 to run at once.
+ */
+static
+bool
+workqueue_add(struct work *w, unsigned ticks)
+{
+	struct workqueue *wq;
+	struct work **wp;
+	int spl;
+
+	/* Stay on this cpu until we're done with its queue. */
+	spl = splhigh();
+	wq = curcpu->c_workqueue;
+	if (wq == NULL) {
+		splx(spl);
+		return false;
+	}
+
+	spinlock_acquire(&wq->wq_lock);
+	if (!w->w_queued) {
+		w->w_queued = true;
+		w->w_wq = wq;
+		if (ticks == 0) {
+			workqueue_ready(wq, w);
+		}
+		else {
+			w->w_due = curcpu->c_hardclocks + ticks;
+			for (wp = &wq->wq_delayed; *wp != NULL;
+			     wp = &(*wp)->w_next) {
+				if ((int)((*wp)->w_due - w->w_due) > 0) {
+					break;
+				}
+			}
+			w->w_next = *wp;
+			*wp = w;
+		}
+	}
+	spinlock_release(&wq->wq_lock);
+	splx(spl);
+	return true;
+}
+
+bool
+workqueue_enqueue(struct work *w)
+{
+	return workqueue_add(w, 0);
+}
+
+bool
+workqueue_enqueue_delayed(struct work *w, unsigned msecs)
+{
+	uint64_t ticks;
+
+	/* In 64 bits; msecs * HZ overflows 32 after about 12 hours. */
+	ticks = DIVROUNDUP((uint64_t)msecs * HZ, 1000);
+	if (ticks == 0) {
+		ticks = 1;
+	}
+	if (ticks > WORKQUEUE_MAXTICKS) {
+		ticks = WORKQUEUE_MAXTICKS;
+	}
+	return workqueue_add(w, (unsigned)ticks);
+}
+
+bool
+workqueue_cancel(struct work *w)
+{
+	struct workqueue *wq;
+	struct work **wp, *prev;
+	bool queued;
+
+	wq = w->w_wq;
+	if (wq == NULL) {
+		/* never queued */
+		return false;
+	}
+
+	spinlock_acquire(&wq->wq_lock);
+	queued = w->w_queued;
+	if (queued) {
+		/* Usually it's still waiting, but it may have come due. */
+		for (wp = &wq->wq_delayed; *wp != NULL && *wp != w;
+		     wp = &(*wp)->w_next) {
+			/* nothing */
+		}
+		if (*wp == NULL) {
+			prev = NULL;
+			for (wp = &wq->wq_head; *wp != w; wp = &(*wp)->w_next) {
+				KASSERT(*wp != NULL);
+				prev = *wp;
+			}
+			if (wq->wq_tail == w) {
+				wq->wq_tail = prev;
+			}
+		}
+		*wp = w->w_next;
+		w->w_next = NULL;
+		w->w_queued = false;
+	}
+	spinlock_release(&wq->wq_lock);
+	return queued;
+}
+
+/*
+ * Move delayed work that has come due to the ready list. Called from
+ * hardclock, so interrupts are already off.
+ */
+void
+workqueue_hardclock(void)
+{
+	struct workqueue *wq;
+	struct work *w;
+
+	wq = curcpu->c_workqueue;
+	if (wq == NULL || wq->wq_delayed == NULL) {
+		/* Unlocked peek; we'll see it next tick if we missed it. */
+		return;
+	}
+
+	spinlock_acquire(&wq->wq_lock);
+	while ((w = wq->wq_delayed) != NULL &&
+	       (int)(curcpu->c_hardclocks - w->w_due) >= 0) {
+		wq->wq_delayed = w->w_next;
+		workqueue_ready(wq, w);
+	}
+	spinlock_release(&wq->wq_lock);
+}
+
+/*
+ * Worker thread. Takes a batch of items off the queue under one
+ * acquisition of the queue lock, then runs them without it. Each item
+ * is marked not queued before it runs, so it can be enqueued again
+ * (even by its own function) while it's running.
+ */
+static
+void
+workqueue_thread(void *data1, unsigned long data2)
+{
+	struct workqueue *wq = data1;
+	void (*funcs[WORKQUEUE_BATCH])(void *);
+	void *datas[WORKQUEUE_BATCH];
+	struct work *w;
+	unsigned i, n;
+
+	(void)data2;
+
+	spinlock_acquire(&wq->wq_lock);
+	while (1) {
+		while (wq->wq_head == NULL) {
+			wchan_sleep(wq->wq_wchan, &wq->wq_lock);
+		}
+
+		n = 0;
+		while (n < WORKQUEUE_BATCH && (w = wq->wq_head) != NULL) {
+			wq->wq_head = w->w_next;
+			if (wq->wq_head == NULL) {
+				wq->wq_tail = NULL;
+			}
+			w->w_next = NULL;
+			w->w_queued = false;
+			funcs[n] = w->w_func;
+			datas[n] = w->w_data;
+			n++;
+		}
+		spinlock_release(&wq->wq_lock);
+
+		for (i=0; i<n; i++) {
+			funcs[i](datas[i]);
+		}
+
+		spinlock_acquire(&wq->wq_lock);
+	}
+}
+
+/*
+ * Create the queue and worker threads for cpu C.
+ */
+static
+void
+workqueue_create(struct cpu *c)
+{
+	struct workqueue *wq;
+	char name[32];
+	unsigned i;
+	int result;
+
+	wq = kmalloc(sizeof(*wq));
+	if (wq == NULL) {
+		panic("workqueue_create: Out of memory\n");
+	}
+	snprintf(name, sizeof(name), "workqueue %u", c->c_number);
+	wq->wq_wchan = wchan_create(name);
+	if (wq->wq_wchan == NULL) {
+		panic("workqueue_create: wchan_create failed\n");
+	}
+	spinlock_init(&wq->wq_lock);
+	wq->wq_head = wq->wq_tail = NULL;
+	wq->wq_delayed = NULL;
+
+	for (i=0; i<WORKQUEUE_NTHREADS; i++) {
+		snprintf(name, sizeof(name), "worker %u/%u", c->c_number, i);
+		result = thread_fork_oncpu(name, c, workqueue_thread, wq, i);
+		if (result) {
+			panic("workqueue_create: thread_fork_oncpu: %s\n",
+			      strerror(result));
+		}
+	}
+
+	/* Publish it only once there are threads to run the work. */
+	membar_store_store();
+	c->c_workqueue = wq;
+}
+
+void
+workqueue_bootstrap(void)
+{
+	struct cpu *c;
+	unsigned i;
+
+	for (i=0; (c = cpu_get(i)) != NULL; i++) {
+		workqueue_create(c);
+	}
+}
@@ -0,0 +1,461 @@
+/*
+ * Pipes. See pipe.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/poll.h>
+#include <kern/stat.h>
+#include <limits.h>
+#include <lib.h>
+#include <stat.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <poll.h>
+#include <pipe.h>
+
+/*
+ * The ring buffer is indexed with free-running counters: p_rpos is
+ * how much has ever been read and p_wpos how much has ever been
+ * written, so the amount buffered is p_wpos - p_rpos and the buffer
+ * index is the counter mod PIPE_SIZE. Everything is under p_lock.
+ *
+ * Wakeups are batched. A writer signals readers once, when it's
+ * done, or when the ring fills and it has to wait; not after every
+ * chunk. A reader only wakes writers once at least half the ring is
+ * free, so a writer blocked on a full pipe goes back to sleep less
+ * often and moves a good amount each time it runs. (A reader only
+ * waits on an empty ring, which is more than half free, so a writer
+ * can't be left asleep with a reader asleep too.) Threads in poll()
+ * are poked on the same occasions.
+ */
+struct pipe {
+	struct lock *p_lock;
+	struct cv *p_readcv;		/* readers wait for data */
+	struct cv *p_writecv;		/* writers wait for space */
+	char *p_buf;
+	unsigned p_rpos;
+	unsigned p_wpos;
+	unsigned p_writewaiters;	/* writers asleep on p_writecv */
+	bool p_readopen;		/* read end not yet reclaimed */
+	bool p_writeopen;		/* write end not yet reclaimed */
+	struct pollhead p_pollhead;	/* poll()ers on either end */
+	struct vnode p_readvn;
+	struct vnode p_writevn;
+};
+
+#define PIPE_LOWATER	(PIPE_SIZE / 2)
+
+static
+unsigned
+pipe_used(struct pipe *p)
+{
+	return p->p_wpos - p->p_rpos;
+}
+
+/*
+ * Poke any threads polling the pipe. Hooks only go on under p_lock,
+ * which we hold, so it's safe to skip the call when there are none.
+ */
+static
+void
+pipe_pollwakeup(struct pipe *p)
+{
+	KASSERT(lock_do_i_hold(p->p_lock));
+	if (p->p_pollhead.ph_hooks != NULL) {
+		pollwakeup(&p->p_pollhead);
+	}
+}
+
+/*
+ * Move up to LEN bytes between the ring, at counter POS, and UIO,
+ * in at most two pieces since the ring may wrap.
+ */
+static
+int
+pipe_uiomove(struct pipe *p, unsigned pos, size_t len, struct uio *uio)
+{
+	unsigned ix, chunk;
+	int result;
+
+	while (len > 0) {
+		ix = pos % PIPE_SIZE;
+		chunk = PIPE_SIZE - ix;
+		if (chunk > len) {
+			chunk = len;
+		}
+		result = uiomove(p->p_buf + ix, chunk, uio);
+		if (result) {
+			return result;
+		}
+		pos += chunk;
+		len -= chunk;
+	}
+	return 0;
+}
+
+/*
+ * Free a pipe, after both ends are gone.
+ */
+static
+void
+pipe_destroy(struct pipe *p)
+{
+	kfree(p->p_buf);
+	pollhead_cleanup(&p->p_pollhead);
+	cv_destroy(p->p_writecv);
+	cv_destroy(p->p_readcv);
+	lock_destroy(p->p_lock);
+	kfree(p);
+}
+
+////////////////////////////////////////////////////////////
+// vnode operations
+
+static
+int
+pipe_eachopen(struct vnode *vn, int openflags)
+{
+	/* pipes only come from pipe(), never from open() */
+	(void)vn;
+	(void)openflags;
+	return EINVAL;
+}
+
+/*
+ * An end is closed for good. Tell the other side, and free the pipe
+ * if it's the second end.
+ */
+static
+int
+pipe_reclaim(struct vnode *vn)
+{
+	struct pipe *p = vn->vn_data;
+	bool destroy;
+
+	lock_acquire(p->p_lock);
+	if (vn == &p->p_readvn) {
+		p->p_readopen = false;
+		/* writers get EPIPE now */
+		cv_broadcast(p->p_writecv, p->p_lock);
+	}
+	else {
+		KASSERT(vn == &p->p_writevn);
+		p->p_writeopen = false;
+		/* readers get EOF once the ring drains */
+		cv_broadcast(p->p_readcv, p->p_lock);
+	}
+	pipe_pollwakeup(p);
+	/* before unlocking, or the other end might free it under us */
+	vnode_cleanup(vn);
+	destroy = !p->p_readopen && !p->p_writeopen;
+	lock_release(p->p_lock);
+
+	if (destroy) {
+		pipe_destroy(p);
+	}
+	return 0;
+}
+
+/*
+ * Read: wait until there's data (or no writer), then take as much as
+ * is there, up to the size asked for. Doesn't wait to fill the whole
+ * request.
+ */
+static
+int
+pipe_read(struct vnode *vn, struct uio *uio)
+{
+	struct pipe *p = vn->vn_data;
+	size_t len;
+	int result;
+
+	if (vn != &p->p_readvn) {
+		return EINVAL;
+	}
+
+	lock_acquire(p->p_lock);
+	while (pipe_used(p) == 0 && p->p_writeopen) {
+		result = cv_wait_intr(p->p_readcv, p->p_lock);
+		if (result) {
+			/* process is exiting */
+			lock_release(p->p_lock);
+			return result;
+		}
+	}
+
+	len = pipe_used(p);
+	if (len > uio->uio_resid) {
+		len = uio->uio_resid;
+	}
+	result = pipe_uiomove(p, p->p_rpos, len, uio);
+	if (result == 0) {
+		p->p_rpos += len;
+	}
+
+	if (PIPE_SIZE - pipe_used(p) >= PIPE_LOWATER) {
+		if (p->p_writewaiters > 0) {
+			cv_broadcast(p->p_writecv, p->p_lock);
+		}
+		if (len > 0) {
+			pipe_pollwakeup(p);
+		}
+	}
+	lock_release(p->p_lock);
+	return result;
+}
+
+/*
+ * Write: put everything into the ring, waiting for space as needed.
+ * A write of up to PIPE_BUF bytes goes in all at once, so it isn't
+ * interleaved with other writers' data.
+ */
+static
+int
+pipe_write(struct vnode *vn, struct uio *uio)
+{
+	struct pipe *p = vn->vn_data;
+	size_t len, room, want;
+	bool wrote;
+	int result;
+
+	if (vn != &p->p_writevn) {
+		return EINVAL;
+	}
+
+	want = uio->uio_resid <= PIPE_BUF ? uio->uio_resid : 1;
+	wrote = false;
+	result = 0;
+
+	lock_acquire(p->p_lock);
+	while (uio->uio_resid > 0) {
+		if (!p->p_readopen) {
+			/* report a short write if we got anywhere */
+			result = wrote ? 0 : EPIPE;
+			break;
+		}
+		room = PIPE_SIZE - pipe_used(p);
+		if (room < want) {
+			/* full: let readers at what's there first */
+			cv_broadcast(p->p_readcv, p->p_lock);
+			pipe_pollwakeup(p);
+			p->p_writewaiters++;
+			result = cv_wait_intr(p->p_writecv, p->p_lock);
+			p->p_writewaiters--;
+			if (result) {
+				/* process is exiting */
+				break;
+			}
+			continue;
+		}
+
+		len = uio->uio_resid < room ? uio->uio_resid : room;
+		result = pipe_uiomove(p, p->p_wpos, len, uio);
+		if (result) {
+			break;
+		}
+		p->p_wpos += len;
+		wrote = true;
+	}
+	if (wrote) {
+		cv_broadcast(p->p_readcv, p->p_lock);
+		pipe_pollwakeup(p);
+	}
+	lock_release(p->p_lock);
+	return result;
+}
+
+/*
+ * Poll. The read end is readable when there's data, or once the
+ * write end is gone (POLLHUP; reads get EOF). The write end is
+ * writable when at least half the ring is free, which is the same
+ * point a blocked writer is woken at, and gets POLLERR once the read
+ * end is gone.
+ */
+static
+int
+pipe_poll(struct vnode *vn, int events, struct pollwaiter *pw)
+{
+	struct pipe *p = vn->vn_data;
+	int revents;
+
+	revents = 0;
+
+	lock_acquire(p->p_lock);
+	pollwait(&p->p_pollhead, pw);
+	if (vn == &p->p_readvn) {
+		if (pipe_used(p) > 0) {
+			revents |= events & POLLIN;
+		}
+		if (!p->p_writeopen) {
+			revents |= POLLHUP | (events & POLLIN);
+		}
+	}
+	else {
+		if (!p->p_readopen) {
+			revents |= POLLERR;
+		}
+		else if (PIPE_SIZE - pipe_used(p) >= PIPE_LOWATER) {
+			revents |= events & POLLOUT;
+		}
+	}
+	lock_release(p->p_lock);
+
+	return revents;
+}
+
+static
+int
+pipe_ioctl(struct vnode *vn, int op, userptr_t data)
+{
+	(void)vn;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+static
+int
+pipe_stat(struct vnode *vn, struct stat *statbuf)
+{
+	struct pipe *p = vn->vn_data;
+
+	bzero(statbuf, sizeof(*statbuf));
+
+	lock_acquire(p->p_lock);
+	statbuf->st_size = pipe_used(p);
+	lock_release(p->p_lock);
+
+	statbuf->st_mode = S_IFIFO | 0600;
+	statbuf->st_blksize = PIPE_SIZE;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *vn, mode_t *ret)
+{
+	(void)vn;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+bool
+pipe_isseekable(struct vnode *vn)
+{
+	(void)vn;
+	return false;
+}
+
+static
+int
+pipe_fsync(struct vnode *vn)
+{
+	(void)vn;
+	return EINVAL;
+}
+
+static
+int
+pipe_truncate(struct vnode *vn, off_t len)
+{
+	(void)vn;
+	(void)len;
+	return EINVAL;
+}
+
+static const struct vnode_ops pipe_vnode_ops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = pipe_eachopen,
+	.vop_reclaim = pipe_reclaim,
+
+	.vop_read = pipe_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_write = pipe_write,
+	.vop_ioctl = pipe_ioctl,
+	.vop_stat = pipe_stat,
+	.vop_gettype = pipe_gettype,
+	.vop_isseekable = pipe_isseekable,
+	.vop_fsync = pipe_fsync,
+	.vop_mmap = vopfail_mmap_perm,
+	.vop_truncate = pipe_truncate,
+	.vop_namefile = vopfail_uio_notdir,
+	.vop_poll = pipe_poll,
+
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+////////////////////////////////////////////////////////////
+// constructor
+
+int
+pipe_create(struct vnode **readvn_ret, struct vnode **writevn_ret)
+{
+	struct pipe *p;
+	int result;
+
+	p = kmalloc(sizeof(*p));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	p->p_buf = kmalloc(PIPE_SIZE);
+	if (p->p_buf == NULL) {
+		goto fail_p;
+	}
+	p->p_lock = lock_create("pipe");
+	if (p->p_lock == NULL) {
+		goto fail_buf;
+	}
+	p->p_readcv = cv_create("pipe-read");
+	if (p->p_readcv == NULL) {
+		goto fail_lock;
+	}
+	p->p_writecv = cv_create("pipe-write");
+	if (p->p_writecv == NULL) {
+		goto fail_readcv;
+	}
+	p->p_rpos = 0;
+	p->p_wpos = 0;
+	p->p_writewaiters = 0;
+	p->p_readopen = true;
+	p->p_writeopen = true;
+	pollhead_init(&p->p_pollhead);
+
+	result = vnode_init(&p->p_readvn, &pipe_vnode_ops, NULL, p);
+	if (result) {
+		goto fail_pollhead;
+	}
+	result = vnode_init(&p->p_writevn, &pipe_vnode_ops, NULL, p);
+	if (result) {
+		vnode_cleanup(&p->p_readvn);
+		goto fail_pollhead;
+	}
+
+	*readvn_ret = &p->p_readvn;
+	*writevn_ret = &p->p_writevn;
+	return 0;
+
+fail_pollhead:
+	pollhead_cleanup(&p->p_pollhead);
+	cv_destroy(p->p_writecv);
+fail_readcv:
+	cv_destroy(p->p_readcv);
+fail_lock:
+	lock_destroy(p->p_lock);
+fail_buf:
+	kfree(p->p_buf);
+fail_p:
+	kfree(p);
+	return ENOMEM;
+}
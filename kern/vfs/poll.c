@@ -0,0 +1,206 @@
+/*
+ * Wait queues for poll() and select(). See poll.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <workqueue.h>
+#include <poll.h>
+
+/*
+ * One waiter belongs to one poll() call. Its timeout is a delayed
+ * work item; when the poll is done early the item is cancelled, and
+ * if it's too late for that, because a worker is already running it,
+ * the poller waits for it to set pw_timedout before freeing the
+ * waiter.
+ *
+ * pw_woken and pw_timedout are under pw_lock. The hooks are only
+ * touched by the poller, except that their hk_next links belong to
+ * the pollhead they're on.
+ */
+struct pollwaiter {
+	struct spinlock pw_lock;
+	struct wchan *pw_wchan;
+	bool pw_woken;			/* a pollhead fired since clear */
+	bool pw_timedout;		/* the timeout went off */
+	bool pw_hastimeout;		/* pw_timeout was queued */
+	struct work pw_timeout;
+	unsigned pw_nhooks;
+	unsigned pw_maxhooks;
+	struct pollhook pw_hooks[];
+};
+
+////////////////////////////////////////////////////////////
+// pollheads
+
+void
+pollhead_init(struct pollhead *ph)
+{
+	spinlock_init(&ph->ph_lock);
+	ph->ph_hooks = NULL;
+}
+
+void
+pollhead_cleanup(struct pollhead *ph)
+{
+	KASSERT(ph->ph_hooks == NULL);
+	spinlock_cleanup(&ph->ph_lock);
+}
+
+void
+pollwait(struct pollhead *ph, struct pollwaiter *pw)
+{
+	struct pollhook *hk;
+
+	if (pw == NULL) {
+		return;
+	}
+
+	KASSERT(pw->pw_nhooks < pw->pw_maxhooks);
+	hk = &pw->pw_hooks[pw->pw_nhooks++];
+	hk->hk_head = ph;
+	hk->hk_waiter = pw;
+
+	spinlock_acquire(&ph->ph_lock);
+	hk->hk_next = ph->ph_hooks;
+	ph->ph_hooks = hk;
+	spinlock_release(&ph->ph_lock);
+}
+
+void
+pollwakeup(struct pollhead *ph)
+{
+	struct pollhook *hk;
+	struct pollwaiter *pw;
+
+	spinlock_acquire(&ph->ph_lock);
+	for (hk = ph->ph_hooks; hk != NULL; hk = hk->hk_next) {
+		pw = hk->hk_waiter;
+		spinlock_acquire(&pw->pw_lock);
+		pw->pw_woken = true;
+		wchan_wakeall(pw->pw_wchan, &pw->pw_lock);
+		spinlock_release(&pw->pw_lock);
+	}
+	spinlock_release(&ph->ph_lock);
+}
+
+////////////////////////////////////////////////////////////
+// waiters
+
+/*
+ * Timeout, run from the workqueue. Once it lets go of pw_lock it
+ * doesn't touch PW again; pollwaiter_destroy relies on that.
+ */
+static
+void
+pollwaiter_timeout(void *data)
+{
+	struct pollwaiter *pw = data;
+
+	spinlock_acquire(&pw->pw_lock);
+	pw->pw_timedout = true;
+	wchan_wakeall(pw->pw_wchan, &pw->pw_lock);
+	spinlock_release(&pw->pw_lock);
+}
+
+struct pollwaiter *
+pollwaiter_create(unsigned maxhooks, int msecs)
+{
+	struct pollwaiter *pw;
+
+	pw = kmalloc(sizeof(*pw) + maxhooks * sizeof(pw->pw_hooks[0]));
+	if (pw == NULL) {
+		return NULL;
+	}
+	pw->pw_wchan = wchan_create("poll");
+	if (pw->pw_wchan == NULL) {
+		kfree(pw);
+		return NULL;
+	}
+	spinlock_init(&pw->pw_lock);
+	pw->pw_woken = false;
+	pw->pw_timedout = false;
+	pw->pw_hastimeout = false;
+	work_init(&pw->pw_timeout, pollwaiter_timeout, pw);
+	pw->pw_nhooks = 0;
+	pw->pw_maxhooks = maxhooks;
+
+	if (msecs >= 0) {
+		if (workqueue_enqueue_delayed(&pw->pw_timeout, msecs)) {
+			pw->pw_hastimeout = true;
+		}
+		else {
+			/* no workers yet (can't happen from a syscall) */
+			pw->pw_timedout = true;
+		}
+	}
+	return pw;
+}
+
+void
+pollwaiter_destroy(struct pollwaiter *pw)
+{
+	struct pollhook *hk, **hkp;
+	struct pollhead *ph;
+	unsigned i;
+
+	for (i=0; i<pw->pw_nhooks; i++) {
+		hk = &pw->pw_hooks[i];
+		ph = hk->hk_head;
+
+		spinlock_acquire(&ph->ph_lock);
+		for (hkp = &ph->ph_hooks; *hkp != hk; hkp = &(*hkp)->hk_next) {
+			KASSERT(*hkp != NULL);
+		}
+		*hkp = hk->hk_next;
+		spinlock_release(&ph->ph_lock);
+	}
+	pw->pw_nhooks = 0;
+
+	if (pw->pw_hastimeout && !workqueue_cancel(&pw->pw_timeout)) {
+		/*
+		 * A worker has the timeout; wait for it to finish. It
+		 * drops pw_lock last, so once we have the lock and see
+		 * pw_timedout, it's done with PW.
+		 */
+		spinlock_acquire(&pw->pw_lock);
+		while (!pw->pw_timedout) {
+			wchan_sleep(pw->pw_wchan, &pw->pw_lock);
+		}
+		spinlock_release(&pw->pw_lock);
+	}
+
+	wchan_destroy(pw->pw_wchan);
+	spinlock_cleanup(&pw->pw_lock);
+	kfree(pw);
+}
+
+void
+pollwaiter_clear(struct pollwaiter *pw)
+{
+	spinlock_acquire(&pw->pw_lock);
+	pw->pw_woken = false;
+	spinlock_release(&pw->pw_lock);
+}
+
+int
+pollwaiter_sleep(struct pollwaiter *pw)
+{
+	int result;
+
+	result = 0;
+	spinlock_acquire(&pw->pw_lock);
+	while (!pw->pw_woken && !pw->pw_timedout) {
+		result = wchan_sleep_intr(pw->pw_wchan, &pw->pw_lock);
+		if (result) {
+			break;
+		}
+	}
+	if (result == 0 && !pw->pw_woken) {
+		result = ETIMEDOUT;
+	}
+	spinlock_release(&pw->pw_lock);
+	return result;
+}
@@ -29,6 +29,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/poll.h>
 #include <vnode.h>
 
 /*
@@ -262,3 +263,14 @@ vopfail_lookparent_notdir(struct vnode *vn, char *path, struct vnode **result,
 	return ENOTDIR;
 }
 
+
+////////////////////////////////////////////////////////////
+// poll (not a failure, but a stub all the same)
+
+int
+vopready_poll(struct vnode *vn, int events, struct pollwaiter *pw)
+{
+	(void)vn;
+	(void)pw;
+	return events & (POLLIN | POLLOUT);
+}
@@ -39,6 +39,7 @@
 #include <lib.h>
 #include <array.h>
 #include <synch.h>
+#include <rcu.h>
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
@@ -85,7 +86,22 @@ struct knowndev {
 DECLARRAY(knowndev, static __UNUSED inline);
 DEFARRAY(knowndev, static __UNUSED inline);
 
-static struct knowndevarray *knowndevs;
+/*
+ * The device table. Everything that changes it (adding devices,
+ * mounting, unmounting) holds vfs_biglock. Lookups that hold
+ * vfs_biglock anyway can just look; others use RCU and take no lock.
+ *
+ * For that to work the array is never changed in place: vfs_doadd
+ * builds a new copy with the new entry, publishes it, and frees the
+ * old one after a grace period. The knowndev structures themselves
+ * are never freed; mount and unmount only change kd_fs.
+ */
+struct knowndevtab {
+	struct knowndevarray kt_devs;
+	struct rcu_head kt_rcu;
+};
+
+static struct knowndevtab *volatile knowndevs;
 
 /* The big lock for all FS ops. Remove for filesystem assignment. */
 static struct lock *vfs_biglock;
@@ -98,10 +114,11 @@ static unsigned vfs_biglock_depth;
 void
 vfs_bootstrap(void)
 {
-	knowndevs = knowndevarray_create();
+	knowndevs = kmalloc(sizeof(struct knowndevtab));
 	if (knowndevs==NULL) {
 		panic("vfs: Could not create knowndevs array\n");
 	}
+	knowndevarray_init(&knowndevs->kt_devs);
 
 	vfs_biglock = lock_create("vfs_biglock");
 	if (vfs_biglock==NULL) {
@@ -157,9 +174,9 @@ vfs_sync(void)
 
 	vfs_biglock_acquire();
 
-	num = knowndevarray_num(knowndevs);
+	num = knowndevarray_num(&knowndevs->kt_devs);
 	for (i=0; i<num; i++) {
-		dev = knowndevarray_get(knowndevs, i);
+		dev = knowndevarray_get(&knowndevs->kt_devs, i);
 		if (dev->kd_fs != NULL) {
 			/*result =*/ FSOP_SYNC(dev->kd_fs);
 		}
@@ -171,20 +188,21 @@ vfs_sync(void)
 }
 
 /*
- * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
- * back an appropriate vnode.
+ * Search the device list for vfs_getroot. Should already hold
+ * vfs_biglock.
  */
+static
 int
-vfs_getroot(const char *devname, struct vnode **result)
+findroot(const char *devname, struct vnode **result)
 {
 	struct knowndev *kd;
 	unsigned i, num;
 
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
+	num = knowndevarray_num(&knowndevs->kt_devs);
 	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
+		kd = knowndevarray_get(&knowndevs->kt_devs, i);
 
 		/*
 		 * If this device has a mounted filesystem, and
@@ -251,22 +269,36 @@ vfs_getroot(const char *devname, struct vnode **result)
 	return ENODEV;
 }
 
+/*
+ * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
+ * back an appropriate vnode. The caller holds vfs_biglock (this is
+ * only used by name lookup), which keeps the table from changing.
+ */
+int
+vfs_getroot(const char *devname, struct vnode **result)
+{
+	return findroot(devname, result);
+}
+
 /*
  * Given a filesystem, hand back the name of the device it's mounted on.
  */
 const char *
 vfs_getdevname(struct fs *fs)
 {
+	struct knowndevtab *tab;
 	struct knowndev *kd;
+	const char *name = NULL;
 	unsigned i, num;
 
 	KASSERT(fs != NULL);
 
-	KASSERT(vfs_biglock_do_i_hold());
+	rcu_read_lock();
+	tab = knowndevs;
 
-	num = knowndevarray_num(knowndevs);
+	num = knowndevarray_num(&tab->kt_devs);
 	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
+		kd = knowndevarray_get(&tab->kt_devs, i);
 
 		if (kd->kd_fs == fs) {
 			/*
@@ -275,11 +307,14 @@ vfs_getdevname(struct fs *fs)
 			 * the fs cannot go away, and the device can't
 			 * go away until the fs goes away.
 			 */
-			return kd->kd_name;
+			name = kd->kd_name;
+			break;
 		}
 	}
 
-	return NULL;
+	rcu_read_unlock();
+
+	return name;
 }
 
 /*
@@ -341,9 +376,9 @@ badnames(const char *n1, const char *n2, const char *n3)
 
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
+	num = knowndevarray_num(&knowndevs->kt_devs);
 	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
+		kd = knowndevarray_get(&knowndevs->kt_devs, i);
 
 		if (kd->kd_fs) {
 			volname = FSOP_GETVOLNAME(kd->kd_fs);
@@ -361,6 +396,60 @@ badnames(const char *n1, const char *n2, const char *n3)
 	return 0;
 }
 
+/*
+ * Free a device table that has been replaced. Called via call_rcu.
+ */
+static
+void
+knowndevtab_free(void *data)
+{
+	struct knowndevtab *tab = data;
+
+	knowndevarray_setsize(&tab->kt_devs, 0);
+	knowndevarray_cleanup(&tab->kt_devs);
+	kfree(tab);
+}
+
+/*
+ * Replace the device table with a copy that has KD added at the end.
+ */
+static
+int
+knowndevtab_add(struct knowndev *kd, unsigned *index_ret)
+{
+	struct knowndevtab *old, *new;
+	unsigned i, num;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	old = knowndevs;
+	num = knowndevarray_num(&old->kt_devs);
+
+	new = kmalloc(sizeof(struct knowndevtab));
+	if (new == NULL) {
+		return ENOMEM;
+	}
+	knowndevarray_init(&new->kt_devs);
+	result = knowndevarray_setsize(&new->kt_devs, num + 1);
+	if (result) {
+		knowndevarray_cleanup(&new->kt_devs);
+		kfree(new);
+		return result;
+	}
+	for (i=0; i<num; i++) {
+		knowndevarray_set(&new->kt_devs, i,
+				  knowndevarray_get(&old->kt_devs, i));
+	}
+	knowndevarray_set(&new->kt_devs, num, kd);
+
+	rcu_assign(knowndevs, new);
+	call_rcu(&old->kt_rcu, knowndevtab_free, old);
+
+	*index_ret = num;
+	return 0;
+}
+
 /*
  * Add a new device to the VFS layer's device table.
  *
@@ -417,7 +506,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		return EEXIST;
 	}
 
-	result = knowndevarray_add(knowndevs, kd, &index);
+	result = knowndevtab_add(kd, &index);
 
 	if (result == 0 && dev != NULL) {
 		/* use index+1 as the device number, so 0 is reserved */
@@ -471,7 +560,7 @@ vfs_addfs(const char *devname, struct fs *fs)
 
 /*
  * Look for a mountable device named DEVNAME.
- * Should already hold knowndevs_lock.
+ * Should already hold vfs_biglock.
  */
 static
 int
@@ -483,9 +572,9 @@ findmount(const char *devname, struct knowndev **result)
 
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
+	num = knowndevarray_num(&knowndevs->kt_devs);
 	for (i=0; !found && i<num; i++) {
-		dev = knowndevarray_get(knowndevs, i);
+		dev = knowndevarray_get(&knowndevs->kt_devs, i);
 		if (dev->kd_rawname==NULL) {
 			/* not mountable/unmountable */
 			continue;
@@ -607,9 +696,9 @@ vfs_unmountall(void)
 
 	vfs_biglock_acquire();
 
-	num = knowndevarray_num(knowndevs);
+	num = knowndevarray_num(&knowndevs->kt_devs);
 	for (i=0; i<num; i++) {
-		dev = knowndevarray_get(knowndevs, i);
+		dev = knowndevarray_get(&knowndevs->kt_devs, i);
 		if (dev->kd_rawname == NULL) {
 			/* not mountable/unmountable */
 			continue;
@@ -193,3 +193,37 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_define_threadstack(struct addrspace *as, unsigned slot, vaddr_t *stackptr)
+{
+	/*
+	 * The stack region for each slot is fixed, so there's
+	 * nothing to record here yet; faults below USERSTACK are
+	 * stack faults.
+	 */
+
+	(void)as;
+
+	if (slot >= USERTHREADSTACK_MAX) {
+		return EINVAL;
+	}
+	*stackptr = USERTHREADSTACK_TOP -
+		slot * USERTHREADSTACK_PAGES * PAGE_SIZE;
+
+	return 0;
+}
+
+void *
+as_map_stack(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	/*
+	 * Write this if the stack's pages can be reached from the
+	 * kernel; until then execv stages the argv in the kernel.
+	 */
+
+	(void)as;
+	(void)vaddr;
+	(void)len;
+
+	return NULL;
+}
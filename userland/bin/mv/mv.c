@@ -28,27 +28,68 @@
  */
 
 #include <unistd.h>
+#include <errno.h>
 #include <err.h>
 
 /*
  * mv - move (rename) files.
  * Usage: mv oldfile newfile
  *
- * Just calls rename() on them. If it fails, we don't attempt to
- * figure out which filename was wrong or what happened.
+ * Calls rename() on them. If that fails because the two names are on
+ * different filesystems, falls back to copying the file (in the
+ * kernel, with copy_file_range) and removing the old one, as Unix mv
+ * does. For other failures, we don't attempt to figure out which
+ * filename was wrong or what happened.
  *
- * In certain circumstances, Unix mv will fall back to copying and
- * deleting the old copy. We don't do that.
- *
- * We also don't allow the Unix form of
+ * We don't allow the Unix form of
  *     mv file1 file2 file3 destination-dir
  */
 
+/* Most to ask the kernel to copy at once. */
+#define COPYCHUNK (1024*1024)
+
+static
+void
+docopy(const char *oldfile, const char *newfile)
+{
+	int oldfd, newfd;
+	ssize_t len;
+
+	oldfd = open(oldfile, O_RDONLY);
+	if (oldfd < 0) {
+		err(1, "%s", oldfile);
+	}
+	newfd = open(newfile, O_WRONLY|O_CREAT|O_TRUNC);
+	if (newfd < 0) {
+		err(1, "%s", newfile);
+	}
+	while ((len = copy_file_range(oldfd, NULL, newfd, NULL,
+				      COPYCHUNK, 0)) > 0) {
+		/* nothing */
+	}
+	if (len < 0) {
+		err(1, "%s to %s", oldfile, newfile);
+	}
+	if (close(oldfd) < 0) {
+		err(1, "%s: close", oldfile);
+	}
+	if (close(newfd) < 0) {
+		err(1, "%s: close", newfile);
+	}
+	if (remove(oldfile)) {
+		err(1, "%s", oldfile);
+	}
+}
+
 static
 void
 dorename(const char *oldfile, const char *newfile)
 {
 	if (rename(oldfile, newfile)) {
+		if (errno == EXDEV) {
+			docopy(oldfile, newfile);
+			return;
+		}
 		err(1, "%s or %s", oldfile, newfile);
 	}
 }
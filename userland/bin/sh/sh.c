@@ -355,19 +355,64 @@ static struct {
 	{ NULL, NULL }
 };
 
+/*
+ * spawnstage
+ * starts one command of a pipeline, with INFD as its standard input
+ * and OUTFD as its standard output (either may be -1 to leave it
+ * alone). CLOSEFD, if not -1, is another pipe end the shell holds
+ * that the command shouldn't inherit.
+ */
+static
+pid_t
+spawnstage(char **args, int infd, int outfd, int closefd)
+{
+	struct spawn_action actions[5];
+	unsigned n = 0;
+
+	if (infd >= 0) {
+		actions[n].sa_op = SPAWN_DUP2;
+		actions[n].sa_fd = infd;
+		actions[n].sa_newfd = STDIN_FILENO;
+		n++;
+		actions[n].sa_op = SPAWN_CLOSE;
+		actions[n].sa_fd = infd;
+		n++;
+	}
+	if (outfd >= 0) {
+		actions[n].sa_op = SPAWN_DUP2;
+		actions[n].sa_fd = outfd;
+		actions[n].sa_newfd = STDOUT_FILENO;
+		n++;
+		actions[n].sa_op = SPAWN_CLOSE;
+		actions[n].sa_fd = outfd;
+		n++;
+	}
+	if (closefd >= 0) {
+		actions[n].sa_op = SPAWN_CLOSE;
+		actions[n].sa_fd = closefd;
+		n++;
+	}
+	return spawnp(args[0], args, actions, n);
+}
+
 /*
  * docommand
  * tokenizes the command line using strtok.  if there aren't any commands,
  * simply returns.  checks to see if it's a builtin, running it if it is.
  * otherwise, it's a standard command.  check for the '&', try to background
- * the job if possible, otherwise just run it and wait on it.
+ * the job if possible, otherwise just run it and wait on it.  commands
+ * separated by '|' are run as a pipeline, connected with pipes, and the
+ * last one's exit status is the result.
  */
 static
 void
 docommand(char *buf, struct exitinfo *ei)
 {
 	char *args[NARG_MAX + 1];
-	int nargs, i;
+	char **stages[NARG_MAX / 2 + 1];
+	pid_t pids[NARG_MAX / 2 + 1];
+	int nargs, nstages, i;
+	int infd, fds[2];
 	char *s;
 	pid_t pid;
 	int status;
@@ -417,32 +462,93 @@ docommand(char *buf, struct exitinfo *ei)
 		bg = 1;
 	}
 
+	/*
+	 * split into pipeline stages at each "|". Refusing empty stages
+	 * as we go keeps nstages within (nargs+1)/2, which fits.
+	 */
+	stages[0] = args;
+	nstages = 1;
+	for (i=0; i<nargs; i++) {
+		if (!strcmp(args[i], "|")) {
+			if (i == 0 || args[i-1] == NULL || i == nargs-1) {
+				printf("Invalid null command\n");
+				exitinfo_exit(ei, 1);
+				return;
+			}
+			args[i] = NULL;
+			stages[nstages++] = &args[i+1];
+		}
+	}
+	for (i=0; i<nstages; i++) {
+		if (stages[i][0] == NULL) {
+			printf("Invalid null command\n");
+			exitinfo_exit(ei, 1);
+			return;
+		}
+	}
+	if (bg && nstages > 1) {
+		printf("%s: Cannot background a pipeline\n", args[0]);
+		exitinfo_exit(ei, 1);
+		return;
+	}
+
 	if (timing) {
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			exitinfo_exit(ei, 255);
-			return;
-		case 0:
-			/* child */
-			execvp(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
+	/*
+	 * Start the commands with spawn rather than fork and exec, so
+	 * we don't copy our whole address space only to throw it away.
+	 * A command that can't be run fails here, in the shell.
+	 *
+	 * Each stage but the last writes into a new pipe, whose read
+	 * end becomes the next stage's input. We close our copies of
+	 * the ends as we go, so each reader sees EOF when its writer
+	 * exits.
+	 */
+	infd = -1;
+	for (i=0; i<nstages; i++) {
+		fds[0] = fds[1] = -1;
+		if (i < nstages - 1 && pipe(fds) < 0) {
+			warn("pipe");
+			pids[i] = -1;
+		}
+		else {
+			pids[i] = spawnstage(stages[i], infd, fds[1], fds[0]);
+			if (pids[i] < 0) {
+				warn("%s", stages[i][0]);
+			}
+		}
+		if (infd >= 0) {
+			close(infd);
+		}
+		if (fds[1] >= 0) {
+			close(fds[1]);
+		}
+		infd = fds[0];
+		if (pids[i] < 0) {
 			break;
+		}
+	}
+	if (i < nstages) {
+		/* collect what we started; its input is already gone */
+		if (infd >= 0) {
+			close(infd);
+		}
+		while (i-- > 0) {
+			waitpid(pids[i], &status, 0);
+		}
+		exitinfo_exit(ei, 1);
+		return;
+	}
+
+	/* wait for all but the last; its status is the result */
+	for (i=0; i<nstages - 1; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			warn("waitpid");
+		}
 	}
+	pid = pids[nstages - 1];
 
 	/* parent */
 	if (bg) {
@@ -39,11 +39,18 @@
  * about the kern/ headers.
  */
 #include <kern/fcntl.h>
+#include <kern/futex.h>
 #include <kern/ioctl.h>
+#include <kern/iovec.h>
+#include <kern/poll.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
+#include <kern/select.h>
+#include <kern/sem.h>
+#include <kern/spawn.h>
 #include <kern/time.h>
 #include <kern/unistd.h>
+#include <kern/uring.h>
 #include <kern/wait.h>
 
 
@@ -148,6 +155,26 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
 ssize_t __getcwd(char *buf, size_t buflen);
+int __threadfork(void (*func)(void *), void *arg);
+__DEAD void threadexit(void);
+int futex(volatile int *addr, int op, int val);
+int semop(const struct sembuf *ops, unsigned nops);
+int poll(struct pollfd *fds, unsigned nfds, int timeout);
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+	   struct timeval *timeout);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+ssize_t readv(int filehandle, const struct iovec *iov, int iovcnt);
+ssize_t writev(int filehandle, const struct iovec *iov, int iovcnt);
+ssize_t preadv(int filehandle, const struct iovec *iov, int iovcnt, off_t pos);
+ssize_t pwritev(int filehandle, const struct iovec *iov, int iovcnt,
+		off_t pos);
+ssize_t copy_file_range(int infile, off_t *inpos, int outfile, off_t *outpos,
+			size_t len, unsigned flags);
+int uring_enter(struct uring *ring, unsigned to_submit);
+int waitmany(pid_t *pids, int *returncodes, unsigned max, int flags);
+pid_t spawn(const char *prog, char *const *args,
+	    const struct spawn_action *actions, unsigned nactions);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -156,7 +183,10 @@ ssize_t __getcwd(char *buf, size_t buflen);
  */
 
 int execvp(const char *prog, char *const *args); /* calls execv */
+pid_t spawnp(const char *prog, char *const *args,	/* calls spawn */
+	     const struct spawn_action *actions, unsigned nactions);
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
+int threadfork(void (*func)(void));		/* calls __threadfork */
 
 #endif /* _UNISTD_H_ */
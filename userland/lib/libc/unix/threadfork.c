@@ -0,0 +1,27 @@
+/*
+ * User-level threads.
+ */
+
+#include <unistd.h>
+
+/*
+ * Start a new thread in this process running FUNC. Uses the system
+ * call __threadfork(), which starts the thread in threadstart() on
+ * its own stack; when FUNC returns, the thread exits.
+ */
+
+static
+void
+threadstart(void *arg)
+{
+	void (*func)(void) = (void (*)(void))arg;
+
+	func();
+	threadexit();
+}
+
+int
+threadfork(void (*func)(void))
+{
+	return __threadfork(threadstart, (void *)func);
+}
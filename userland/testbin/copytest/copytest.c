@@ -0,0 +1,299 @@
+/*
+ * copytest - test copy_file_range().
+ *
+ * Makes a file with a known pattern, copies it whole through the
+ * files' seek positions and compares the copy with the original.
+ * Copies a piece from the middle with explicit positions and checks
+ * that the seek positions didn't move. Checks the error cases, and
+ * copying out of a pipe. Then times copying the file with
+ * copy_file_range against a read/write loop.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#define SRCFILE		"copytest.src"
+#define DSTFILE		"copytest.dst"
+#define FILESIZE	(64 * 1024 + 100)	/* not a whole block */
+#define BUFSIZE		4096
+#define NTIMES		4
+
+static char buf[BUFSIZE];
+static char buf2[BUFSIZE];
+
+static
+char
+pattern(unsigned pos)
+{
+	return (char)(pos * 13 + pos / 512);
+}
+
+static
+void
+makesrc(void)
+{
+	unsigned pos, i, len;
+	int fd;
+
+	fd = open(SRCFILE, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", SRCFILE);
+	}
+	for (pos=0; pos<FILESIZE; pos+=len) {
+		len = FILESIZE - pos < BUFSIZE ? FILESIZE - pos : BUFSIZE;
+		for (i=0; i<len; i++) {
+			buf[i] = pattern(pos + i);
+		}
+		if (write(fd, buf, len) != (ssize_t)len) {
+			err(1, "%s: write", SRCFILE);
+		}
+	}
+	close(fd);
+}
+
+/*
+ * Check that FD holds LEN bytes of the pattern starting at pattern
+ * position SRCPOS, from file position DSTPOS.
+ */
+static
+void
+checkdata(int fd, off_t dstpos, unsigned srcpos, unsigned len)
+{
+	unsigned done, i, n;
+	ssize_t r;
+
+	for (done=0; done<len; done+=n) {
+		n = len - done < BUFSIZE ? len - done : BUFSIZE;
+		r = pread(fd, buf, n, dstpos + done);
+		if (r != (ssize_t)n) {
+			errx(1, "FAILED: short read of copy (%d)", (int)r);
+		}
+		for (i=0; i<n; i++) {
+			if (buf[i] != pattern(srcpos + done + i)) {
+				errx(1, "FAILED: copy wrong at byte %u",
+				     done + i);
+			}
+		}
+	}
+}
+
+static
+void
+test_whole(void)
+{
+	int in, out;
+	ssize_t r;
+	unsigned total;
+
+	in = open(SRCFILE, O_RDONLY);
+	out = open(DSTFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (in < 0 || out < 0) {
+		err(1, "open");
+	}
+	total = 0;
+	while ((r = copy_file_range(in, NULL, out, NULL, 10000, 0)) > 0) {
+		total += r;
+	}
+	if (r < 0) {
+		err(1, "copy_file_range");
+	}
+	if (total != FILESIZE) {
+		errx(1, "FAILED: copied %u bytes, expected %u",
+		     total, FILESIZE);
+	}
+	if (lseek(in, 0, SEEK_CUR) != FILESIZE ||
+	    lseek(out, 0, SEEK_CUR) != FILESIZE) {
+		errx(1, "FAILED: seek positions not advanced");
+	}
+	checkdata(out, 0, 0, FILESIZE);
+	close(in);
+	close(out);
+	printf("copytest: whole-file copy ok\n");
+}
+
+static
+void
+test_positions(void)
+{
+	off_t inpos, outpos;
+	int in, out;
+	ssize_t r;
+
+	in = open(SRCFILE, O_RDONLY);
+	out = open(DSTFILE, O_RDWR);
+	if (in < 0 || out < 0) {
+		err(1, "open");
+	}
+
+	/* an unaligned piece from the middle, to another place */
+	inpos = 1000;
+	outpos = 20000;
+	r = copy_file_range(in, &inpos, out, &outpos, 5000, 0);
+	if (r != 5000) {
+		errx(1, "FAILED: positioned copy returned %d", (int)r);
+	}
+	if (inpos != 6000 || outpos != 25000) {
+		errx(1, "FAILED: positions not updated");
+	}
+	if (lseek(in, 0, SEEK_CUR) != 0 || lseek(out, 0, SEEK_CUR) != 0) {
+		errx(1, "FAILED: seek positions moved");
+	}
+	checkdata(out, 20000, 1000, 5000);
+
+	/* past EOF copies nothing */
+	inpos = FILESIZE + 10;
+	r = copy_file_range(in, &inpos, out, NULL, 100, 0);
+	if (r != 0) {
+		errx(1, "FAILED: copy past EOF returned %d", (int)r);
+	}
+
+	/* errors */
+	inpos = 0;
+	outpos = 100;
+	r = copy_file_range(out, &inpos, out, &outpos, 1000, 0);
+	if (r != -1 || errno != EINVAL) {
+		errx(1, "FAILED: overlapping copy returned %d", (int)r);
+	}
+	r = copy_file_range(in, NULL, out, NULL, 10, 1);
+	if (r != -1 || errno != EINVAL) {
+		errx(1, "FAILED: copy with flags returned %d", (int)r);
+	}
+	r = copy_file_range(out, NULL, in, NULL, 10, 0);
+	if (r != -1 || errno != EBADF) {
+		errx(1, "FAILED: copy to read-only file returned %d", (int)r);
+	}
+	close(in);
+	close(out);
+	printf("copytest: positions and errors ok\n");
+}
+
+static
+void
+test_pipe(void)
+{
+	int fds[2], out, status;
+	off_t outpos;
+	pid_t pid;
+	ssize_t r;
+	unsigned total;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		int in;
+
+		close(fds[0]);
+		in = open(SRCFILE, O_RDONLY);
+		if (in < 0) {
+			err(1, "%s", SRCFILE);
+		}
+		while ((r = copy_file_range(in, NULL, fds[1], NULL,
+					    FILESIZE, 0)) > 0) {
+			/* nothing */
+		}
+		_exit(r < 0);
+	}
+	close(fds[1]);
+
+	out = open(DSTFILE, O_RDWR|O_TRUNC);
+	if (out < 0) {
+		err(1, "%s", DSTFILE);
+	}
+	outpos = 0;
+	r = copy_file_range(fds[0], &outpos, out, NULL, 10, 0);
+	if (r != -1 || errno != ESPIPE) {
+		errx(1, "FAILED: position on a pipe gave %d", (int)r);
+	}
+	total = 0;
+	while ((r = copy_file_range(fds[0], NULL, out, NULL,
+				    FILESIZE, 0)) > 0) {
+		total += r;
+	}
+	if (r < 0) {
+		err(1, "copy_file_range from pipe");
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "FAILED: child failed");
+	}
+	if (total != FILESIZE) {
+		errx(1, "FAILED: got %u bytes from pipe", total);
+	}
+	checkdata(out, 0, 0, FILESIZE);
+	close(fds[0]);
+	close(out);
+	printf("copytest: pipe copy ok\n");
+}
+
+static
+unsigned long
+timecopy(int usesyscall)
+{
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	int in, out, i;
+	ssize_t r;
+
+	__time(&s0, &ns0);
+	for (i=0; i<NTIMES; i++) {
+		in = open(SRCFILE, O_RDONLY);
+		out = open(DSTFILE, O_WRONLY|O_TRUNC);
+		if (in < 0 || out < 0) {
+			err(1, "open");
+		}
+		if (usesyscall) {
+			while ((r = copy_file_range(in, NULL, out, NULL,
+						    FILESIZE, 0)) > 0) {
+				/* nothing */
+			}
+		}
+		else {
+			while ((r = read(in, buf2, BUFSIZE)) > 0) {
+				if (write(out, buf2, r) != r) {
+					err(1, "write");
+				}
+			}
+		}
+		if (r < 0) {
+			err(1, "copy");
+		}
+		close(in);
+		close(out);
+	}
+	__time(&s1, &ns1);
+	return (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+}
+
+int
+main(void)
+{
+	unsigned long ms1, ms2;
+
+	makesrc();
+	test_whole();
+	test_positions();
+	test_pipe();
+
+	ms1 = timecopy(0);
+	ms2 = timecopy(1);
+	printf("copytest: %d copies of %u bytes: read/write %lu ms, "
+	       "copy_file_range %lu ms\n", NTIMES, FILESIZE, ms1, ms2);
+
+	remove(SRCFILE);
+	remove(DSTFILE);
+	printf("copytest: passed\n");
+	return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * futextest - test futex() with a user-level mutex.
+ *
+ * Several threads increment a shared counter under a mutex built
+ * from an atomic word plus futex(). The uncontended lock and unlock
+ * paths never enter the kernel; a thread only calls futex() when
+ * the lock is actually held by someone else. At the end we check the
+ * counter and print how often the slow path was taken.
+ *
+ * First, though, checks the cases that don't need a second thread:
+ * a wait on a value that doesn't match comes straight back with
+ * EAGAIN, and a wake with nobody waiting wakes nobody.
+ *
+ * The threaded part needs user-level threads (threadfork) as well as
+ * futex.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NTHREADS	8
+#define NLOOPS		2000
+#define NWORK		20
+
+/*
+ * Atomic operations using LL/SC. Both return the old value.
+ */
+static
+int
+atomic_cmpxchg(volatile int *p, int old, int new)
+{
+	int x, y;
+
+	do {
+		y = 1;
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"bne %0, %3, 1f;"	/*   if (x != old) skip */
+			"move %1, %4;"		/*   y = new */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			"1:"
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "+r" (y) : "r" (p), "r" (old), "r" (new)
+			: "memory");
+	} while (x == old && y == 0);
+	return x;
+}
+
+static
+int
+atomic_xchg(volatile int *p, int new)
+{
+	int x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"move %1, %3;"		/*   y = new */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (p), "r" (new)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+/*
+ * Mutex: 0 = unlocked, 1 = locked, 2 = locked and maybe waited on.
+ */
+static volatile int mutex;
+static volatile int slowpaths;
+
+static
+void
+mutex_lock(void)
+{
+	int c;
+
+	c = atomic_cmpxchg(&mutex, 0, 1);
+	if (c == 0) {
+		/* fast path: no syscall */
+		return;
+	}
+	if (c != 2) {
+		c = atomic_xchg(&mutex, 2);
+	}
+	while (c != 0) {
+		futex(&mutex, FUTEX_WAIT, 2);
+		c = atomic_xchg(&mutex, 2);
+	}
+	/* we hold the lock now, so this is safe */
+	slowpaths++;
+}
+
+static
+void
+mutex_unlock(void)
+{
+	if (atomic_xchg(&mutex, 0) == 2) {
+		futex(&mutex, FUTEX_WAKE, 1);
+	}
+}
+
+static volatile int counter;
+static volatile int done;
+
+static
+void
+test_nowait(void)
+{
+	static volatile int word = 5;
+	int r;
+
+	r = futex(&word, FUTEX_WAIT, 6);
+	if (r != -1 || errno != EAGAIN) {
+		errx(1, "FAILED: wait on a changed value returned %d", r);
+	}
+	r = futex(&word, FUTEX_WAKE, 1);
+	if (r != 0) {
+		errx(1, "FAILED: wake with no waiters returned %d", r);
+	}
+	r = futex((volatile int *)((volatile char *)&word + 1),
+		  FUTEX_WAKE, 1);
+	if (r != -1 || errno != EINVAL) {
+		errx(1, "FAILED: misaligned futex returned %d", r);
+	}
+	printf("futextest: single-threaded checks ok\n");
+}
+
+static
+void
+worker(void)
+{
+	int i, j, tmp;
+
+	for (i=0; i<NLOOPS; i++) {
+		mutex_lock();
+		for (j=0; j<NWORK; j++) {
+			/* a non-atomic increment, spread out */
+			tmp = counter;
+			counter = tmp + 1;
+		}
+		mutex_unlock();
+	}
+
+	mutex_lock();
+	done++;
+	mutex_unlock();
+	futex(&done, FUTEX_WAKE, 1);
+}
+
+int
+main(void)
+{
+	int i, d, result;
+
+	test_nowait();
+
+	for (i=0; i<NTHREADS; i++) {
+		result = threadfork(worker);
+		if (result) {
+			err(1, "threadfork");
+		}
+	}
+
+	/* Wait for the workers without spinning. */
+	while ((d = done) < NTHREADS) {
+		futex(&done, FUTEX_WAIT, d);
+	}
+
+	printf("futextest: %d threads x %d loops, %d slow paths\n",
+	       NTHREADS, NLOOPS, slowpaths);
+	if (counter != NTHREADS * NLOOPS * NWORK) {
+		errx(1, "FAILED: counter is %d, expected %d", counter,
+		     NTHREADS * NLOOPS * NWORK);
+	}
+	printf("futextest: passed\n");
+	return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * iovtest - test readv, writev, preadv, and pwritev.
+ *
+ * Writes records made of several pieces with one writev each, reads
+ * them back with readv into buffers split at different places, then
+ * overwrites one record in the middle with pwritev and checks it
+ * with preadv. Also checks that a bad iovec count is rejected.
+ */
+
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define FILENAME	"iovtest.dat"
+#define NRECORDS	10
+#define RECSIZE		24
+
+static const char header[] = "rec";		/* 3 bytes */
+static const char body[] = "0123456789abcdefghij";	/* 20 bytes */
+static const char trailer[] = "\n";		/* 1 byte */
+
+/*
+ * Build record NUM: the header, the body with the record number
+ * stuffed in, and the trailer.
+ */
+static
+void
+mkrecord(int num, char *bodybuf, struct iovec *iov)
+{
+	memcpy(bodybuf, body, sizeof(body) - 1);
+	bodybuf[0] = 'A' + num;
+
+	iov[0].iov_base = (void *)header;
+	iov[0].iov_len = sizeof(header) - 1;
+	iov[1].iov_base = bodybuf;
+	iov[1].iov_len = sizeof(body) - 1;
+	iov[2].iov_base = (void *)trailer;
+	iov[2].iov_len = sizeof(trailer) - 1;
+}
+
+static
+void
+checkrecord(int num, const char *rec)
+{
+	char bodybuf[sizeof(body)];
+	struct iovec iov[3];
+	char want[RECSIZE];
+
+	mkrecord(num, bodybuf, iov);
+	memcpy(want, iov[0].iov_base, iov[0].iov_len);
+	memcpy(want + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+	memcpy(want + iov[0].iov_len + iov[1].iov_len,
+	       iov[2].iov_base, iov[2].iov_len);
+	if (memcmp(rec, want, RECSIZE) != 0) {
+		errx(1, "FAILED: record %d is wrong", num);
+	}
+}
+
+int
+main(void)
+{
+	char bodybuf[sizeof(body)];
+	char a[5], b[RECSIZE - 5], rec[RECSIZE];
+	struct iovec iov[3];
+	int fd, i;
+	ssize_t r;
+
+	fd = open(FILENAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+
+	/* write the records, one writev each */
+	for (i=0; i<NRECORDS; i++) {
+		mkrecord(i, bodybuf, iov);
+		r = writev(fd, iov, 3);
+		if (r != RECSIZE) {
+			err(1, "writev of record %d returned %d", i, (int)r);
+		}
+	}
+
+	/* read them back, split differently */
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+	for (i=0; i<NRECORDS; i++) {
+		iov[0].iov_base = a;
+		iov[0].iov_len = sizeof(a);
+		iov[1].iov_base = b;
+		iov[1].iov_len = sizeof(b);
+		r = readv(fd, iov, 2);
+		if (r != RECSIZE) {
+			err(1, "readv of record %d returned %d", i, (int)r);
+		}
+		memcpy(rec, a, sizeof(a));
+		memcpy(rec + sizeof(a), b, sizeof(b));
+		checkrecord(i, rec);
+	}
+
+	/* replace record 4 with record 9's contents, positionally */
+	mkrecord(9, bodybuf, iov);
+	r = pwritev(fd, iov, 3, 4 * RECSIZE);
+	if (r != RECSIZE) {
+		err(1, "pwritev returned %d", (int)r);
+	}
+	iov[0].iov_base = rec;
+	iov[0].iov_len = 10;
+	iov[1].iov_base = rec + 10;
+	iov[1].iov_len = 0;
+	iov[2].iov_base = rec + 10;
+	iov[2].iov_len = RECSIZE - 10;
+	r = preadv(fd, iov, 3, 4 * RECSIZE);
+	if (r != RECSIZE) {
+		err(1, "preadv returned %d", (int)r);
+	}
+	checkrecord(9, rec);
+
+	/* the seek position is still at the end */
+	if (lseek(fd, 0, SEEK_CUR) != NRECORDS * RECSIZE) {
+		errx(1, "FAILED: pwritev/preadv moved the seek position");
+	}
+
+	/* bad counts */
+	if (readv(fd, iov, 0) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: readv with no iovecs didn't fail with EINVAL");
+	}
+	if (writev(fd, iov, -1) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: writev with -1 iovecs didn't fail with EINVAL");
+	}
+
+	close(fd);
+	remove(FILENAME);
+	printf("iovtest: passed\n");
+	return 0;
+}
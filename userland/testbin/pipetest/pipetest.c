@@ -0,0 +1,140 @@
+/*
+ * pipetest - test pipes.
+ *
+ * A child writes a known byte pattern into a pipe in writes of
+ * assorted sizes (some bigger than the pipe's buffer) and the parent
+ * reads it in reads of other sizes, checking every byte and that it
+ * sees EOF once the child is done. Prints the throughput. Then
+ * checks that writing to a pipe with no reader fails with EPIPE.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define TOTAL		(256 * 1024)
+#define BUFSIZE		8192
+
+static const unsigned wsizes[] = { 1, 100, 512, 4000, 5000, 8192 };
+static const unsigned rsizes[] = { 7, 4096, 1000, 8192, 1 };
+#define NWSIZES (sizeof(wsizes) / sizeof(wsizes[0]))
+#define NRSIZES (sizeof(rsizes) / sizeof(rsizes[0]))
+
+static char buf[BUFSIZE];
+
+static
+char
+pattern(unsigned pos)
+{
+	return (char)(pos * 31 + pos / 256);
+}
+
+static
+void
+writer(int fd)
+{
+	unsigned pos, len, i, k;
+	ssize_t r;
+
+	pos = 0;
+	k = 0;
+	while (pos < TOTAL) {
+		len = wsizes[k++ % NWSIZES];
+		if (len > TOTAL - pos) {
+			len = TOTAL - pos;
+		}
+		for (i=0; i<len; i++) {
+			buf[i] = pattern(pos + i);
+		}
+		r = write(fd, buf, len);
+		if (r != (ssize_t)len) {
+			err(1, "child: write returned %d", (int)r);
+		}
+		pos += len;
+	}
+}
+
+static
+void
+reader(int fd)
+{
+	unsigned pos, i, k;
+	ssize_t r;
+
+	pos = 0;
+	k = 0;
+	while (1) {
+		r = read(fd, buf, rsizes[k++ % NRSIZES]);
+		if (r < 0) {
+			err(1, "read");
+		}
+		if (r == 0) {
+			break;
+		}
+		for (i=0; i<(unsigned)r; i++) {
+			if (buf[i] != pattern(pos + i)) {
+				errx(1, "FAILED: wrong byte at %u", pos + i);
+			}
+		}
+		pos += r;
+	}
+	if (pos != TOTAL) {
+		errx(1, "FAILED: got %u bytes, expected %u", pos, TOTAL);
+	}
+}
+
+int
+main(void)
+{
+	int fds[2], status;
+	time_t s0, s1;
+	unsigned long ns0, ns1, msecs;
+	pid_t pid;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	__time(&s0, &ns0);
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		writer(fds[1]);
+		_exit(0);
+	}
+	close(fds[1]);
+	reader(fds[0]);
+	close(fds[0]);
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "FAILED: writer failed");
+	}
+	__time(&s1, &ns1);
+	msecs = (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+	printf("pipetest: %u bytes in %lu ms, %lu KB/s\n", TOTAL, msecs,
+	       (unsigned long)TOTAL / msecs * 1000 / 1024);
+
+	/* nobody to read */
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	close(fds[0]);
+	if (write(fds[1], "x", 1) != -1 || errno != EPIPE) {
+		errx(1, "FAILED: write with no reader didn't fail with EPIPE");
+	}
+	close(fds[1]);
+
+	printf("pipetest: passed\n");
+	return 0;
+}
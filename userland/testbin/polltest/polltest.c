@@ -0,0 +1,297 @@
+/*
+ * polltest - test poll() and select().
+ *
+ * Checks that an empty pipe isn't readable and that a timeout is
+ * honored; that a poller blocked on several pipes sleeps until a
+ * child writes to one of them and then reports just that one; that a
+ * closed write end shows up as POLLHUP; that bad file handles give
+ * POLLNVAL from poll and EBADF from select. Then has one process
+ * multiplex a stream of messages from several children and prints
+ * the rate.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <poll.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NCHILDREN	4
+#define NMESSAGES	500
+
+static
+unsigned long
+msecs_since(time_t s0, unsigned long ns0)
+{
+	time_t s1;
+	unsigned long ns1;
+
+	__time(&s1, &ns1);
+	return (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+}
+
+static
+void
+waitchild(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "FAILED: child failed");
+	}
+}
+
+/*
+ * Fork a child that sleeps for DELAY milliseconds (by polling
+ * nothing), writes one byte to FD, and exits.
+ */
+static
+pid_t
+latewriter(int fd, int delay)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		if (poll(NULL, 0, delay) != 0) {
+			err(1, "child: poll");
+		}
+		if (write(fd, "x", 1) != 1) {
+			err(1, "child: write");
+		}
+		_exit(0);
+	}
+	return pid;
+}
+
+static
+void
+test_timeout(int rfd, int wfd)
+{
+	struct pollfd pfd;
+	fd_set rset;
+	struct timeval tv;
+	time_t s0;
+	unsigned long ns0, ms;
+	int r;
+
+	pfd.fd = rfd;
+	pfd.events = POLLIN;
+	r = poll(&pfd, 1, 0);
+	if (r != 0) {
+		errx(1, "FAILED: empty pipe polled readable (%d)", r);
+	}
+
+	__time(&s0, &ns0);
+	r = poll(&pfd, 1, 200);
+	ms = msecs_since(s0, ns0);
+	if (r != 0) {
+		errx(1, "FAILED: poll with timeout returned %d", r);
+	}
+	if (ms < 150) {
+		errx(1, "FAILED: 200 ms timeout took only %lu ms", ms);
+	}
+
+	FD_ZERO(&rset);
+	FD_SET(rfd, &rset);
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+	r = select(rfd + 1, &rset, NULL, NULL, &tv);
+	if (r != 0 || FD_ISSET(rfd, &rset)) {
+		errx(1, "FAILED: select on empty pipe returned %d", r);
+	}
+
+	pfd.fd = wfd;
+	pfd.events = POLLOUT;
+	r = poll(&pfd, 1, 0);
+	if (r != 1 || pfd.revents != POLLOUT) {
+		errx(1, "FAILED: empty pipe not writable (%d, 0x%x)",
+		     r, pfd.revents);
+	}
+	printf("polltest: timeouts ok (%lu ms for 200)\n", ms);
+}
+
+static
+void
+test_wakeup(int p1[2], int p2[2])
+{
+	struct pollfd pfds[2];
+	fd_set rset;
+	time_t s0;
+	unsigned long ns0, ms;
+	pid_t pid;
+	char ch;
+	int r;
+
+	/* poll: only the pipe written to comes back */
+	pfds[0].fd = p1[0];
+	pfds[0].events = POLLIN;
+	pfds[1].fd = p2[0];
+	pfds[1].events = POLLIN;
+
+	__time(&s0, &ns0);
+	pid = latewriter(p2[1], 300);
+	r = poll(pfds, 2, INFTIM);
+	ms = msecs_since(s0, ns0);
+	if (r != 1 || pfds[0].revents != 0 || pfds[1].revents != POLLIN) {
+		errx(1, "FAILED: poll returned %d (0x%x, 0x%x)",
+		     r, pfds[0].revents, pfds[1].revents);
+	}
+	if (ms < 200) {
+		errx(1, "FAILED: poll returned after %lu ms, before the "
+		     "write", ms);
+	}
+	if (read(p2[0], &ch, 1) != 1) {
+		err(1, "read");
+	}
+	waitchild(pid);
+
+	/* same with select, the other pipe */
+	pid = latewriter(p1[1], 100);
+	FD_ZERO(&rset);
+	FD_SET(p1[0], &rset);
+	FD_SET(p2[0], &rset);
+	r = select((p1[0] > p2[0] ? p1[0] : p2[0]) + 1, &rset, NULL, NULL,
+		   NULL);
+	if (r != 1 || !FD_ISSET(p1[0], &rset) || FD_ISSET(p2[0], &rset)) {
+		errx(1, "FAILED: select returned %d", r);
+	}
+	if (read(p1[0], &ch, 1) != 1) {
+		err(1, "read");
+	}
+	waitchild(pid);
+	printf("polltest: wakeups ok (%lu ms for 300)\n", ms);
+}
+
+static
+void
+test_hup_nval(int rfd, int wfd)
+{
+	struct pollfd pfds[2];
+	fd_set rset;
+	int r;
+
+	close(wfd);
+	pfds[0].fd = rfd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = wfd;
+	pfds[1].events = POLLIN;
+	r = poll(pfds, 2, INFTIM);
+	if (r != 2 || !(pfds[0].revents & POLLHUP) ||
+	    pfds[1].revents != POLLNVAL) {
+		errx(1, "FAILED: poll returned %d (0x%x, 0x%x)",
+		     r, pfds[0].revents, pfds[1].revents);
+	}
+
+	FD_ZERO(&rset);
+	FD_SET(wfd, &rset);
+	r = select(wfd + 1, &rset, NULL, NULL, NULL);
+	if (r != -1 || errno != EBADF) {
+		errx(1, "FAILED: select on closed fd returned %d", r);
+	}
+	close(rfd);
+	printf("polltest: POLLHUP/POLLNVAL ok\n");
+}
+
+/*
+ * NCHILDREN children each send NMESSAGES one-byte messages on their
+ * own pipe; we take them as they come with poll.
+ */
+static
+void
+test_fanin(void)
+{
+	struct pollfd pfds[NCHILDREN];
+	pid_t pids[NCHILDREN];
+	int fds[2], i, j, nopen, r;
+	unsigned got;
+	time_t s0;
+	unsigned long ns0, ms;
+	char ch;
+
+	__time(&s0, &ns0);
+	for (i=0; i<NCHILDREN; i++) {
+		if (pipe(fds) < 0) {
+			err(1, "pipe");
+		}
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			close(fds[0]);
+			for (j=0; j<NMESSAGES; j++) {
+				if (write(fds[1], "m", 1) != 1) {
+					err(1, "child: write");
+				}
+			}
+			_exit(0);
+		}
+		close(fds[1]);
+		pfds[i].fd = fds[0];
+		pfds[i].events = POLLIN;
+	}
+
+	got = 0;
+	nopen = NCHILDREN;
+	while (nopen > 0) {
+		r = poll(pfds, NCHILDREN, INFTIM);
+		if (r <= 0) {
+			err(1, "poll");
+		}
+		for (i=0; i<NCHILDREN; i++) {
+			if (pfds[i].revents == 0) {
+				continue;
+			}
+			r = read(pfds[i].fd, &ch, 1);
+			if (r < 0) {
+				err(1, "read");
+			}
+			if (r == 0) {
+				close(pfds[i].fd);
+				pfds[i].fd = -1;
+				nopen--;
+				continue;
+			}
+			got++;
+		}
+	}
+	for (i=0; i<NCHILDREN; i++) {
+		waitchild(pids[i]);
+	}
+	ms = msecs_since(s0, ns0);
+	if (got != NCHILDREN * NMESSAGES) {
+		errx(1, "FAILED: got %u messages, expected %u",
+		     got, NCHILDREN * NMESSAGES);
+	}
+	printf("polltest: %u messages from %d writers in %lu ms\n",
+	       got, NCHILDREN, ms);
+}
+
+int
+main(void)
+{
+	int p1[2], p2[2];
+
+	if (pipe(p1) < 0 || pipe(p2) < 0) {
+		err(1, "pipe");
+	}
+
+	test_timeout(p1[0], p1[1]);
+	test_wakeup(p1, p2);
+	test_hup_nval(p1[0], p1[1]);
+	close(p2[0]);
+	close(p2[1]);
+	test_fanin();
+
+	printf("polltest: passed\n");
+	return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * preadtest - test pread() and pwrite().
+ *
+ * Fills a file with pwrite, block by block in a scrambled order,
+ * then forks children that all pread different blocks of it through
+ * the same inherited file handle at once. Checks the data, and that
+ * none of this moved the shared seek position.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <err.h>
+
+#define FILENAME	"preadtest.dat"
+#define BLOCKSIZE	128
+#define NBLOCKS		32
+#define NKIDS		4
+#define NPASSES		20
+
+static
+void
+fillblock(char *buf, int block)
+{
+	int i;
+
+	for (i=0; i<BLOCKSIZE; i++) {
+		buf[i] = (char)(block * 7 + i);
+	}
+}
+
+/*
+ * Child: read every block, starting at our own, NPASSES times.
+ */
+static
+int
+reader(int fd, int me)
+{
+	char buf[BLOCKSIZE], want[BLOCKSIZE];
+	int pass, i, block, j;
+	ssize_t r;
+
+	for (pass=0; pass<NPASSES; pass++) {
+		for (i=0; i<NBLOCKS; i++) {
+			block = (me * (NBLOCKS / NKIDS) + i) % NBLOCKS;
+			r = pread(fd, buf, BLOCKSIZE,
+				  (off_t)block * BLOCKSIZE);
+			if (r != BLOCKSIZE) {
+				warn("kid %d: pread of block %d returned %d",
+				     me, block, (int)r);
+				return 1;
+			}
+			fillblock(want, block);
+			for (j=0; j<BLOCKSIZE; j++) {
+				if (buf[j] != want[j]) {
+					warnx("kid %d: block %d byte %d wrong",
+					      me, block, j);
+					return 1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+int
+main(void)
+{
+	char buf[BLOCKSIZE];
+	pid_t kids[NKIDS];
+	int fd, i, block, status, failed;
+	off_t pos;
+
+	fd = open(FILENAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+
+	/* Write the blocks out of order; 5 is prime to NBLOCKS. */
+	for (i=0; i<NBLOCKS; i++) {
+		block = (i * 5) % NBLOCKS;
+		fillblock(buf, block);
+		if (pwrite(fd, buf, BLOCKSIZE, (off_t)block * BLOCKSIZE)
+		    != BLOCKSIZE) {
+			err(1, "pwrite of block %d", block);
+		}
+	}
+
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos != 0) {
+		errx(1, "FAILED: pwrite moved the seek position to %d",
+		     (int)pos);
+	}
+
+	for (i=0; i<NKIDS; i++) {
+		kids[i] = fork();
+		if (kids[i] < 0) {
+			err(1, "fork");
+		}
+		if (kids[i] == 0) {
+			_exit(reader(fd, i));
+		}
+	}
+
+	failed = 0;
+	for (i=0; i<NKIDS; i++) {
+		if (waitpid(kids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			failed = 1;
+		}
+	}
+	if (failed) {
+		errx(1, "FAILED: a reader got bad data");
+	}
+
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos != 0) {
+		errx(1, "FAILED: pread moved the seek position to %d",
+		     (int)pos);
+	}
+
+	/* Reading at end of file gets nothing. */
+	if (pread(fd, buf, BLOCKSIZE, (off_t)NBLOCKS * BLOCKSIZE) != 0) {
+		errx(1, "FAILED: pread past end of file got data");
+	}
+
+	close(fd);
+	remove(FILENAME);
+	printf("preadtest: passed\n");
+	return 0;
+}
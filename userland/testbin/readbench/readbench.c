@@ -0,0 +1,143 @@
+/*
+ * readbench - time 1-byte reads.
+ *
+ * Each read is almost all system call overhead, so this measures the
+ * fd lookup path: filetable_get and filetable_put. Runs once with a
+ * single thread and then with several threads sharing the file
+ * table, each reading its own fd so the only thing they share is
+ * the table. Prints reads per second for each.
+ *
+ * Needs user-level threads (threadfork).
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <err.h>
+
+#define FILENAME	"readbench.dat"
+#define FILESIZE	512
+#define NTHREADS	4
+#define NREADS		20000
+
+static int fds[NTHREADS];
+static volatile int starting, started;
+static volatile int finished[NTHREADS];
+
+/*
+ * Do NREADS 1-byte reads on FD, rewinding at end of file.
+ */
+static
+void
+readloop(int fd)
+{
+	char ch;
+	int i, r;
+
+	for (i=0; i<NREADS; i++) {
+		r = read(fd, &ch, 1);
+		if (r < 0) {
+			err(1, "read");
+		}
+		if (r == 0) {
+			if (lseek(fd, 0, SEEK_SET) < 0) {
+				err(1, "lseek");
+			}
+		}
+	}
+}
+
+static
+void
+worker(void)
+{
+	int me;
+
+	/*
+	 * threadfork passes no argument, so pick up our number from
+	 * main, which waits for us to do so before starting the next.
+	 */
+	me = starting;
+	started = me + 1;
+	futex(&started, FUTEX_WAKE, 1);
+
+	readloop(fds[me]);
+	finished[me] = 1;
+	futex(&finished[me], FUTEX_WAKE, 1);
+}
+
+static
+void
+report(const char *what, int nreads, time_t s0, unsigned long ns0)
+{
+	time_t s1;
+	unsigned long ns1, msecs;
+
+	__time(&s1, &ns1);
+	msecs = (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+	printf("readbench: %s: %d reads in %lu.%03lu s, %lu reads/s\n",
+	       what, nreads, msecs / 1000, msecs % 1000,
+	       nreads * 1000UL / msecs);
+}
+
+int
+main(void)
+{
+	char buf[FILESIZE];
+	time_t s0;
+	unsigned long ns0;
+	int fd, i, s, result;
+
+	/* make the file */
+	fd = open(FILENAME, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	for (i=0; i<FILESIZE; i++) {
+		buf[i] = 'a' + i % 26;
+	}
+	if (write(fd, buf, FILESIZE) != FILESIZE) {
+		err(1, "%s: write", FILENAME);
+	}
+	close(fd);
+
+	for (i=0; i<NTHREADS; i++) {
+		fds[i] = open(FILENAME, O_RDONLY);
+		if (fds[i] < 0) {
+			err(1, "%s", FILENAME);
+		}
+	}
+
+	/* one thread */
+	__time(&s0, &ns0);
+	readloop(fds[0]);
+	report("1 thread", NREADS, s0, ns0);
+
+	/* several threads sharing the file table */
+	__time(&s0, &ns0);
+	for (i=0; i<NTHREADS; i++) {
+		starting = i;
+		result = threadfork(worker);
+		if (result) {
+			err(1, "threadfork");
+		}
+		while ((s = started) <= i) {
+			futex(&started, FUTEX_WAIT, s);
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		while (finished[i] == 0) {
+			futex(&finished[i], FUTEX_WAIT, 0);
+		}
+	}
+	report("threads", NTHREADS * NREADS, s0, ns0);
+
+	for (i=0; i<NTHREADS; i++) {
+		close(fds[i]);
+	}
+	remove(FILENAME);
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * reaptest - test waitpid(WAIT_ANY) and waitmany().
+ *
+ * Forks a pile of children that exit with different codes, polls
+ * once with WNOHANG, then collects the rest in batches with
+ * waitmany. Checks that every child turns up exactly once with the
+ * right status, and that waiting with no children left fails with
+ * ECHILD.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NKIDS	40
+#define BATCH	16
+
+static pid_t kids[NKIDS];
+static int seen[NKIDS];
+
+static
+void
+collect(pid_t pid, int status)
+{
+	int i;
+
+	for (i=0; i<NKIDS; i++) {
+		if (kids[i] == pid) {
+			break;
+		}
+	}
+	if (i == NKIDS) {
+		errx(1, "FAILED: got unknown pid %d", pid);
+	}
+	if (seen[i]) {
+		errx(1, "FAILED: got pid %d twice", pid);
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != i) {
+		errx(1, "FAILED: pid %d: status %d, expected exit %d",
+		     pid, status, i);
+	}
+	seen[i] = 1;
+}
+
+int
+main(void)
+{
+	pid_t pids[BATCH], pid;
+	int statuses[BATCH], status;
+	int i, n, got, calls;
+
+	for (i=0; i<NKIDS; i++) {
+		kids[i] = fork();
+		if (kids[i] < 0) {
+			err(1, "fork");
+		}
+		if (kids[i] == 0) {
+			_exit(i);
+		}
+	}
+
+	got = 0;
+
+	/* One nonblocking poll; either answer is fine. */
+	pid = waitpid(WAIT_ANY, &status, WNOHANG);
+	if (pid < 0) {
+		err(1, "waitpid WNOHANG");
+	}
+	if (pid > 0) {
+		collect(pid, status);
+		got++;
+	}
+
+	calls = 0;
+	while (got < NKIDS) {
+		n = waitmany(pids, statuses, BATCH, 0);
+		if (n < 0) {
+			err(1, "waitmany");
+		}
+		if (n == 0 || n > BATCH) {
+			errx(1, "FAILED: waitmany returned %d", n);
+		}
+		for (i=0; i<n; i++) {
+			collect(pids[i], statuses[i]);
+		}
+		got += n;
+		calls++;
+	}
+	printf("reaptest: %d children collected in %d waitmany calls\n",
+	       NKIDS, calls);
+
+	if (waitpid(WAIT_ANY, &status, 0) >= 0 || errno != ECHILD) {
+		errx(1, "FAILED: waitpid with no children didn't fail "
+		     "with ECHILD");
+	}
+	if (waitmany(pids, statuses, BATCH, WNOHANG) >= 0 ||
+	    errno != ECHILD) {
+		errx(1, "FAILED: waitmany with no children didn't fail "
+		     "with ECHILD");
+	}
+
+	printf("reaptest: passed\n");
+	return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * spawntest - test spawn() and its file actions.
+ *
+ * Spawns a copy of itself with its stdout redirected to a file via
+ * SPAWN_DUP2, waits for it, and checks what it wrote. Also checks
+ * that spawning something that doesn't exist fails in the caller.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define PROG		"/testbin/spawntest"
+#define FILENAME	"spawntest.out"
+#define MESSAGE		"spawned child says hello\n"
+
+static
+int
+child(void)
+{
+	ssize_t len;
+
+	len = write(STDOUT_FILENO, MESSAGE, strlen(MESSAGE));
+	if (len != (ssize_t)strlen(MESSAGE)) {
+		return 1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	char *args[3];
+	char buf[128];
+	struct spawn_action act[2];
+	pid_t pid;
+	ssize_t len;
+	int fd, status;
+
+	if (argc == 2 && !strcmp(argv[1], "child")) {
+		return child();
+	}
+
+	fd = open(FILENAME, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+
+	/* Run ourselves with stdout going to the file. */
+	args[0] = (char *)PROG;
+	args[1] = (char *)"child";
+	args[2] = NULL;
+	act[0].sa_op = SPAWN_DUP2;
+	act[0].sa_fd = fd;
+	act[0].sa_newfd = STDOUT_FILENO;
+	act[1].sa_op = SPAWN_CLOSE;
+	act[1].sa_fd = fd;
+	act[1].sa_newfd = 0;
+	pid = spawn(PROG, args, act, 2);
+	if (pid < 0) {
+		err(1, "spawn");
+	}
+	close(fd);
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "FAILED: child status %d", status);
+	}
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len < 0) {
+		err(1, "%s: read", FILENAME);
+	}
+	buf[len] = 0;
+	close(fd);
+	remove(FILENAME);
+	if (strcmp(buf, MESSAGE) != 0) {
+		errx(1, "FAILED: child wrote \"%s\"", buf);
+	}
+
+	/* A missing program should fail right here. */
+	args[0] = (char *)"/testbin/no-such-program";
+	args[1] = NULL;
+	pid = spawn(args[0], args, NULL, 0);
+	if (pid >= 0 || errno != ENOENT) {
+		errx(1, "FAILED: spawn of missing program didn't fail "
+		     "with ENOENT");
+	}
+
+	printf("spawntest: passed\n");
+	return 0;
+}
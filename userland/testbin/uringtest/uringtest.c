@@ -0,0 +1,350 @@
+/*
+ * uringtest - test uring_enter().
+ *
+ * Opens a file, writes and reads it back, seeks and closes it, all
+ * through the rings, checking that entries run in order and that
+ * each completion carries its entry's data and result. Checks the
+ * errors, wrapping around the queues, and that a full completion
+ * queue stops submission. Then times small pwrites and lseeks done
+ * with plain system calls against the same done through the rings,
+ * and prints the rates.
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#define FILENAME	"uringtest.dat"
+#define NSQ		32
+#define NCQ		64
+#define CHUNK		16
+#define NCHUNKS		8
+#define NOPS		4096
+
+/* The ring area: header, then submissions, then completions. */
+static struct {
+	struct uring hdr;
+	struct uring_sqe sq[NSQ];
+	struct uring_cqe cq[NCQ];
+} ringmem;
+
+static struct uring *ring = &ringmem.hdr;
+static char buf[NCHUNKS][CHUNK];
+
+static
+void
+ring_init(void)
+{
+	memset(&ringmem, 0, sizeof(ringmem));
+	ring->u_sqmask = NSQ - 1;
+	ring->u_cqmask = NCQ - 1;
+	if (URING_SQ(ring) != ringmem.sq || URING_CQ(ring) != ringmem.cq) {
+		errx(1, "FAILED: ring layout doesn't match URING_SQ/URING_CQ");
+	}
+}
+
+/*
+ * Queue an entry.
+ */
+static
+void
+queue(int op, int fd, void *ubuf, unsigned len, off_t off, int flags,
+      unsigned data)
+{
+	struct uring_sqe *sqe;
+
+	if (ring->u_sqtail - ring->u_sqhead >= NSQ) {
+		errx(1, "queue: submission queue full");
+	}
+	sqe = &URING_SQ(ring)[ring->u_sqtail & ring->u_sqmask];
+	sqe->sqe_op = op;
+	sqe->sqe_fd = fd;
+	sqe->sqe_buf = ubuf;
+	sqe->sqe_len = len;
+	sqe->sqe_off = off;
+	sqe->sqe_flags = flags;
+	sqe->sqe_mode = 0664;
+	sqe->sqe_data = data;
+	ring->u_sqtail++;
+}
+
+/*
+ * Run everything queued; it all has to go.
+ */
+static
+void
+submit(void)
+{
+	unsigned queued;
+	int r;
+
+	queued = ring->u_sqtail - ring->u_sqhead;
+	r = uring_enter(ring, queued);
+	if (r < 0) {
+		err(1, "uring_enter");
+	}
+	if ((unsigned)r != queued || ring->u_sqhead != ring->u_sqtail) {
+		errx(1, "FAILED: submitted %d of %u", r, queued);
+	}
+}
+
+/*
+ * Take the next completion, which should be for DATA; returns its
+ * result.
+ */
+static
+long long
+reap(unsigned data)
+{
+	struct uring_cqe *cqe;
+
+	if (ring->u_cqhead == ring->u_cqtail) {
+		errx(1, "FAILED: no completion for entry %u", data);
+	}
+	cqe = &URING_CQ(ring)[ring->u_cqhead & ring->u_cqmask];
+	if (cqe->cqe_data != data) {
+		errx(1, "FAILED: completion for %u, expected %u",
+		     (unsigned)cqe->cqe_data, data);
+	}
+	ring->u_cqhead++;
+	return cqe->cqe_res;
+}
+
+static
+void
+expect(unsigned data, long long want)
+{
+	long long res;
+
+	res = reap(data);
+	if (res != want) {
+		errx(1, "FAILED: entry %u gave %lld, expected %lld",
+		     data, res, want);
+	}
+}
+
+static
+void
+test_io(void)
+{
+	char rbuf[CHUNK];
+	int fd, i, j;
+
+	ring_init();
+
+	queue(URING_OP_OPEN, -1, (void *)FILENAME, 0, 0,
+	      O_RDWR|O_CREAT|O_TRUNC, 0);
+	submit();
+	fd = reap(0);
+	if (fd < 0) {
+		errx(1, "FAILED: open through ring: %s", strerror(-fd));
+	}
+
+	/* Write the chunks backwards with pwrite, then find the end. */
+	for (i=0; i<NCHUNKS; i++) {
+		for (j=0; j<CHUNK; j++) {
+			buf[i][j] = 'a' + i + j;
+		}
+	}
+	for (i=NCHUNKS-1; i>=0; i--) {
+		queue(URING_OP_PWRITE, fd, buf[i], CHUNK, i * CHUNK, 0, i);
+	}
+	queue(URING_OP_LSEEK, fd, NULL, 0, 0, SEEK_END, 100);
+	submit();
+	for (i=NCHUNKS-1; i>=0; i--) {
+		expect(i, CHUNK);
+	}
+	expect(100, NCHUNKS * CHUNK);
+
+	/* These only work if the entries run in order. */
+	queue(URING_OP_LSEEK, fd, NULL, 0, CHUNK, SEEK_SET, 101);
+	queue(URING_OP_READ, fd, rbuf, CHUNK, 0, 0, 102);
+	queue(URING_OP_LSEEK, fd, NULL, 0, 0, SEEK_CUR, 103);
+	submit();
+	expect(101, CHUNK);
+	expect(102, CHUNK);
+	expect(103, 2 * CHUNK);
+	if (memcmp(rbuf, buf[1], CHUNK) != 0) {
+		errx(1, "FAILED: read after lseek got the wrong data");
+	}
+	for (i=0; i<NCHUNKS; i++) {
+		if (pread(fd, rbuf, CHUNK, i * CHUNK) != CHUNK ||
+		    memcmp(rbuf, buf[i], CHUNK) != 0) {
+			errx(1, "FAILED: chunk %d wrong in the file", i);
+		}
+	}
+
+	/* Errors come back per entry and don't stop the batch. */
+	queue(URING_OP_CLOSE, fd, NULL, 0, 0, 0, 200);
+	queue(URING_OP_READ, fd, rbuf, CHUNK, 0, 0, 201);
+	queue(99, -1, NULL, 0, 0, 0, 202);
+	queue(URING_OP_OPEN, -1, (void *)"uringtest.nonexistent", 0, 0,
+	      O_RDONLY, 203);
+	queue(URING_OP_NOP, -1, NULL, 0, 0, 0, 204);
+	submit();
+	expect(200, 0);
+	expect(201, -EBADF);
+	expect(202, -EINVAL);
+	expect(203, -ENOENT);
+	expect(204, 0);
+
+	remove(FILENAME);
+	printf("uringtest: I/O through the rings ok\n");
+}
+
+static
+void
+test_full(void)
+{
+	unsigned i, round, data;
+	int r;
+
+	ring_init();
+
+	/* Go around the queues many times. */
+	data = 0;
+	for (round=0; round<50; round++) {
+		for (i=0; i<NSQ; i++) {
+			queue(URING_OP_NOP, -1, NULL, 0, 0, 0, data + i);
+		}
+		submit();
+		for (i=0; i<NSQ; i++) {
+			expect(data + i, 0);
+		}
+		data += NSQ;
+	}
+
+	/* Fill the completion queue; then nothing more can run. */
+	for (round=0; round<NCQ/NSQ; round++) {
+		for (i=0; i<NSQ; i++) {
+			queue(URING_OP_NOP, -1, NULL, 0, 0, 0, data++);
+		}
+		submit();
+	}
+	queue(URING_OP_NOP, -1, NULL, 0, 0, 0, data);
+	r = uring_enter(ring, 1);
+	if (r != -1 || errno != EBUSY) {
+		errx(1, "FAILED: uring_enter with full completions gave %d",
+		     r);
+	}
+	for (i=0; i<NCQ; i++) {
+		expect(data - NCQ + i, 0);
+	}
+	submit();
+	expect(data, 0);
+
+	/* Bad rings. */
+	ring->u_sqmask = 5;
+	r = uring_enter(ring, 1);
+	if (r != -1 || errno != EINVAL) {
+		errx(1, "FAILED: ring of 6 entries gave %d", r);
+	}
+	r = uring_enter(NULL, 1);
+	if (r != -1 || errno != EFAULT) {
+		errx(1, "FAILED: NULL ring gave %d", r);
+	}
+	printf("uringtest: wraparound and full queues ok\n");
+}
+
+static
+unsigned long
+msecs_since(time_t s0, unsigned long ns0)
+{
+	time_t s1;
+	unsigned long ns1;
+
+	__time(&s1, &ns1);
+	return (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+}
+
+static
+unsigned long
+rate(unsigned long ms)
+{
+	return ms == 0 ? 0 : NOPS * 1000UL / ms;
+}
+
+/*
+ * Do NOPS of OP (pwrite or lseek) on FD, with plain calls or in
+ * batches of NSQ through the rings; returns milliseconds taken.
+ */
+static
+unsigned long
+timeops(int fd, int op, int batched)
+{
+	time_t s0;
+	unsigned long ns0;
+	unsigned i, j;
+
+	ring_init();
+	__time(&s0, &ns0);
+	for (i=0; i<NOPS; i+=NSQ) {
+		for (j=0; j<NSQ; j++) {
+			if (batched) {
+				queue(op, fd, buf[0], CHUNK, j * CHUNK,
+				      SEEK_SET, j);
+			}
+			else if (op == URING_OP_PWRITE) {
+				if (pwrite(fd, buf[0], CHUNK, j * CHUNK)
+				    != CHUNK) {
+					err(1, "pwrite");
+				}
+			}
+			else {
+				if (lseek(fd, j * CHUNK, SEEK_SET) < 0) {
+					err(1, "lseek");
+				}
+			}
+		}
+		if (batched) {
+			submit();
+			for (j=0; j<NSQ; j++) {
+				if (reap(j) < 0) {
+					errx(1, "FAILED: batched op failed");
+				}
+			}
+		}
+	}
+	return msecs_since(s0, ns0);
+}
+
+static
+void
+bench(void)
+{
+	unsigned long ms[4];
+	int fd;
+
+	fd = open(FILENAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	ms[0] = timeops(fd, URING_OP_PWRITE, 0);
+	ms[1] = timeops(fd, URING_OP_PWRITE, 1);
+	ms[2] = timeops(fd, URING_OP_LSEEK, 0);
+	ms[3] = timeops(fd, URING_OP_LSEEK, 1);
+	close(fd);
+	remove(FILENAME);
+
+	printf("uringtest: %d %d-byte pwrites: syscalls %lu ms (%lu/s), "
+	       "rings %lu ms (%lu/s)\n", NOPS, CHUNK,
+	       ms[0], rate(ms[0]), ms[1], rate(ms[1]));
+	printf("uringtest: %d lseeks: syscalls %lu ms (%lu/s), "
+	       "rings %lu ms (%lu/s)\n", NOPS,
+	       ms[2], rate(ms[2]), ms[3], rate(ms[3]));
+}
+
+int
+main(void)
+{
+	test_io();
+	test_full();
+	bench();
+
+	printf("uringtest: passed\n");
+	return 0;
+}
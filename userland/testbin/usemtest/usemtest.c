@@ -376,6 +376,76 @@ conctest(void)
 	}
 }
 
+/*
+ * Batched version of conctest: start all the children with one
+ * semop() and wait for all of them with another.
+ */
+static
+void
+batchparent(struct usem *gosems, struct usem *waitsems)
+{
+	struct sembuf goops[NUMJOBS], waitops[NUMJOBS];
+	unsigned i, j;
+
+	for (i=0; i<NUMJOBS; i++) {
+		goops[i].sem_fd = gosems[i].fd;
+		goops[i].sem_op = 1;
+		waitops[i].sem_fd = waitsems[i].fd;
+		waitops[i].sem_op = -1;
+	}
+
+	for (j=0; j<LOOPS; j++) {
+		if (semop(goops, NUMJOBS) < 0) {
+			err(1, "semop (V)");
+		}
+		if (semop(waitops, NUMJOBS) < 0) {
+			err(1, "semop (P)");
+		}
+		putchar('\n');
+	}
+}
+
+static
+void
+batchtest(void)
+{
+	unsigned i;
+	struct usem gosems[NUMJOBS], waitsems[NUMJOBS];
+	pid_t pids[NUMJOBS];
+
+	say("All together now...\n");
+
+	for (i=0; i<NUMJOBS; i++) {
+		usem_init(&gosems[i], "g", i);
+		usem_init(&waitsems[i], "w", i);
+		usem_open(&gosems[i]);
+		usem_open(&waitsems[i]);
+	}
+
+	for (i=0; i<NUMJOBS; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			child_plain(&gosems[i], &waitsems[i], i);
+			_exit(0);
+		}
+	}
+	batchparent(gosems, waitsems);
+
+	for (i=0; i<NUMJOBS; i++) {
+		dowait(pids[i], i);
+	}
+
+	for (i=0; i<NUMJOBS; i++) {
+		usem_close(&gosems[i]);
+		usem_close(&waitsems[i]);
+		usem_cleanup(&gosems[i]);
+		usem_cleanup(&waitsems[i]);
+	}
+}
+
 ////////////////////////////////////////////////////////////
 // concurrent use test
 
@@ -384,6 +454,7 @@ main(void)
 {
 	basetest();
 	conctest();
+	batchtest();
 	say("Passed.\n");
 	return 0;
 }
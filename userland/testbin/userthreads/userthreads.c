@@ -80,7 +80,9 @@ main(int argc, char *argv[])
     }
 
     printf("Parent has left.\n");
-    return 0;
+
+    /* Returning would call exit() and take the other threads with us. */
+    threadexit();
 }
 
 /* multiple threads will simply print out the global variable.